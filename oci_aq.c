@@ -34,19 +34,23 @@ value caml_oci_get_tdo(value env, value handles, value type_name) {
   CAMLparam3(env, handles, type_name);
   OCIEnv* e = Oci_env_val(env);
   oci_handles_t h = Oci_handles_val(handles);
-  char* t = String_val(type_name);
+  char* t = strdup(String_val(type_name));
 #ifdef DEBUG
   char dbuf[256]; snprintf(dbuf, 255, "caml_oci_get_tdo: getting TDO for type '%s'", t); debug(dbuf);
 #endif
   sword x;
   c_alloc_t tdo = {NULL, 1};
 
-  /* use the current schema for the type if object, else if RAW the use the AQ schema */
+  /* use the current schema for the type if object, else if RAW the use the AQ schema.
+     Pinned for the process, as the TDO is cached for every session of the login */
+  caml_release_runtime_system();
   if (strncmp(t, "RAW", 3) == 0) {
-    x = OCITypeByName(e, h.err, h.svc, (text*)"SYS", strlen("SYS"), (text*)t, strlen(t), (text*)0, 0, OCI_DURATION_SESSION, OCI_TYPEGET_ALL, (OCIType**)&tdo.ptr);
+    x = OCITypeByName(e, h.err, h.svc, (text*)"SYS", strlen("SYS"), (text*)t, strlen(t), (text*)0, 0, OCI_DURATION_PROCESS, OCI_TYPEGET_ALL, (OCIType**)&tdo.ptr);
   } else {
-    x = OCITypeByName(e, h.err, h.svc, NULL, 0, (text*)t, strlen(t), (text*)0, 0, OCI_DURATION_SESSION, OCI_TYPEGET_ALL, (OCIType**)&tdo.ptr);
+    x = OCITypeByName(e, h.err, h.svc, NULL, 0, (text*)t, strlen(t), (text*)0, 0, OCI_DURATION_PROCESS, OCI_TYPEGET_ALL, (OCIType**)&tdo.ptr);
   }
+  caml_acquire_runtime_system();
+  free(t);
   CHECK_OCI(x, h);
 
   value v = caml_alloc_custom(&c_alloc_t_custom_ops, sizeof(c_alloc_t), 0, 1);
@@ -87,18 +91,17 @@ value caml_oci_int_from_number(value handles, value cht, value offset) {
   c_alloc_t t = C_alloc_val(cht);
   int o = Int_val(offset);
 
-  OCINumber* on = (OCINumber*)malloc(sizeof(OCINumber));
-  memcpy(&on, &t.ptr + o, sizeof(OCINumber));
+  OCINumber on;
+  memcpy(&on, (char*)t.ptr + o, sizeof(OCINumber));
   int test;
 #ifdef DEBUG
   char dbuf[256]; snprintf(dbuf, 255, "caml_oci_int_from_number: entered t.ptr=%p", t.ptr); debug(dbuf);
 #endif
-  sword x = OCINumberToInt(h.err, on, sizeof(int), OCI_NUMBER_SIGNED, &test);
+  sword x = OCINumberToInt(h.err, &on, sizeof(int), OCI_NUMBER_SIGNED, &test);
   CHECK_OCI(x, h);
 #ifdef DEBUG
   snprintf(dbuf, 255, "caml_oci_int_from_number: retrieved number from payload as %d", test); debug(dbuf);
 #endif
-  //free(on);
   CAMLreturn(Val_int(test));
 }
 
@@ -110,7 +113,7 @@ value caml_oci_flt_from_number(value handles, value cht, value offset) {
   int o = Int_val(offset);
 
   OCINumber on;
-  memcpy(&on, &t.ptr + o, sizeof(OCINumber));
+  memcpy(&on, (char*)t.ptr + o, sizeof(OCINumber));
   double test;
   sword x = OCINumberToReal(h.err, &on, sizeof(double), &test);
   CHECK_OCI(x, h);
@@ -131,19 +134,105 @@ value caml_oci_string_from_string(value env, value cht) {
   CAMLreturn(caml_copy_string((char*)OCIStringPtr(e, t.ptr)));
 }
 
-/* actually enqueue the message */
-value caml_oci_aq_enqueue(value handles, value queue_name, value message_tdo, value message, value null_message) {
-  CAMLparam5(handles, queue_name, message_tdo, message, null_message);
+#define ALIGN_TO(o, a) ((((o) + (a) - 1) / (a)) * (a))
+
+/* work out from the TDO where each attribute of an object message goes, laid
+   out as the C struct OTT would generate for it, followed by the null 
+   indicator struct (one OCIInd for the object, then one per attribute) so 
+   that a payload is a single allocation. Returns (kinds, offsets, null offset, 
+   total size), kind 0 for a string and 1 for a number */
+value caml_oci_aq_layout(value env, value handles, value message_tdo) {
+  CAMLparam3(env, handles, message_tdo);
+  CAMLlocal3(kinds, offsets, rv);
+  OCIEnv* e = Oci_env_val(env);
   oci_handles_t h = Oci_handles_val(handles);
-  char* qn = String_val(queue_name);
+  c_alloc_t mt = C_alloc_val(message_tdo);
+  ub4 n = OCITypeAttrs(e, h.err, (OCIType*)mt.ptr);
+  ub4 i;
+  size_t o = 0;
+  sword x;
+
+  kinds = caml_alloc(n, 0);
+  offsets = caml_alloc(n, 0);
+  for (i = 0; i < n; i++) {
+    OCITypeElem* elem = NULL;
+    x = OCITypeAttrByPos(e, h.err, (OCIType*)mt.ptr, i + 1, &elem);
+    CHECK_OCI(x, h);
+    switch (OCITypeElemTypeCode(e, h.err, elem)) {
+    case OCI_TYPECODE_VARCHAR2:
+    case OCI_TYPECODE_VARCHAR:
+    case OCI_TYPECODE_CHAR:
+      o = ALIGN_TO(o, sizeof(OCIString*));
+      Store_field(kinds, i, Val_int(0));
+      Store_field(offsets, i, Val_int(o));
+      o += sizeof(OCIString*);
+      break;
+    case OCI_TYPECODE_NUMBER:
+    case OCI_TYPECODE_INTEGER:
+    case OCI_TYPECODE_SMALLINT:
+    case OCI_TYPECODE_DECIMAL:
+    case OCI_TYPECODE_FLOAT:
+    case OCI_TYPECODE_REAL:
+    case OCI_TYPECODE_DOUBLE:
+      Store_field(kinds, i, Val_int(1));
+      Store_field(offsets, i, Val_int(o));
+      o += sizeof(OCINumber);
+      break;
+    default:
+      caml_invalid_argument("caml_oci_aq_layout: message type has an attribute of a type not supported in AQ messages");
+    }
+  }
+  o = ALIGN_TO(o, sizeof(void*));
+#ifdef DEBUG
+  char dbuf[256]; snprintf(dbuf, 255, "caml_oci_aq_layout: %d attributes, payload %d bytes, null struct %d bytes", n, (int)o, (int)((n + 1) * sizeof(OCIInd))); debug(dbuf);
+#endif
+
+  rv = caml_alloc_tuple(4);
+  Store_field(rv, 0, kinds);
+  Store_field(rv, 1, offsets);
+  Store_field(rv, 2, Val_int(o));
+  Store_field(rv, 3, Val_int(o + (n + 1) * sizeof(OCIInd)));
+  CAMLreturn(rv);
+}
+
+/* write/read the null indicator at position i of a null struct starting at
+   offset bytes from cht.ptr. Position 0 is the object itself */
+value caml_oci_write_ind(value cht, value offset, value i, value ind) {
+  CAMLparam4(cht, offset, i, ind);
+  c_alloc_t c = C_alloc_val(cht);
+  OCIInd* np = (OCIInd*)((char*)c.ptr + Int_val(offset));
+  np[Int_val(i)] = (OCIInd)Int_val(ind);
+  CAMLreturn(Val_unit);
+}
+
+value caml_oci_read_ind(value cht, value offset, value i) {
+  CAMLparam3(cht, offset, i);
+  c_alloc_t c = C_alloc_val(cht);
+  if (c.ptr == NULL) {
+    CAMLreturn(Val_int(OCI_IND_NOTNULL));
+  }
+  OCIInd* np = (OCIInd*)((char*)c.ptr + Int_val(offset));
+  CAMLreturn(Val_int(np[Int_val(i)]));
+}
+
+/* actually enqueue the message - the null struct is in the same buffer as the 
+   payload, at null_offset */
+value caml_oci_aq_enqueue(value handles, value queue_name, value message_tdo, value message, value null_offset) {
+  CAMLparam5(handles, queue_name, message_tdo, message, null_offset);
+  oci_handles_t h = Oci_handles_val(handles);
+  char* qn = strdup(String_val(queue_name));
   c_alloc_t mt = C_alloc_val(message_tdo);
   c_alloc_t m = C_alloc_val(message);
-  c_alloc_t nm = C_alloc_val(null_message);
+  c_alloc_t nm = {(char*)m.ptr + Int_val(null_offset), 1};
+  sword x;
 #ifdef DEBUG
   char dbuf[256]; snprintf(dbuf, 255, "caml_oci_aq_enqueue: enqueueing message on '%s'",  qn); debug(dbuf);
 #endif
 
-  sword x = OCIAQEnq(h.svc, h.err, (text*)qn, 0, 0, mt.ptr, (dvoid**)&m.ptr, (dvoid**)&nm.ptr, 0, 0);
+  caml_release_runtime_system();
+  x = OCIAQEnq(h.svc, h.err, (text*)qn, 0, 0, mt.ptr, (dvoid**)&m.ptr, (dvoid**)&nm.ptr, 0, 0);
+  caml_acquire_runtime_system();
+  free(qn);
   CHECK_OCI(x, h);
 #ifdef DEBUG
   debug("caml_oci_aq_enqueue: message enqueued successfully");
@@ -156,9 +245,9 @@ value caml_oci_aq_enqueue_raw(value env, value handles, value queue_name, value
   CAMLparam5(env, handles, queue_name, message_tdo, message);
   OCIEnv* e = Oci_env_val(env);
   oci_handles_t h = Oci_handles_val(handles);
-  char* qn = String_val(queue_name);
+  char* qn = strdup(String_val(queue_name));
   c_alloc_t mt = C_alloc_val(message_tdo);
-  char* m = String_val(message);
+  char* m = String_val(message); /* copied into the raw before the runtime is released */
   sword x;
 #ifdef DEBUG
   char dbuf[256]; snprintf(dbuf, 255, "caml_oci_aq_enqueue_raw: enqueueing message on '%s'",  qn); debug(dbuf);
@@ -173,7 +262,10 @@ value caml_oci_aq_enqueue_raw(value env, value handles, value queue_name, value
   /* enqueue the payload */
   OCIInd ind = 0; 
   dvoid *indptr = (dvoid *)&ind;
+  caml_release_runtime_system();
   x = OCIAQEnq(h.svc, h.err, (text*)qn, 0, 0, mt.ptr, (dvoid**)&raw, (dvoid**)&indptr, 0, 0);
+  caml_acquire_runtime_system();
+  free(qn);
   CHECK_OCI(x, h);
 #ifdef DEBUG
   debug("caml_oci_aq_enqueue_raw: message enqueued");
@@ -181,12 +273,28 @@ value caml_oci_aq_enqueue_raw(value env, value handles, value queue_name, value
   CAMLreturn(Val_unit);
 }
 
+/* a dequeued payload and its null struct, both in the object cache */
+static value aq_payload_pair(void* payload, void* ind) {
+  CAMLparam0();
+  CAMLlocal3(rv, p, n);
+  c_alloc_t pc = {payload, 1};
+  c_alloc_t nc = {ind, 1};
+  p = caml_alloc_custom(&c_alloc_t_custom_ops, sizeof(c_alloc_t), 0, 1);
+  C_alloc_val(p) = pc;
+  n = caml_alloc_custom(&c_alloc_t_custom_ops, sizeof(c_alloc_t), 0, 1);
+  C_alloc_val(n) = nc;
+  rv = caml_alloc_tuple(2);
+  Store_field(rv, 0, p);
+  Store_field(rv, 1, n);
+  CAMLreturn(rv);
+}
+
 /* dequeue a message */
 value caml_oci_aq_dequeue(value env, value handles, value queue_name, value message_tdo, value timeout) {
   CAMLparam5(env, handles, queue_name, message_tdo, timeout);
   OCIEnv* e = Oci_env_val(env);
   oci_handles_t h = Oci_handles_val(handles);
-  char* qn = String_val(queue_name);
+  char* qn = strdup(String_val(queue_name));
   c_alloc_t mt = C_alloc_val(message_tdo);
   int to = Int_val(timeout);
   sword x;
@@ -209,6 +317,7 @@ value caml_oci_aq_dequeue(value env, value handles, value queue_name, value mess
   caml_release_runtime_system();
   x = OCIAQDeq(h.svc, h.err, (text*)qn, deqopt, 0, mt.ptr, (dvoid**)&msg_buf.ptr, (dvoid**)&ind_buf, 0, 0);
   caml_acquire_runtime_system();
+  free(qn);
   CHECK_OCI(x, h);
   OCIDescriptorFree((dvoid *)deqopt, OCI_DTYPE_AQDEQ_OPTIONS);
 
@@ -216,9 +325,7 @@ value caml_oci_aq_dequeue(value env, value handles, value queue_name, value mess
   snprintf(dbuf, 255, "pointer msg_buf.ptr=%p timeout=%d", msg_buf.ptr, to); debug(dbuf);
 #endif
   
-  value v = caml_alloc_custom(&c_alloc_t_custom_ops, sizeof(c_alloc_t), 0, 1);
-  C_alloc_val(v) = msg_buf;
-  CAMLreturn(v);
+  CAMLreturn(aq_payload_pair(msg_buf.ptr, ind_buf));
 }
 
 value caml_oci_aq_dequeue_raw(value env, value handles, value queue_name, value message_tdo, value timeout) {
@@ -226,7 +333,7 @@ value caml_oci_aq_dequeue_raw(value env, value handles, value queue_name, value
   CAMLlocal1(dqm);
   OCIEnv* e = Oci_env_val(env);
   oci_handles_t h = Oci_handles_val(handles);
-  char* qn = String_val(queue_name);
+  char* qn = strdup(String_val(queue_name));
   c_alloc_t mt = C_alloc_val(message_tdo);
   int to = Int_val(timeout);
   sword x;
@@ -252,6 +359,7 @@ value caml_oci_aq_dequeue_raw(value env, value handles, value queue_name, value
   caml_release_runtime_system();
   x = OCIAQDeq(h.svc, h.err, (text*)qn, deqopt, 0, mt.ptr, (dvoid**)&raw, (void**)&indptr, 0, 0);
   caml_acquire_runtime_system();
+  free(qn);
   CHECK_OCI(x, h);
   OCIDescriptorFree((dvoid *)deqopt, OCI_DTYPE_AQDEQ_OPTIONS);
 
@@ -267,4 +375,232 @@ value caml_oci_aq_dequeue_raw(value env, value handles, value queue_name, value
   CAMLreturn(dqm);
 }
 
+/* array enqueue - payloads built in OCaml as for caml_oci_aq_enqueue, all 
+   sent in one round trip. Returns the number enqueued */
+value caml_oci_aq_enqueue_array(value handles, value queue_name, value message_tdo, value messages, value null_offset) {
+  CAMLparam5(handles, queue_name, message_tdo, messages, null_offset);
+  oci_handles_t h = Oci_handles_val(handles);
+  c_alloc_t mt = C_alloc_val(message_tdo);
+  int no = Int_val(null_offset);
+  ub4 n = Wosize_val(messages);
+  ub4 i;
+  sword x;
+
+  if (n == 0) {
+    CAMLreturn(Val_int(0));
+  }
+
+  char* qn = strdup(String_val(queue_name));
+  dvoid** m = (dvoid**)malloc(n * sizeof(dvoid*));
+  dvoid** nm = (dvoid**)malloc(n * sizeof(dvoid*));
+  for (i = 0; i < n; i++) {
+    m[i] = C_alloc_val(Field(messages, i)).ptr;
+    nm[i] = (char*)m[i] + no;
+  }
+#ifdef DEBUG
+  char dbuf[256]; snprintf(dbuf, 255, "caml_oci_aq_enqueue_array: enqueueing %d messages on '%s'", n, qn); debug(dbuf);
+#endif
+
+  caml_release_runtime_system();
+  x = OCIAQEnqArray(h.svc, h.err, (text*)qn, 0, &n, 0, mt.ptr, m, nm, 0, 0, 0, 0);
+  caml_acquire_runtime_system();
+  free(qn);
+  free(m);
+  free(nm);
+  CHECK_OCI(x, h);
+  CAMLreturn(Val_int(n));
+}
+
+/* array enqueue of RAW messages, one string each */
+value caml_oci_aq_enqueue_raw_array(value env, value handles, value queue_name, value message_tdo, value messages) {
+  CAMLparam5(env, handles, queue_name, message_tdo, messages);
+  OCIEnv* e = Oci_env_val(env);
+  oci_handles_t h = Oci_handles_val(handles);
+  c_alloc_t mt = C_alloc_val(message_tdo);
+  ub4 n = Wosize_val(messages);
+  ub4 count = n;
+  ub4 i;
+  sword x = OCI_SUCCESS;
+
+  if (n == 0) {
+    CAMLreturn(Val_int(0));
+  }
+
+  /* copy every payload into a raw before the runtime is released */
+  OCIRaw** raws = (OCIRaw**)calloc(n, sizeof(OCIRaw*));
+  OCIInd* inds = (OCIInd*)calloc(n, sizeof(OCIInd));
+  dvoid** indp = (dvoid**)malloc(n * sizeof(dvoid*));
+  for (i = 0; i < n && x == OCI_SUCCESS; i++) {
+    value m = Field(messages, i);
+    x = OCIRawAssignBytes(e, h.err, (ub1*)String_val(m), (ub4)caml_string_length(m), &raws[i]);
+    indp[i] = (dvoid*)&inds[i];
+  }
+
+  char* qn = strdup(String_val(queue_name));
+#ifdef DEBUG
+  char dbuf[256]; snprintf(dbuf, 255, "caml_oci_aq_enqueue_raw_array: enqueueing %d messages on '%s'", n, qn); debug(dbuf);
+#endif
+  if (x == OCI_SUCCESS) {
+    caml_release_runtime_system();
+    x = OCIAQEnqArray(h.svc, h.err, (text*)qn, 0, &count, 0, mt.ptr, (dvoid**)raws, indp, 0, 0, 0, 0);
+    caml_acquire_runtime_system();
+  }
+  free(qn);
+
+  /* the raws live in the object cache for the session unless resized to 0 */
+  for (i = 0; i < n; i++) {
+    if (raws[i] != NULL) {
+      OCIRawResize(e, h.err, 0, &raws[i]);
+    }
+  }
+  free(raws);
+  free(inds);
+  free(indp);
+  CHECK_OCI(x, h);
+  CAMLreturn(Val_int(count));
+}
+
+/* dequeue up to max messages in one round trip, waiting up to timeout seconds
+   for the first one only - OCIAQDeqArray returns as soon as any are available.
+   If an error comes after some messages were dequeued they are returned and
+   the caller passes the error back with them (aq_array_error), raising only
+   when *n is 0. Nothing is raised here, so the caller can free its arrays 
+   first */
+static sword oci_aq_dequeue_array(OCIEnv* e, oci_handles_t h, value queue_name, c_alloc_t mt, value wait, dvoid** msgs, dvoid** inds, ub4* n) {
+  int to = Int_val(Field(wait, 0));
+  sword x;
+
+  OCIAQDeqOptions  *deqopt    = (OCIAQDeqOptions *)0;
+  x = OCIDescriptorAlloc(e, (dvoid **)&deqopt, OCI_DTYPE_AQDEQ_OPTIONS, 0, (dvoid **)0);
+  if (x != OCI_SUCCESS) {
+    *n = 0;
+    return x;
+  }
+  if (to > -1) {
+    x = OCIAttrSet(deqopt, OCI_DTYPE_AQDEQ_OPTIONS, (dvoid *)&to, 0, OCI_ATTR_WAIT, h.err);
+    if (x != OCI_SUCCESS) {
+      OCIDescriptorFree((dvoid *)deqopt, OCI_DTYPE_AQDEQ_OPTIONS);
+      *n = 0;
+      return x;
+    }
+  }
+
+  char* qn = strdup(String_val(queue_name));
+#ifdef DEBUG
+  char dbuf[256]; snprintf(dbuf, 255, "oci_aq_dequeue_array: dequeueing up to %d messages from '%s'", *n, qn); debug(dbuf);
+#endif
+  caml_release_runtime_system();
+  x = OCIAQDeqArray(h.svc, h.err, (text*)qn, deqopt, n, 0, mt.ptr, msgs, inds, 0, 0, 0, 0);
+  caml_acquire_runtime_system();
+  free(qn);
+  OCIDescriptorFree((dvoid *)deqopt, OCI_DTYPE_AQDEQ_OPTIONS);
+#ifdef DEBUG
+  snprintf(dbuf, 255, "oci_aq_dequeue_array: dequeued %d messages", *n); debug(dbuf);
+#endif
+  return x;
+}
+
+/* an array dequeue can fail part way and still return messages, so take the
+   error off the handle before anything else uses it, or 0 and "" if none */
+static void aq_array_error(oci_handles_t h, sword x, ub4 n, char* errbuf, sb4* errcode) {
+  *errcode = 0;
+  errbuf[0] = '\0';
+  if (x != OCI_SUCCESS && x != OCI_SUCCESS_WITH_INFO) {
+    OCIErrorGet(h.err, 1, NULL, errcode, (OraText*)errbuf, 256, OCI_HTYPE_ERROR);
+    size_t len = strlen(errbuf);
+    if (len > 0 && errbuf[len - 1] == '\n') { errbuf[len - 1] = '\0'; }
+#ifdef DEBUG
+    char dbuf[300]; snprintf(dbuf, 299, "aq_array_error: error after %d messages: %s", n, errbuf); debug(dbuf);
+#endif
+  }
+}
+
+/* the messages of an array dequeue with that error, for the caller to raise 
+   next time as it is still owed these */
+static value aq_array_result(value msgs, sb4 errcode, char* errbuf) {
+  CAMLparam1(msgs);
+  CAMLlocal1(rv);
+  rv = caml_alloc_tuple(3);
+  Store_field(rv, 0, msgs);
+  Store_field(rv, 1, Val_int(errcode));
+  Store_field(rv, 2, caml_copy_string(errbuf));
+  CAMLreturn(rv);
+}
+
+/* array dequeue of object messages - wait is (timeout, max). Payloads and
+   their null structs are in the object cache as for caml_oci_aq_dequeue */
+value caml_oci_aq_dequeue_array(value env, value handles, value queue_name, value message_tdo, value wait) {
+  CAMLparam5(env, handles, queue_name, message_tdo, wait);
+  CAMLlocal2(rv, v);
+  OCIEnv* e = Oci_env_val(env);
+  oci_handles_t h = Oci_handles_val(handles);
+  c_alloc_t mt = C_alloc_val(message_tdo);
+  int max = Int_val(Field(wait, 1));
+  ub4 i;
+  char errbuf[256];
+  sb4 errcode;
+
+  if (max < 1) {
+    caml_invalid_argument("caml_oci_aq_dequeue_array: must dequeue at least one message");
+  }
+  ub4 n = max;
+  dvoid** msgs = (dvoid**)calloc(max, sizeof(dvoid*));
+  dvoid** inds = (dvoid**)calloc(max, sizeof(dvoid*));
+  sword x = oci_aq_dequeue_array(e, h, queue_name, mt, wait, msgs, inds, &n);
+  if (n == 0) {
+    free(msgs);
+    free(inds);
+    CHECK_OCI(x, h);
+  }
+  aq_array_error(h, x, n, errbuf, &errcode);
+
+  rv = caml_alloc(n, 0);
+  for (i = 0; i < n; i++) {
+    v = aq_payload_pair(msgs[i], inds[i]);
+    Store_field(rv, i, v);
+  }
+  free(msgs);
+  free(inds);
+  CAMLreturn(aq_array_result(rv, errcode, errbuf));
+}
+
+/* array dequeue of RAW messages, returned as strings */
+value caml_oci_aq_dequeue_raw_array(value env, value handles, value queue_name, value message_tdo, value wait) {
+  CAMLparam5(env, handles, queue_name, message_tdo, wait);
+  CAMLlocal2(rv, dqm);
+  OCIEnv* e = Oci_env_val(env);
+  oci_handles_t h = Oci_handles_val(handles);
+  c_alloc_t mt = C_alloc_val(message_tdo);
+  int max = Int_val(Field(wait, 1));
+  ub4 i;
+  char errbuf[256];
+  sb4 errcode;
+
+  if (max < 1) {
+    caml_invalid_argument("caml_oci_aq_dequeue_raw_array: must dequeue at least one message");
+  }
+  ub4 n = max;
+  OCIRaw** raws = (OCIRaw**)calloc(max, sizeof(OCIRaw*));
+  dvoid** inds = (dvoid**)calloc(max, sizeof(dvoid*));
+  sword x = oci_aq_dequeue_array(e, h, queue_name, mt, wait, (dvoid**)raws, inds, &n);
+  if (n == 0) {
+    free(raws);
+    free(inds);
+    CHECK_OCI(x, h);
+  }
+  aq_array_error(h, x, n, errbuf, &errcode);
+
+  rv = caml_alloc(n, 0);
+  for (i = 0; i < n; i++) {
+    ub4 pls = OCIRawSize(e, raws[i]);
+    dqm = caml_alloc_string(pls);
+    memcpy((char*)String_val(dqm), OCIRawPtr(e, raws[i]), pls);
+    Store_field(rv, i, dqm);
+    OCIRawResize(e, h.err, 0, &raws[i]);
+  }
+  free(raws);
+  free(inds);
+  CAMLreturn(aq_array_result(rv, errcode, errbuf));
+}
+
 /* end of file */
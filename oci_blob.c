@@ -1,3 +1,243 @@
 /* functions relating to LOBs */
 
+#include <caml/mlvalues.h>
+#include <caml/memory.h>
+#include <caml/alloc.h>
+#include <caml/custom.h>
+#include <caml/callback.h>
+#include <caml/fail.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <oci.h>
+#include <ocidfn.h>
+#include "oci_wrapper.h"
+
+#if OCAML_VERSION_MINOR >= 12
+#include <caml/threads.h>
+#else
+#include <caml/signals.h>
+#endif 
+
+/* from threads.h in 3.12 only */
+#ifndef caml_acquire_runtime_system
+#define caml_acquire_runtime_system caml_leave_blocking_section
+#define caml_release_runtime_system caml_enter_blocking_section
+#endif
+
+/* freeing the descriptor of a temporary LOB frees the LOB as well */
+void caml_oci_free_lob(value lob) {
+  CAMLparam1(lob);
+  oci_lob_t* l = Oci_lob_val(lob);
+  if (l != NULL) {
+    OCIDescriptorFree(l->loc, OCI_DTYPE_LOB);
+    free(l);
+    Oci_lob_val(lob) = NULL;
+  }
+  CAMLreturn0;
+}
+
+static struct custom_operations oci_lob_custom_ops = {"oci_lob_custom_ops", &caml_oci_free_lob, NULL, NULL, NULL, NULL};
+
+/* take ownership of a locator, e.g. one just fetched into a define buffer */
+value oci_lob_wrap(oci_handles_t h, int sqlt, OCILobLocator* loc) {
+  CAMLparam0();
+  CAMLlocal1(v);
+  oci_lob_t* l = (oci_lob_t*)malloc(sizeof(oci_lob_t));
+  l->loc = loc;
+  l->h = h;
+  l->sqlt = sqlt;
+  l->offset = 0;
+  l->chunk = 0;
+
+  v = caml_alloc_custom(&oci_lob_custom_ops, sizeof(oci_lob_t*), 0, 1);
+  Oci_lob_val(v) = l;
+  CAMLreturn(v);
+}
+
+/* a new empty temporary LOB, which lasts until it is garbage collected or 
+   the session ends */
+value caml_oci_lob_create_temp(value handles, value clob) {
+  CAMLparam2(handles, clob);
+  oci_handles_t h = Oci_handles_val(handles);
+  int is_clob = Bool_val(clob);
+  OCILobLocator* loc = NULL;
+  sword x;
+
+  x = OCIDescriptorAlloc(global_env, (dvoid**)&loc, OCI_DTYPE_LOB, 0, 0);
+  if (x != OCI_SUCCESS) {
+    raise_caml_exception(-1, "caml_oci_lob_create_temp: cannot allocate LOB locator");
+  }
+
+  caml_release_runtime_system();
+  x = OCILobCreateTemporary(h.svc, h.err, loc, 0, SQLCS_IMPLICIT, is_clob ? OCI_TEMP_CLOB : OCI_TEMP_BLOB, FALSE, OCI_DURATION_SESSION);
+  caml_acquire_runtime_system();
+  if (x != OCI_SUCCESS) {
+    OCIDescriptorFree(loc, OCI_DTYPE_LOB);
+    oci_non_success(h);
+  }
+
+  CAMLreturn(oci_lob_wrap(h, is_clob ? SQLT_CLOB : SQLT_BLOB, loc));
+}
+
+value caml_oci_lob_is_clob(value lob) {
+  CAMLparam1(lob);
+  CAMLreturn(Val_bool(Oci_lob_val(lob)->sqlt == SQLT_CLOB));
+}
+
+/* length in characters for a CLOB, bytes for a BLOB - with LOB prefetch on 
+   this comes from the fetch rather than the server */
+value caml_oci_lob_length(value lob) {
+  CAMLparam1(lob);
+  oci_lob_t* l = Oci_lob_val(lob);
+  ub8 len = 0;
+  sword x;
+
+  caml_release_runtime_system();
+  x = OCILobGetLength2(l->h.svc, l->h.err, l->loc, &len);
+  caml_acquire_runtime_system();
+  CHECK_OCI(x, l->h);
+
+  CAMLreturn(Val_long(len));
+}
+
+/* the amount the server stores a LOB in, reads and writes should be a 
+   multiple of it - asked for once per locator */
+value caml_oci_lob_chunk_size(value lob) {
+  CAMLparam1(lob);
+  oci_lob_t* l = Oci_lob_val(lob);
+  ub4 chunk = 0;
+  sword x;
+
+  if (l->chunk == 0) {
+    caml_release_runtime_system();
+    x = OCILobGetChunkSize(l->h.svc, l->h.err, l->loc, &chunk);
+    caml_acquire_runtime_system();
+    CHECK_OCI(x, l->h);
+    l->chunk = chunk;
+  }
+
+  CAMLreturn(Val_long(l->chunk));
+}
+
+value caml_oci_lob_seek(value lob, value pos) {
+  CAMLparam2(lob, pos);
+  if (Long_val(pos) < 0) {
+    caml_invalid_argument("caml_oci_lob_seek: negative position");
+  }
+  Oci_lob_val(lob)->offset = (ub8)Long_val(pos);
+  CAMLreturn(Val_unit);
+}
+
+value caml_oci_lob_position(value lob) {
+  CAMLparam1(lob);
+  CAMLreturn(Val_long(Oci_lob_val(lob)->offset));
+}
+
+/* read up to len bytes from the current position into buf at off, in one 
+   round-trip, and move the position on past them. OCI reads into a buffer of 
+   its own while the runtime is released, as buf may move. Returns the bytes 
+   read, 0 at the end of the LOB. A CLOB is only ever read in whole characters */
+value caml_oci_lob_read(value lob, value buf, value off, value len) {
+  CAMLparam4(lob, buf, off, len);
+  oci_lob_t* l = Oci_lob_val(lob);
+  int o = Int_val(off);
+  int n = Int_val(len);
+  ub8 bytes = n;
+  ub8 chars = 0;
+  char* tmp;
+  sword x;
+
+  if (o < 0 || n < 0 || o + n > caml_string_length(buf)) {
+    caml_invalid_argument("caml_oci_lob_read: range outside buffer");
+  }
+  if (n == 0) {
+    CAMLreturn(Val_int(0));
+  }
+
+  tmp = (char*)malloc(n);
+  caml_release_runtime_system();
+  x = OCILobRead2(l->h.svc, l->h.err, l->loc, &bytes, &chars, l->offset + 1, tmp, n, OCI_ONE_PIECE, NULL, NULL, 0, SQLCS_IMPLICIT);
+  caml_acquire_runtime_system();
+  if (x == OCI_NO_DATA) {
+    bytes = 0;
+    chars = 0;
+  } else if (x != OCI_SUCCESS) {
+    free(tmp);
+    oci_non_success(l->h);
+  }
+
+  memcpy(Bytes_val(buf) + o, tmp, bytes);
+  free(tmp);
+  l->offset += (l->sqlt == SQLT_CLOB && chars > 0) ? chars : bytes;
+#ifdef DEBUG
+  char dbuf[256]; snprintf(dbuf, 255, "caml_oci_lob_read: read %llu bytes, now at %llu", (unsigned long long)bytes, (unsigned long long)l->offset); debug(dbuf);
+#endif
+
+  CAMLreturn(Val_long(bytes));
+}
+
+/* write len bytes of s from off at the current position, overwriting what 
+   is there and extending the LOB if need be, and move the position on */
+value caml_oci_lob_write(value lob, value s, value off, value len) {
+  CAMLparam4(lob, s, off, len);
+  oci_lob_t* l = Oci_lob_val(lob);
+  int o = Int_val(off);
+  int n = Int_val(len);
+  ub8 bytes = n;
+  ub8 chars = 0;
+  char* tmp;
+  sword x;
+
+  if (o < 0 || n < 0 || o + n > caml_string_length(s)) {
+    caml_invalid_argument("caml_oci_lob_write: range outside string");
+  }
+  if (n == 0) {
+    CAMLreturn(Val_int(0));
+  }
+
+  tmp = (char*)malloc(n);
+  memcpy(tmp, String_val(s) + o, n);
+  caml_release_runtime_system();
+  x = OCILobWrite2(l->h.svc, l->h.err, l->loc, &bytes, &chars, l->offset + 1, tmp, n, OCI_ONE_PIECE, NULL, NULL, 0, SQLCS_IMPLICIT);
+  caml_acquire_runtime_system();
+  free(tmp);
+  CHECK_OCI(x, l->h);
+
+  l->offset += (l->sqlt == SQLT_CLOB && chars > 0) ? chars : bytes;
+
+  CAMLreturn(Val_long(bytes));
+}
+
+/* cut a LOB down to len characters or bytes */
+value caml_oci_lob_trim(value lob, value len) {
+  CAMLparam2(lob, len);
+  oci_lob_t* l = Oci_lob_val(lob);
+  sword x;
+
+  caml_release_runtime_system();
+  x = OCILobTrim2(l->h.svc, l->h.err, l->loc, (ub8)Long_val(len));
+  caml_acquire_runtime_system();
+  CHECK_OCI(x, l->h);
+  if (l->offset > (ub8)Long_val(len)) {
+    l->offset = Long_val(len);
+  }
+
+  CAMLreturn(Val_unit);
+}
+
+/* bytes of each LOB to send back with the rows it is fetched in, so that 
+   small LOBs need no round-trips of their own - applies to statements 
+   defined after it is set */
+value caml_oci_set_lob_prefetch(value handles, value size) {
+  CAMLparam2(handles, size);
+  oci_handles_t h = Oci_handles_val(handles);
+  ub4 n = Int_val(size);
+
+  sword x = OCIAttrSet((void*)h.ses, OCI_HTYPE_SESSION, (void*)&n, 0, OCI_ATTR_DEFAULT_LOBPREFETCH_SIZE, h.err);
+  CHECK_OCI(x, h);
+
+  CAMLreturn(Val_unit);
+}
+
 /* end of file */
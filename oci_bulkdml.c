@@ -6,9 +6,13 @@
 #include <caml/custom.h>
 #include <caml/callback.h>
 #include <caml/fail.h>
+#include <caml/bigarray.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
 #include <oci.h>
 #include <ocidfn.h>
 #include "oci_wrapper.h"
@@ -25,169 +29,367 @@
 #define caml_release_runtime_system caml_enter_blocking_section
 #endif
 
-/* sizes of the datatypes */
-value caml_oci_get_size_of_int(value unit) { CAMLparam1(unit); CAMLreturn(Val_int(sizeof(int))); }
-value caml_oci_get_size_of_float(value unit) { CAMLparam1(unit); CAMLreturn(Val_int(sizeof(double))); }
+/* constructors of bulk_column */
+#define BULK_VALUES 0
+#define BULK_INTS   1
+#define BULK_FLOATS 2
+#define BULK_DATES  3
 
-/* this is not a primitive type and will need padding to align correctly */
-value caml_oci_get_size_of_date(value unit) { 
-  CAMLparam1(unit); 
-
-  int s = sizeof(OCIDate);
-  int packed_size = ((s / sizeof(void*)) + 1) * (sizeof(void*));
-
-  CAMLreturn(Val_int(packed_size));
+/* number of rows in a bulk_column */
+int oci_bulk_column_rows(value column) {
+  value c = Field(column, 0);
+  return Tag_val(column) == BULK_VALUES ? (int)Wosize_val(c) : (int)Caml_ba_array_val(c)->dim[0];
 }
 
-/* write a native int at an offset in a heap alloc */
-value caml_oci_write_nat_int_at_offset( value cht, value offset, value newint ) {
-  CAMLparam3(cht, offset, newint);
-  c_alloc_t t = C_alloc_val(cht);
-  int o = Int_val(offset);
-  int ni = Int_val(newint);
-  
-  memcpy(t.ptr + o, &ni, sizeof(int));
-#ifdef DEBUG
-  char dbuf[256]; snprintf(dbuf, 255, "caml_oci_write_nat_int_at_offset: wrote %d at %p + %d", ni, t.ptr, o); debug(dbuf);
-#endif
-  CAMLreturn(Val_unit);
+/* write a Unix.tm into an OCIDate, normalising it as Unix.mktime would */
+static void tm_to_ocidate(value tm, OCIDate* od) {
+  struct tm ut;
+  ut.tm_sec  = Int_val(Field(tm, 0));
+  ut.tm_min  = Int_val(Field(tm, 1));
+  ut.tm_hour = Int_val(Field(tm, 2));
+  ut.tm_mday = Int_val(Field(tm, 3));
+  ut.tm_mon  = Int_val(Field(tm, 4));
+  ut.tm_year = Int_val(Field(tm, 5));
+  tm_to_epoch(&ut);
+  OCIDateSetDate(od, ut.tm_year + 1900, ut.tm_mon + 1, ut.tm_mday);
+  OCIDateSetTime(od, ut.tm_hour, ut.tm_min, ut.tm_sec);
 }
 
-/* writea native double at an offset in a heap alloc */
-value caml_oci_write_nat_flt_at_offset(value cht, value offset, value newdouble ) {
-  CAMLparam3(cht, offset, newdouble);
-  c_alloc_t t = C_alloc_val(cht);
-  int o = Int_val(offset);
-  double nd = Double_val(newdouble);
-  
-  memcpy(t.ptr + o, &nd, sizeof(double));
-  CAMLreturn(Val_unit);
+/* work out the type and width a Values column needs in one pass over it - the 
+   first non-Null value decides the type, an Integer in a Number column (or 
+   vice versa) makes it all Number, and an all-Null column goes as strings */
+static void scan_values(value vals, int* sqlt, int* width) {
+  int n = Wosize_val(vals);
+  int i, t, l;
+  int maxlen = 0;
+  int kind = -1;
+
+  for (i = 0; i < n; i++) {
+    value v = Field(vals, i);
+    if (Is_long(v)) { /* Null, or RefCursor which cannot be bound in bulk */
+      continue;
+    }
+    t = Tag_val(v);
+    if (t == COL_VARCHAR) {
+      l = caml_string_length(Field(v, 0));
+      if (l > MAXBINDLEN) {
+	caml_invalid_argument("orabindexec: string is longer than 65535 bytes, bind it as a LOB");
+      }
+      if (l > maxlen) { maxlen = l; }
+    }
+    if (kind == -1 || kind == t) {
+      kind = t;
+    } else if ((kind == COL_INTEGER && t == COL_NUMBER) || (kind == COL_NUMBER && t == COL_INTEGER)) {
+      kind = COL_NUMBER;
+    } else {
+      caml_invalid_argument("orabindexec: column mixes datatypes");
+    }
+  }
+
+  switch (kind) {
+  case COL_INTEGER:
+    *sqlt = SQLT_INT; *width = sizeof(sb8);
+    break;
+  case COL_NUMBER:
+    *sqlt = SQLT_FLT; *width = sizeof(double);
+    break;
+  case COL_DATETIME:
+    *sqlt = SQLT_ODT; *width = sizeof(OCIDate);
+    break;
+  case COL_VARCHAR:
+  case -1:
+    *sqlt = SQLT_CHR;
+    for (*width = 32; *width < maxlen; *width *= 2);
+    break;
+  default:
+    caml_invalid_argument("orabindexec: datatype cannot be bound in bulk");
+  }
 }
 
-/* write a native string (null-terminated char array) at an offset within a heap alloc */
-value caml_oci_write_chr_at_offset(value cht, value offset, value newstring) {
-  CAMLparam3(cht, offset, newstring);
-  c_alloc_t t = C_alloc_val(cht);
-  int o = Int_val(offset);
-  char* s = String_val(newstring);
+/* pack a whole column into a bind slot in one call - a col_value array or a 
+   Bigarray, with NULLs (or nan in Floats and Dates) going in the indicator 
+   array and strings packed with their lengths rather than padded. Returns 
+   true if the slot's buffers moved */
+int oci_pack_column(oci_bind_slot_t* b, value column) {
+  value c = Field(column, 0);
+  int n = oci_bulk_column_rows(column);
+  int sqlt = 0, width = 0;
+  int i, rebind;
+
+  switch (Tag_val(column)) {
+  case BULK_VALUES:
+    scan_values(c, &sqlt, &width);
+    break;
+  case BULK_INTS:
+    sqlt = SQLT_INT; width = sizeof(sb8);
+    break;
+  case BULK_FLOATS:
+    sqlt = SQLT_FLT; width = sizeof(double);
+    break;
+  case BULK_DATES:
+    sqlt = SQLT_ODT; width = sizeof(OCIDate);
+    break;
+  }
+  rebind = oci_bind_slot_reserve(b, sqlt, width, n > 0 ? n : 1);
+
+  switch (Tag_val(column)) {
+  case BULK_VALUES:
+    for (i = 0; i < n; i++) {
+      value v = Field(c, i);
+      char* p = (char*)b->ptr + (i * b->width);
+      if (Is_long(v)) {
+	b->inds[i] = -1;
+	b->lens[i] = 0;
+	continue;
+      }
+      b->inds[i] = 0;
+      switch (Tag_val(v)) {
+      case COL_VARCHAR:
+	b->lens[i] = caml_string_length(Field(v, 0));
+	memcpy(p, String_val(Field(v, 0)), b->lens[i]);
+	break;
+      case COL_INTEGER:
+	if (sqlt == SQLT_FLT) {
+	  *(double*)p = (double)Long_val(Field(v, 0));
+	} else {
+	  *(sb8*)p = Long_val(Field(v, 0));
+	}
+	break;
+      case COL_NUMBER:
+	*(double*)p = Double_val(Field(v, 0));
+	break;
+      case COL_DATETIME:
+	tm_to_ocidate(Field(v, 0), (OCIDate*)p);
+	break;
+      }
+    }
+    break;
+  case BULK_INTS: /* int64 is already what SQLT_INT wants */
+    memcpy(b->ptr, Caml_ba_data_val(c), n * sizeof(sb8));
+    memset(b->inds, 0, n * sizeof(sb2));
+    break;
+  case BULK_FLOATS:
+    memcpy(b->ptr, Caml_ba_data_val(c), n * sizeof(double));
+    for (i = 0; i < n; i++) {
+      b->inds[i] = isnan(((double*)b->ptr)[i]) ? -1 : 0;
+    }
+    break;
+  case BULK_DATES:
+    epochs_to_ocidates((double*)Caml_ba_data_val(c), n, b->ptr, b->width, b->inds);
+    break;
+  }
+
 #ifdef DEBUG
-  char dbuf[256]; snprintf(dbuf, 255, "caml_oci_write_chr_at_offset: writing '%s' at %p + %d", s, t.ptr, o); debug(dbuf); 
+  char dbuf[256]; snprintf(dbuf, 255, "oci_pack_column: packed %d rows sqlt=%d width=%d rebind=%d", n, sqlt, b->width, rebind); debug(dbuf);
 #endif
-  memcpy(t.ptr + o, s, strlen(s) + 1);
 
-  //BREAKPOINT
-  CAMLreturn(Val_unit);
+  return rebind;
 }
 
-/* construct an OCIDate from an epoch and write it at an offset */
-value caml_oci_write_odt_at_offset(value cht, value offset, value newdate) {
-  CAMLparam3(cht, offset, newdate);
-  c_alloc_t t = C_alloc_val(cht);
-  int o = Int_val(offset);
-  double epoch = Double_val(newdate);
-
-  OCIDate od;
-  epoch_to_ocidate(epoch, &od);
-  memcpy(t.ptr + o, &od, sizeof(OCIDate));
+/* as above for a bind slot, returning true if it must be bound again */
+value caml_oci_pack_column(value slot, value column) {
+  CAMLparam2(slot, column);
+  oci_bind_slot_t* b = Oci_bind_slot_val(slot);
+  int rebind = oci_pack_column(b, column);
+  CAMLreturn(Val_bool(rebind || !b->bound));
+}
 
+/* bind whatever a slot's buffers currently hold to a Pos or Name - swapped
+   when another slot has been bound there since this one (orabulkload 
+   alternates two sets), so its old bind handle cannot be reused */
+value caml_oci_bind_packed(value handles, value stmt, value slot, value bs, value swapped) {
+  CAMLparam5(handles, stmt, slot, bs, swapped);
+  oci_bind_slot_t* b = Oci_bind_slot_val(slot);
+  if (Bool_val(swapped)) {
+    b->bh = NULL;
+  }
+  oci_bind_slot_bind(Oci_handles_val(handles), Oci_statement_val(stmt), bs, b);
   CAMLreturn(Val_unit);
 }
 
-/* bind an array of native ints as SQLT_INT */
-value caml_oci_bind_bulk_int(value handles, value stmt, value bindh, value cht, value pos) {
-  CAMLparam5(handles, stmt, bindh, cht, pos);
-  oci_handles_t h = Oci_handles_val(handles);
-  OCIStmt* s = Oci_statement_val(stmt);
-  OCIBind* bh = Oci_bindhandle_val(bindh);
-  c_alloc_t t = C_alloc_val(cht);
-  int p = Int_val(pos);
-
-#ifdef DEBUG
-  char dbuf[256]; snprintf(dbuf, 255, "caml_oci_bind_bulk_int: binding t.ptr=%p at pos %d using bindhandle %p", t.ptr, p, bh); debug(dbuf);
-#endif
+/* collect the rows that failed in a batch run with OCI_BATCH_ERRORS as an 
+   array of (row, ORA code, message), rows counting from 0 */
+static value batch_errors(oci_handles_t h, OCIStmt* s) {
+  CAMLparam0();
+  CAMLlocal2(errs, e);
+  OCIEnv* env = NULL;
+  OCIError* rowerr = NULL;
+  ub4 nerrs = 0;
+  ub4 row = 0;
+  sb4 code = 0;
+  text errbuf[512];
+  int i, l;
+  sword x;
 
-  sword x = OCIBindByPos(s, &bh, h.err, (ub4)p, (dvoid*)t.ptr, (sb4) sizeof(int), SQLT_INT, NULL, NULL, NULL, 0, NULL, OCI_DEFAULT);
+  x = OCIAttrGet(s, OCI_HTYPE_STMT, &nerrs, 0, OCI_ATTR_NUM_DML_ERRORS, h.err);
   CHECK_OCI(x, h);
+  x = OCIAttrGet(h.svc, OCI_HTYPE_SVCCTX, &env, 0, OCI_ATTR_ENV, h.err);
+  CHECK_OCI(x, h);
+  OCIHandleAlloc(env, (dvoid**)&rowerr, OCI_HTYPE_ERROR, 0, NULL);
+
+  errs = caml_alloc_tuple(nerrs);
+  for (i = 0; i < (int)nerrs; i++) {
+    OCIParamGet(h.err, OCI_HTYPE_ERROR, h.err, (dvoid**)&rowerr, i);
+    OCIAttrGet(rowerr, OCI_HTYPE_ERROR, &row, 0, OCI_ATTR_DML_ROW_OFFSET, h.err);
+    errbuf[0] = '\0';
+    OCIErrorGet(rowerr, 1, NULL, &code, errbuf, sizeof(errbuf), OCI_HTYPE_ERROR);
+    l = strlen((char*)errbuf);
+    if (l > 0 && errbuf[l - 1] == '\n') { /* same trailing newline as raise_caml_exception strips */
+      errbuf[l - 1] = '\0';
+    }
+    e = caml_alloc_tuple(3);
+    Store_field(e, 0, Val_int(row));
+    Store_field(e, 1, Val_int(code));
+    Store_field(e, 2, caml_copy_string((char*)errbuf));
+    Store_field(errs, i, e);
+  }
+  OCIHandleFree(rowerr, OCI_HTYPE_ERROR);
 
 #ifdef DEBUG
-  snprintf(dbuf, 255, "caml_oci_bind_bulk_int: after bind, handle is %p", bh); debug(dbuf);
+  char dbuf[256]; snprintf(dbuf, 255, "batch_errors: %d rows failed", nerrs); debug(dbuf);
 #endif
 
-  CAMLreturn(Val_unit);
+  CAMLreturn(errs);
 }
 
-/* bind an array of native doubles as SQLT_FLT (or maybe SQLT_BDOUBLE?) */
-value caml_oci_bind_bulk_flt(value handles, value stmt, value bindh, value cht, value pos) {
-  CAMLparam5(handles, stmt, bindh, cht, pos);
+value caml_oci_bulk_exec(value handles, value stmt, value num_rows, value auto_commit, value batch_errs) {
+  CAMLparam5(handles, stmt, num_rows, auto_commit, batch_errs);
   oci_handles_t h = Oci_handles_val(handles);
   OCIStmt* s = Oci_statement_val(stmt);
-  OCIBind* bh = Oci_bindhandle_val(bindh);
-  c_alloc_t t = C_alloc_val(cht);
-  int p = Int_val(pos);
-
-  sword x = OCIBindByPos(s, &bh, h.err, (ub4)p, (dvoid*)t.ptr, (sb4) sizeof(double), SQLT_BDOUBLE, NULL, NULL, NULL, 0, NULL, OCI_DEFAULT);
-  CHECK_OCI(x, h);
+  int nr = Int_val(num_rows);
+  ub4 mode = Bool_val(auto_commit) ? OCI_COMMIT_ON_SUCCESS : OCI_DEFAULT;
+  sword x;
 
-  CAMLreturn(Val_unit);
-}
+  if (Bool_val(batch_errs)) { /* carry on past rows that fail */
+    mode |= OCI_BATCH_ERRORS;
+  }
 
-/* bind a string array as type SQLT_STR */
-value caml_oci_bind_bulk_chr(value handles, value stmt, value bindh, value cht, value skipandpos) {
-  CAMLparam5(handles, stmt, bindh, cht, skipandpos); 
-  oci_handles_t h = Oci_handles_val(handles);
-  OCIStmt* s = Oci_statement_val(stmt);
-  OCIBind* bh = Oci_bindhandle_val(bindh);
-  c_alloc_t t = C_alloc_val(cht);
+#ifdef DEBUG
+  char dbuf[256]; snprintf(dbuf, 255, "caml_oci_bulk_exec: executing for %d rows mode=%d", nr, mode); debug(dbuf);
+#endif
 
-  int sk = Int_val(Field(skipandpos, 0));
-  int p = Int_val(Field(skipandpos, 1));
+  caml_release_runtime_system();
+  x = OCIStmtExecute(h.svc, s, h.err, nr,  0, (OCISnapshot*) NULL, (OCISnapshot*) NULL, mode);
+  caml_acquire_runtime_system();
 
-  sword x = OCIBindByPos(s, &bh, h.err, (ub4)p, (dvoid*)t.ptr, (sb4)sk, SQLT_STR, NULL, NULL, NULL, 0, NULL, OCI_DEFAULT);
+  if (Bool_val(batch_errs) && x == OCI_SUCCESS_WITH_INFO) { /* some rows failed, the rest went in */
+    CAMLreturn(batch_errors(h, s));
+  }
   CHECK_OCI(x, h);
-  
-  CAMLreturn(Val_unit);
-}
 
-/* */
-value caml_oci_bind_bulk_odt(value handles, value stmt, value bindh, value cht, value skipandpos) {
-  CAMLparam5(handles, stmt, bindh, cht, skipandpos); 
-  oci_handles_t h = Oci_handles_val(handles);
-  OCIStmt* s = Oci_statement_val(stmt);
-  OCIBind* bh = Oci_bindhandle_val(bindh);
-  c_alloc_t t = C_alloc_val(cht);
+  CAMLreturn(Atom(0));
+}
 
-  int sk = Int_val(Field(skipandpos, 0));
-  int p = Int_val(Field(skipandpos, 1));
+/* a bulk execute running on its own (detached) thread, so the next batch can
+   be packed into another set of bind slots while the server works on this 
+   one. Whichever of the thread and the finalizer is last frees the job */
+typedef struct {
+  OCISvcCtx* svc;
+  OCIError* err;
+  OCIStmt* s;
+  ub4 iters;
+  ub4 mode;
+  sword result;
+  int done;      /* the execute has returned */
+  int waited;    /* its result has been checked */
+  int orphaned;  /* the OCaml value has been collected */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} oci_bulk_job_t;
+
+#define Oci_bulk_job_val(v) (*((oci_bulk_job_t**) Data_custom_val(v)))
+
+static void bulk_job_free(oci_bulk_job_t* j) {
+  pthread_cond_destroy(&j->cond);
+  pthread_mutex_destroy(&j->lock);
+  free(j);
+}
 
-  sword x = OCIBindByPos(s, &bh, h.err, (ub4)p, (dvoid*)t.ptr, (sb4)sk, SQLT_ODT, NULL, NULL, NULL, 0, NULL, OCI_DEFAULT);
-  CHECK_OCI(x, h);
+static void* bulk_job_run(void* arg) {
+  oci_bulk_job_t* j = (oci_bulk_job_t*)arg;
+  int orphaned;
+  sword x = OCIStmtExecute(j->svc, j->s, j->err, j->iters, 0, (OCISnapshot*) NULL, (OCISnapshot*) NULL, j->mode);
+  pthread_mutex_lock(&j->lock);
+  j->result = x;
+  j->done = 1;
+  orphaned = j->orphaned;
+  pthread_cond_broadcast(&j->cond);
+  pthread_mutex_unlock(&j->lock);
+  if (orphaned) {
+    bulk_job_free(j);
+  }
+  return NULL;
+}
 
-  CAMLreturn(Val_unit);
+/* a job dropped without being waited for is left to its thread to free, 
+   rather than blocking the GC until the server is done */
+void caml_oci_free_bulk_job(value v) {
+  oci_bulk_job_t* j = Oci_bulk_job_val(v);
+  int done;
+  pthread_mutex_lock(&j->lock);
+  done = j->done;
+  j->orphaned = 1;
+  pthread_mutex_unlock(&j->lock);
+  if (done) {
+    bulk_job_free(j);
+  }
 }
 
-value caml_oci_bulk_exec(value handles, value stmt, value num_rows, value auto_commit) {
+static struct custom_operations oci_bulk_job_custom_ops = {"oci_bulk_job_custom_ops", &caml_oci_free_bulk_job, NULL, NULL, NULL, NULL};
+
+/* start executing the statement for num_rows rows and return at once - the 
+   caller must make no other OCI calls on this connection until it has waited */
+value caml_oci_bulk_exec_start(value handles, value stmt, value num_rows, value auto_commit) {
   CAMLparam4(handles, stmt, num_rows, auto_commit);
+  CAMLlocal1(v);
   oci_handles_t h = Oci_handles_val(handles);
-  OCIStmt* s = Oci_statement_val(stmt);
-  int nr = Int_val(num_rows);
-  int ac = Bool_val(auto_commit);
-  sword x;
+  oci_bulk_job_t* j = (oci_bulk_job_t*)calloc(1, sizeof(oci_bulk_job_t));
+  pthread_attr_t attr;
+  pthread_t tid;
+  int rc;
+
+  pthread_mutex_init(&j->lock, NULL);
+  pthread_cond_init(&j->cond, NULL);
+  j->svc = h.svc;
+  j->err = h.err;
+  j->s = Oci_statement_val(stmt);
+  j->iters = Int_val(num_rows);
+  j->mode = Bool_val(auto_commit) ? OCI_COMMIT_ON_SUCCESS : OCI_DEFAULT;
+  v = caml_alloc_custom(&oci_bulk_job_custom_ops, sizeof(oci_bulk_job_t*), 0, 1);
+  Oci_bulk_job_val(v) = j;
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  rc = pthread_create(&tid, &attr, bulk_job_run, j);
+  pthread_attr_destroy(&attr);
+  if (rc != 0) {
+    j->done = j->waited = 1; /* nothing running, so the finalizer frees it */
+    caml_failwith("caml_oci_bulk_exec_start: cannot create thread");
+  }
 
 #ifdef DEBUG
-  char dbuf[256]; snprintf(dbuf, 255, "caml_oci_bulk_exec: executing for %d rows", nr); debug(dbuf);
+  char dbuf[256]; snprintf(dbuf, 255, "caml_oci_bulk_exec_start: executing for %d rows", j->iters); debug(dbuf);
 #endif
 
-  caml_release_runtime_system();
-  if (!ac) { /* run query normally */
-    x = OCIStmtExecute(h.svc, s, h.err, nr,  0, (OCISnapshot*) NULL, (OCISnapshot*) NULL, OCI_DEFAULT);
-  } else { /* run query and commit immediately */
-    x = OCIStmtExecute(h.svc, s, h.err, nr,  0, (OCISnapshot*) NULL, (OCISnapshot*) NULL, OCI_COMMIT_ON_SUCCESS);
-#ifdef DEBUG
-    debug("caml_oci_bulk_exec: autocommit is ON");
-#endif
+  CAMLreturn(v);
+}
+
+/* wait for a started execute to finish, raising if it failed */
+value caml_oci_bulk_exec_wait(value handles, value job) {
+  CAMLparam2(handles, job);
+  oci_bulk_job_t* j = Oci_bulk_job_val(job);
+
+  if (!j->waited) {
+    caml_release_runtime_system();
+    pthread_mutex_lock(&j->lock);
+    while (!j->done) {
+      pthread_cond_wait(&j->cond, &j->lock);
+    }
+    pthread_mutex_unlock(&j->lock);
+    caml_acquire_runtime_system();
+    j->waited = 1;
+    CHECK_OCI(j->result, Oci_handles_val(handles));
   }
-  caml_acquire_runtime_system();
-  CHECK_OCI(x, h);
 
   CAMLreturn(Val_unit);
 }
@@ -12,6 +12,18 @@
 #include <time.h>
 #include "oci_wrapper.h"
 
+#if OCAML_VERSION_MINOR >= 12
+#include <caml/threads.h>
+#else
+#include <caml/signals.h>
+#endif 
+
+/* from threads.h in 3.12 only */
+#ifndef caml_acquire_runtime_system
+#define caml_acquire_runtime_system caml_leave_blocking_section
+#define caml_release_runtime_system caml_enter_blocking_section
+#endif
+
 /* write a timestamped log message {C} for C code */
 void debug(char* msg) {
   char datebuf[32];
@@ -50,7 +62,9 @@ void run_sql_simple(OCIEnv* e, oci_handles_t h, char* sql) {
   x = OCIStmtPrepare(sth, h.err, (text*)sql, strlen(sql), OCI_NTV_SYNTAX, OCI_DEFAULT);
   CHECK_OCI(x, h);
   
+  caml_release_runtime_system();
   x = OCIStmtExecute(h.svc,sth, h.err, 1,  0, (CONST OCISnapshot*) NULL, (OCISnapshot*) NULL, OCI_DEFAULT);
+  caml_acquire_runtime_system();
   CHECK_OCI(x, h);
 }
 
@@ -79,7 +93,7 @@ value caml_alloc_c_mem(value bytes) {
   int b = Int_val(bytes);
 
   c_alloc_t c = {NULL, 0};
-  c.ptr = malloc(b);
+  c.ptr = calloc(1, b);
 #ifdef DEBUG
   char dbuf[256]; snprintf(dbuf, 255, "caml_alloc_c_mem: allocated %d bytes at address %p", b, c.ptr); debug(dbuf);
 #endif
@@ -9,9 +9,23 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <sys/time.h>
 #include <oci.h>
 #include "oci_wrapper.h"
 
+#if OCAML_VERSION_MINOR >= 12
+#include <caml/threads.h>
+#else
+#include <caml/signals.h>
+#endif 
+
+/* from threads.h in 3.12 only */
+#ifndef caml_acquire_runtime_system
+#define caml_acquire_runtime_system caml_leave_blocking_section
+#define caml_release_runtime_system caml_enter_blocking_section
+#endif
+
 /* Create an OCI environment */
 OCIEnv* global_env;
 
@@ -37,8 +51,8 @@ value caml_oci_env_create(value unit) {
 #endif
 
   CAMLparam1(unit);
-  /* OCI_OBJECT mode to enable AQ features */
-  sword x = OCIEnvCreate(&global_env, OCI_OBJECT|OCI_THREADED, 0, 0, 0, 0, 0, 0);
+  /* OCI_OBJECT mode to enable AQ features, OCI_EVENTS for change notification */
+  sword x = OCIEnvCreate(&global_env, OCI_OBJECT|OCI_THREADED|OCI_EVENTS, 0, 0, 0, 0, 0, 0);
   if (x != OCI_SUCCESS) {
     raise_caml_exception(-1, "Cannot create an OCI environment (check ORACLE_HOME?)");
   }
@@ -75,9 +89,13 @@ value caml_oci_alloc_handles(value env) {
 value caml_oci_server_attach(value handles, value dbname) {
   CAMLparam2(handles, dbname);
   oci_handles_t h = Oci_handles_val(handles);
-  char* db = String_val(dbname);
+  char* db = strdup(String_val(dbname));
+  sword x;
 
-  sword x = OCIServerAttach(h.srv, h.err, (text*)db, strlen(db), OCI_DEFAULT);
+  caml_release_runtime_system();
+  x = OCIServerAttach(h.srv, h.err, (text*)db, strlen(db), OCI_DEFAULT);
+  caml_acquire_runtime_system();
+  free(db);
   CHECK_OCI(x, h)
 
   /* place the attached server within the service context */
@@ -106,7 +124,9 @@ value caml_oci_session_begin(value handles) {
   sword x;
 
   OCIAttrSet ((void*)h.svc, OCI_HTYPE_SVCCTX, (void*)h.srv, 0, OCI_ATTR_SERVER,h.err);
-  x = OCISessionBegin ((void*)h.svc, h.err, h.ses, OCI_CRED_RDBMS, OCI_DEFAULT);
+  caml_release_runtime_system();
+  x = OCISessionBegin ((void*)h.svc, h.err, h.ses, OCI_CRED_RDBMS, OCI_STMT_CACHE); /* for OCIStmtPrepare2 */
+  caml_acquire_runtime_system();
   CHECK_OCI(x, h)
 
   /* place the session within the service context */
@@ -115,6 +135,18 @@ value caml_oci_session_begin(value handles) {
   CAMLreturn(Val_unit);
 }
 
+/* number of statements kept by the session's statement cache, 0 turns it off */
+value caml_oci_set_stmt_cache_size(value handles, value size) {
+  CAMLparam2(handles, size);
+  oci_handles_t h = Oci_handles_val(handles);
+  ub4 n = Int_val(size);
+
+  sword x = OCIAttrSet((void*)h.svc, OCI_HTYPE_SVCCTX, (void*)&n, 0, OCI_ATTR_STMTCACHESIZE, h.err);
+  CHECK_OCI(x, h)
+
+  CAMLreturn(Val_unit);
+}
+
 /* do a pointless query to force v$session.module to update */
 value caml_oci_set_module(value env, value handles, value module) {
   CAMLparam3(env, handles, module);
@@ -134,7 +166,11 @@ value caml_oci_session_end (value handles) {
   CAMLparam1(handles);
   oci_handles_t h = Oci_handles_val(handles);
 
-  sword x = OCISessionEnd(h.svc, h.err, h.ses, 0);
+  sword x;
+
+  caml_release_runtime_system();
+  x = OCISessionEnd(h.svc, h.err, h.ses, 0);
+  caml_acquire_runtime_system();
   CHECK_OCI(x, h)
 
   CAMLreturn(Val_unit);
@@ -145,7 +181,11 @@ value caml_oci_server_detach(value handles) {
   CAMLparam1(handles);
   oci_handles_t h = Oci_handles_val(handles);
 
-  sword x = OCIServerDetach(h.srv, h.err, OCI_DEFAULT);
+  sword x;
+
+  caml_release_runtime_system();
+  x = OCIServerDetach(h.srv, h.err, OCI_DEFAULT);
+  caml_acquire_runtime_system();
   CHECK_OCI(x, h)
 
   CAMLreturn(Val_unit);
@@ -197,4 +237,407 @@ value caml_oci_break(value handles) {
   CAMLreturn(Val_unit);
 }
 
+/* check a connection is still alive with a single round-trip */
+value caml_oci_ping(value handles) {
+  CAMLparam1(handles);
+  oci_handles_t h = Oci_handles_val(handles);
+  sword x;
+
+  caml_release_runtime_system();
+  x = OCIPing(h.svc, h.err, OCI_DEFAULT);
+  caml_acquire_runtime_system();
+  CHECK_OCI(x, h);
+
+  CAMLreturn(Val_unit);
+}
+
+/* whether the session has a transaction open - kept by OCI from the last 
+   round trip, so this does not go to the server */
+value caml_oci_in_transaction(value handles) {
+  CAMLparam1(handles);
+  oci_handles_t h = Oci_handles_val(handles);
+  boolean open = FALSE;
+
+  sword x = OCIAttrGet(h.ses, OCI_HTYPE_SESSION, &open, 0, OCI_ATTR_TRANSACTION_IN_PROGRESS, h.err);
+  CHECK_OCI(x, h);
+
+  CAMLreturn(Val_bool(open));
+}
+
+/* switch a connection in or out of non-blocking mode, in which a call that 
+   would wait on the server returns OCI_STILL_EXECUTING and has to be made 
+   again until it completes. Setting the attribute toggles the mode whatever 
+   the value, so only set it if it needs to change */
+value caml_oci_set_nonblocking(value handles, value on) {
+  CAMLparam2(handles, on);
+  oci_handles_t h = Oci_handles_val(handles);
+  ub1 mode = 0;
+  sword x;
+
+  x = OCIAttrGet(h.srv, OCI_HTYPE_SERVER, &mode, 0, OCI_ATTR_NONBLOCKING_MODE, h.err);
+  CHECK_OCI(x, h);
+  if ((mode != 0) != Bool_val(on)) {
+    x = OCIAttrSet(h.srv, OCI_HTYPE_SERVER, NULL, 0, OCI_ATTR_NONBLOCKING_MODE, h.err);
+    CHECK_OCI(x, h);
+  }
+
+  CAMLreturn(Val_unit);
+}
+
+/* abandon a call in progress in non-blocking mode, and put the connection 
+   back in a state to take the next one */
+value caml_oci_cancel(value handles) {
+  CAMLparam1(handles);
+  oci_handles_t h = Oci_handles_val(handles);
+  sword x;
+
+  x = OCIBreak(h.svc, h.err);
+  CHECK_OCI(x, h);
+  x = OCIReset(h.svc, h.err);
+  CHECK_OCI(x, h);
+
+  CAMLreturn(Val_unit);
+}
+
+/* session pools - OCI keeps between min and max sessions open to one 
+   database as one user, and hands them out to OCISessionGet */
+typedef struct {
+  OCISPool* spool;
+  OCIError* err;
+  OraText* name;  /* pool name for OCISessionGet, owned by OCI */
+  ub4 namelen;
+} oci_spool_t;
+
+#define Oci_spool_val(v) (*((oci_spool_t*) Data_custom_val(v)))
+
+/* create a pool for user/password@dbname - sizes is (min, max, increment) and
+   idle sessions are closed after timeout seconds (0 to keep them) */
+value caml_oci_spool_create(value env, value login, value sizes, value timeout) {
+  CAMLparam4(env, login, sizes, timeout);
+  CAMLlocal1(v);
+  OCIEnv* e = Oci_env_val(env);
+  oci_spool_t p = { NULL, NULL, NULL, 0 };
+  /* copied, as the strings may move while the runtime is released */
+  char* db = strdup(String_val(Field(login, 0)));
+  char* user = strdup(String_val(Field(login, 1)));
+  char* pass = strdup(String_val(Field(login, 2)));
+  ub4 smin = Int_val(Field(sizes, 0)), smax = Int_val(Field(sizes, 1)), sincr = Int_val(Field(sizes, 2));
+  ub4 t = Int_val(timeout);
+  ub1 getmode = OCI_SPOOL_ATTRVAL_WAIT;
+  sb4 errcode = 0;
+  char errbuf[256];
+  sword x;
+
+  OCIHandleAlloc(e, (dvoid**)&p.err, OCI_HTYPE_ERROR, 0, 0);
+  OCIHandleAlloc(e, (dvoid**)&p.spool, OCI_HTYPE_SPOOL, 0, 0);
+
+  caml_release_runtime_system();
+  x = OCISessionPoolCreate(e, p.err, p.spool, &p.name, &p.namelen, (OraText*)db, strlen(db), smin, smax, sincr, 
+			   (OraText*)user, strlen(user), (OraText*)pass, strlen(pass), OCI_SPC_HOMOGENEOUS|OCI_SPC_STMTCACHE);
+  caml_acquire_runtime_system();
+  free(db); free(user); free(pass);
+
+  if (x == OCI_SUCCESS || x == OCI_SUCCESS_WITH_INFO) {
+    OCIAttrSet(p.spool, OCI_HTYPE_SPOOL, &getmode, 0, OCI_ATTR_SPOOL_GETMODE, p.err);
+    if (t > 0) {
+      x = OCIAttrSet(p.spool, OCI_HTYPE_SPOOL, &t, 0, OCI_ATTR_SPOOL_TIMEOUT, p.err);
+      if (x != OCI_SUCCESS && x != OCI_SUCCESS_WITH_INFO) { /* the pool exists, so close it before giving up */
+	strcpy(errbuf, "orapool_create: could not set the timeout\n");
+	OCIErrorGet(p.err, 1, NULL, &errcode, (OraText*)errbuf, sizeof(errbuf), OCI_HTYPE_ERROR);
+	OCISessionPoolDestroy(p.spool, p.err, OCI_SPD_FORCE);
+      }
+    }
+  } else {
+    strcpy(errbuf, "orapool_create: no pool\n");
+    OCIErrorGet(p.err, 1, NULL, &errcode, (OraText*)errbuf, sizeof(errbuf), OCI_HTYPE_ERROR);
+  }
+  /* nothing owns the handles if there is no pool to hand back */
+  if (x != OCI_SUCCESS && x != OCI_SUCCESS_WITH_INFO) {
+    OCIHandleFree(p.spool, OCI_HTYPE_SPOOL);
+    OCIHandleFree(p.err, OCI_HTYPE_ERROR);
+    raise_caml_exception(errcode, errbuf);
+  }
+
+#ifdef DEBUG
+  char dbuf[256]; snprintf(dbuf, 255, "caml_oci_spool_create: pool %.*s min=%d max=%d incr=%d", p.namelen, p.name, smin, smax, sincr); debug(dbuf);
+#endif
+
+  v = caml_alloc_custom(&oci_custom_ops, sizeof(oci_spool_t), 0, 1);
+  Oci_spool_val(v) = p;
+  CAMLreturn(v);
+}
+
+/* take a session from the pool, waiting if all max are busy - returns its 
+   handles and whether it came back with the tag, i.e. has been used before.
+   The server and session handles belong to the pool, only err is ours */
+value caml_oci_spool_get(value env, value pool, value tag) {
+  CAMLparam3(env, pool, tag);
+  CAMLlocal2(v, r);
+  OCIEnv* e = Oci_env_val(env);
+  oci_spool_t p = Oci_spool_val(pool);
+  oci_handles_t h = { NULL, NULL, NULL, NULL, NULL };
+  char* t = strdup(String_val(tag));
+  OraText* rettag = NULL;
+  ub4 rettaglen = 0;
+  boolean found = 0;
+  sb4 errcode = 0;
+  char errbuf[256];
+  sword x;
+
+  OCIHandleAlloc(e, (dvoid**)&h.err, OCI_HTYPE_ERROR, 0, 0);
+
+  caml_release_runtime_system();
+  x = OCISessionGet(e, h.err, &h.svc, NULL, p.name, p.namelen, (OraText*)t, strlen(t), &rettag, &rettaglen, &found, 
+		    OCI_SESSGET_SPOOL|OCI_SESSGET_STMTCACHE);
+  caml_acquire_runtime_system();
+  free(t);
+  if (x != OCI_SUCCESS && x != OCI_SUCCESS_WITH_INFO) {
+    /* no session to hand back, so the error handle has no owner either */
+    strcpy(errbuf, "orapool_acquire: no session\n");
+    OCIErrorGet(h.err, 1, NULL, &errcode, (OraText*)errbuf, sizeof(errbuf), OCI_HTYPE_ERROR);
+    OCIHandleFree(h.err, OCI_HTYPE_ERROR);
+    raise_caml_exception(errcode, errbuf);
+  }
+  OCIAttrGet(h.svc, OCI_HTYPE_SVCCTX, &h.srv, 0, OCI_ATTR_SERVER, h.err);
+  OCIAttrGet(h.svc, OCI_HTYPE_SVCCTX, &h.ses, 0, OCI_ATTR_SESSION, h.err);
+
+  v = caml_alloc_custom(&oci_custom_ops, sizeof(oci_handles_t), 0, 1);
+  Oci_handles_val(v) = h;
+  r = caml_alloc_tuple(2);
+  Store_field(r, 0, v);
+  Store_field(r, 1, Val_bool(found));
+  CAMLreturn(r);
+}
+
+/* give a session back to its pool tagged with tag, or close it if drop (e.g.
+   it failed a ping) - then free the error handle */
+value caml_oci_spool_release(value handles, value tag, value drop) {
+  CAMLparam3(handles, tag, drop);
+  oci_handles_t h = Oci_handles_val(handles);
+  char* t = strdup(String_val(tag));
+  sb4 errcode = 0;
+  char errbuf[256];
+  sword x;
+
+  caml_release_runtime_system();
+  if (Bool_val(drop)) {
+    x = OCISessionRelease(h.svc, h.err, NULL, 0, OCI_SESSRLS_DROPSESS);
+  } else {
+    x = OCISessionRelease(h.svc, h.err, (OraText*)t, strlen(t), OCI_SESSRLS_RETAG);
+  }
+  caml_acquire_runtime_system();
+  free(t);
+  /* the session is gone either way, so free the error handle before raising */
+  if (x != OCI_SUCCESS) {
+    strcpy(errbuf, "orapool_release: release failed\n");
+    OCIErrorGet(h.err, 1, NULL, &errcode, (OraText*)errbuf, sizeof(errbuf), OCI_HTYPE_ERROR);
+  }
+  OCIHandleFree(h.err, OCI_HTYPE_ERROR);
+  if (x != OCI_SUCCESS) {
+    raise_caml_exception(errcode, errbuf);
+  }
+
+  CAMLreturn(Val_unit);
+}
+
+/* sessions the pool has open, and how many of those are handed out */
+value caml_oci_spool_counts(value pool) {
+  CAMLparam1(pool);
+  CAMLlocal1(r);
+  oci_spool_t p = Oci_spool_val(pool);
+  ub4 open = 0, busy = 0;
+
+  OCIAttrGet(p.spool, OCI_HTYPE_SPOOL, &open, 0, OCI_ATTR_SPOOL_OPEN_COUNT, p.err);
+  OCIAttrGet(p.spool, OCI_HTYPE_SPOOL, &busy, 0, OCI_ATTR_SPOOL_BUSY_COUNT, p.err);
+  r = caml_alloc_tuple(2);
+  Store_field(r, 0, Val_int(open));
+  Store_field(r, 1, Val_int(busy));
+  CAMLreturn(r);
+}
+
+/* close every session in the pool, busy or not, and free it */
+value caml_oci_spool_destroy(value pool) {
+  CAMLparam1(pool);
+  oci_spool_t p = Oci_spool_val(pool);
+  oci_handles_t h = { p.err, NULL, NULL, NULL, NULL };
+  sword x;
+
+  caml_release_runtime_system();
+  x = OCISessionPoolDestroy(p.spool, p.err, OCI_SPD_FORCE);
+  caml_acquire_runtime_system();
+  CHECK_OCI(x, h);
+  OCIHandleFree(p.spool, OCI_HTYPE_SPOOL);
+  OCIHandleFree(p.err, OCI_HTYPE_ERROR);
+
+  CAMLreturn(Val_unit);
+}
+
+/* logging on several sessions at once - each gets a thread of its own for 
+   the attach and session begin round-trips, and the first failure stops the 
+   others at their next step */
+typedef struct {
+  pthread_t tid;
+  int threaded;
+  oci_handles_t h;
+  char* db;
+  char* user;
+  char* pass;
+  int* failed;         /* shared between all the threads of one call */
+  pthread_mutex_t* lock;
+  int attached;
+  int logged_on;
+  sb4 errcode;
+  char errbuf[256];
+  double elapsed;
+} oci_logon_job_t;
+
+static int logon_failed(oci_logon_job_t* j) {
+  int f;
+  pthread_mutex_lock(j->lock);
+  f = *j->failed;
+  pthread_mutex_unlock(j->lock);
+  return f;
+}
+
+static void logon_error(oci_logon_job_t* j) {
+  OCIErrorGet(j->h.err, 1, NULL, &j->errcode, (OraText*)j->errbuf, sizeof(j->errbuf), OCI_HTYPE_ERROR);
+  pthread_mutex_lock(j->lock);
+  *j->failed = 1;
+  pthread_mutex_unlock(j->lock);
+}
+
+static void* logon_thread(void* arg) {
+  oci_logon_job_t* j = (oci_logon_job_t*)arg;
+  struct timeval t1, t2;
+  sword x;
+
+  gettimeofday(&t1, NULL);
+  if (!logon_failed(j)) {
+    x = OCIServerAttach(j->h.srv, j->h.err, (text*)j->db, strlen(j->db), OCI_DEFAULT);
+    if (x != OCI_SUCCESS) {
+      logon_error(j);
+    } else {
+      j->attached = 1;
+      OCIAttrSet(j->h.svc, OCI_HTYPE_SVCCTX, j->h.srv, 0, OCI_ATTR_SERVER, j->h.err);
+      OCIAttrSet(j->h.ses, OCI_HTYPE_SESSION, j->user, strlen(j->user), OCI_ATTR_USERNAME, j->h.err);
+      OCIAttrSet(j->h.ses, OCI_HTYPE_SESSION, j->pass, strlen(j->pass), OCI_ATTR_PASSWORD, j->h.err);
+    }
+  }
+  if (j->attached && !logon_failed(j)) {
+    x = OCISessionBegin(j->h.svc, j->h.err, j->h.ses, OCI_CRED_RDBMS, OCI_STMT_CACHE);
+    if (x != OCI_SUCCESS) {
+      logon_error(j);
+    } else {
+      j->logged_on = 1;
+      OCIAttrSet(j->h.svc, OCI_HTYPE_SVCCTX, j->h.ses, 0, OCI_ATTR_SESSION, j->h.err);
+    }
+  }
+  gettimeofday(&t2, NULL);
+  j->elapsed = (t2.tv_sec - t1.tv_sec) + (t2.tv_usec - t1.tv_usec) / 1e6;
+  return NULL;
+}
+
+static void free_handles(oci_handles_t h) {
+  if (h.srv) OCIHandleFree(h.srv, OCI_HTYPE_SERVER);
+  if (h.svc) OCIHandleFree(h.svc, OCI_HTYPE_SVCCTX);
+  if (h.err) OCIHandleFree(h.err, OCI_HTYPE_ERROR);
+  if (h.ses) OCIHandleFree(h.ses, OCI_HTYPE_SESSION);
+  if (h.auth) OCIHandleFree(h.auth, OCI_HTYPE_AUTHINFO);
+}
+
+/* log on n sessions as user/password@dbname concurrently - returns an array
+   of (handles, seconds taken), or if any fails, closes the rest and raises 
+   the first error. The first session is logged on by itself before the rest
+   are started, so bad credentials cost one failed login rather than n */
+value caml_oci_logon_many(value env, value login, value num) {
+  CAMLparam3(env, login, num);
+  CAMLlocal3(res, v, t);
+  OCIEnv* e = Oci_env_val(env);
+  int n = Int_val(num), i, failed = 0, first = -1;
+  pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+  oci_logon_job_t* jobs;
+  /* copied, as the strings may move while the runtime is released */
+  char* db = strdup(String_val(Field(login, 0)));
+  char* user = strdup(String_val(Field(login, 1)));
+  char* pass = strdup(String_val(Field(login, 2)));
+  sb4 errcode = 0;
+  char errbuf[256];
+
+  if (n < 0) {
+    free(db); free(user); free(pass);
+    caml_invalid_argument("oralogon_many: negative number of connections");
+  }
+
+  jobs = calloc(n ? n : 1, sizeof(oci_logon_job_t));
+  for (i = 0; i < n; i++) {
+    OCIHandleAlloc(e, (dvoid**)&jobs[i].h.err, OCI_HTYPE_ERROR,   0, 0);
+    OCIHandleAlloc(e, (dvoid**)&jobs[i].h.srv, OCI_HTYPE_SERVER,  0, 0);
+    OCIHandleAlloc(e, (dvoid**)&jobs[i].h.svc, OCI_HTYPE_SVCCTX,  0, 0);
+    OCIHandleAlloc(e, (dvoid**)&jobs[i].h.ses, OCI_HTYPE_SESSION, 0, 0);
+    OCIHandleAlloc(e, (dvoid**)&jobs[i].h.auth, OCI_HTYPE_AUTHINFO, 0, 0);
+    jobs[i].db = db; jobs[i].user = user; jobs[i].pass = pass;
+    jobs[i].failed = &failed;
+    jobs[i].lock = &lock;
+  }
+
+  caml_release_runtime_system();
+  if (n > 0) {
+    logon_thread(&jobs[0]);
+  }
+  /* no other thread is running yet, so failed can be read without the lock */
+  if (!failed) {
+    for (i = 1; i < n; i++) {
+      jobs[i].threaded = (pthread_create(&jobs[i].tid, NULL, logon_thread, &jobs[i]) == 0);
+      if (!jobs[i].threaded) {
+	/* no more threads to be had, so do this one here */
+	logon_thread(&jobs[i]);
+      }
+    }
+  }
+  for (i = 0; i < n; i++) {
+    if (jobs[i].threaded) {
+      pthread_join(jobs[i].tid, NULL);
+    }
+    if (first < 0 && jobs[i].errcode) {
+      first = i;
+    }
+  }
+  /* failed could be set without an error code if OCIErrorGet itself failed */
+  if (failed) {
+    for (i = 0; i < n; i++) {
+      if (jobs[i].logged_on) OCISessionEnd(jobs[i].h.svc, jobs[i].h.err, jobs[i].h.ses, OCI_DEFAULT);
+      if (jobs[i].attached) OCIServerDetach(jobs[i].h.srv, jobs[i].h.err, OCI_DEFAULT);
+    }
+  }
+  caml_acquire_runtime_system();
+  free(db); free(user); free(pass);
+
+  if (failed) {
+    if (first >= 0) {
+      errcode = jobs[first].errcode;
+      strcpy(errbuf, jobs[first].errbuf);
+    } else {
+      errcode = -1;
+      strcpy(errbuf, "oralogon_many: logon failed\n");
+    }
+    for (i = 0; i < n; i++) {
+      free_handles(jobs[i].h);
+    }
+    free(jobs);
+    raise_caml_exception(errcode, errbuf);
+  }
+
+  res = caml_alloc_tuple(n);
+  for (i = 0; i < n; i++) {
+    v = caml_alloc_custom(&oci_custom_ops, sizeof(oci_handles_t), 0, 1);
+    Oci_handles_val(v) = jobs[i].h;
+    t = caml_alloc_tuple(2);
+    Store_field(t, 0, v);
+    Store_field(t, 1, caml_copy_double(jobs[i].elapsed));
+    Store_field(res, i, t);
+  }
+  free(jobs);
+  CAMLreturn(res);
+}
+
 /* end of file */
@@ -0,0 +1,405 @@
+/* Database Change Notification - OCI calls back on a thread of its own, 
+   which only ever queues the changes in C under a mutex. OCaml takes them 
+   off the queue in caml_oci_dcn_wait, so the callback never touches the 
+   OCaml runtime */
+
+#include <caml/mlvalues.h>
+#include <caml/memory.h>
+#include <caml/alloc.h>
+#include <caml/custom.h>
+#include <caml/callback.h>
+#include <caml/fail.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <oci.h>
+#include <ocidfn.h>
+#include "oci_wrapper.h"
+
+#if OCAML_VERSION_MINOR >= 12
+#include <caml/threads.h>
+#else
+#include <caml/signals.h>
+#endif 
+
+/* from threads.h in 3.12 only */
+#ifndef caml_acquire_runtime_system
+#define caml_acquire_runtime_system caml_leave_blocking_section
+#define caml_release_runtime_system caml_enter_blocking_section
+#endif
+
+/* one change, as queued by the callback */
+typedef struct oci_dcn_event {
+  int kind;       /* OCI_EVENT_* */
+  char* table;    /* SCHEMA.TABLE, or NULL */
+  int ops;        /* OCI_OPCODE_* flags */
+  char* rowid;    /* NULL when only the table is known */
+  ub8 query_id;   /* for query-level notifications */
+  struct oci_dcn_event* next;
+} oci_dcn_event_t;
+
+/* a subscription and its queue of changes - the callback holds a pointer to 
+   this, so it is not freed while it could still be called */
+typedef struct {
+  OCISubscription* subscr;
+  OCIError* cberr;       /* for the callback thread, as error handles are not shared */
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  oci_dcn_event_t* head;
+  oci_dcn_event_t* tail;
+  int queued;
+  int max_queued;
+  int dropped;           /* changes lost because the queue was full */
+  int registered;
+} oci_dcn_t;
+
+#define Oci_dcn_val(v) (*((oci_dcn_t**) Data_custom_val(v)))
+
+static void dcn_free_events(oci_dcn_event_t* e) {
+  oci_dcn_event_t* next;
+  while (e != NULL) {
+    next = e->next;
+    free(e->table);
+    free(e->rowid);
+    free(e);
+    e = next;
+  }
+}
+
+/* called with d->lock held */
+static void dcn_queue(oci_dcn_t* d, int kind, text* table, int ops, text* rowid, ub4 rowid_len, ub8 query_id) {
+  oci_dcn_event_t* e;
+
+  if (d->queued >= d->max_queued && kind != OCI_EVENT_DEREG) {
+    d->dropped++;
+    return;
+  }
+  e = (oci_dcn_event_t*)calloc(1, sizeof(oci_dcn_event_t));
+  e->kind = kind;
+  e->table = table ? strdup((char*)table) : NULL;
+  e->ops = ops;
+  if (rowid && rowid_len > 0) {
+    e->rowid = (char*)malloc(rowid_len + 1);
+    memcpy(e->rowid, rowid, rowid_len);
+    e->rowid[rowid_len] = '\0';
+  }
+  e->query_id = query_id;
+  if (d->tail) {
+    d->tail->next = e;
+  } else {
+    d->head = e;
+  }
+  d->tail = e;
+  d->queued++;
+}
+
+/* a collection of table change descriptors, one entry per changed row or 
+   one for the whole table if OCI did not send the rows */
+static void dcn_table_changes(oci_dcn_t* d, int kind, OCIColl* tables, ub8 query_id) {
+  sb4 ntables = 0, nrows = 0;
+  sb4 i, j;
+  boolean exist;
+  dvoid** elem;
+  dvoid* ind;
+  dvoid* tdesc;
+  dvoid* rdesc;
+  text* table;
+  text* rowid;
+  ub4 rowid_len;
+  ub4 table_ops, row_ops;
+  OCIColl* rows;
+
+  if (tables == NULL || OCICollSize(global_env, d->cberr, tables, &ntables) != OCI_SUCCESS) {
+    return;
+  }
+  for (i = 0; i < ntables; i++) {
+    if (OCICollGetElem(global_env, d->cberr, tables, i, &exist, (dvoid**)&elem, &ind) != OCI_SUCCESS) {
+      continue;
+    }
+    tdesc = *elem;
+    table = NULL; table_ops = 0; rows = NULL; nrows = 0;
+    OCIAttrGet(tdesc, OCI_DTYPE_TABLE_CHDES, &table, NULL, OCI_ATTR_CHDES_TABLE_NAME, d->cberr);
+    OCIAttrGet(tdesc, OCI_DTYPE_TABLE_CHDES, &table_ops, NULL, OCI_ATTR_CHDES_TABLE_OPFLAGS, d->cberr);
+    OCIAttrGet(tdesc, OCI_DTYPE_TABLE_CHDES, &rows, NULL, OCI_ATTR_CHDES_TABLE_ROW_CHANGES, d->cberr);
+    if (rows != NULL && !(table_ops & OCI_OPCODE_ALLROWS)) {
+      OCICollSize(global_env, d->cberr, rows, &nrows);
+    }
+    if (nrows == 0) {
+      dcn_queue(d, kind, table, table_ops, NULL, 0, query_id);
+    }
+    for (j = 0; j < nrows; j++) {
+      if (OCICollGetElem(global_env, d->cberr, rows, j, &exist, (dvoid**)&elem, &ind) != OCI_SUCCESS) {
+	continue;
+      }
+      rdesc = *elem;
+      rowid = NULL; rowid_len = 0; row_ops = 0;
+      OCIAttrGet(rdesc, OCI_DTYPE_ROW_CHDES, &rowid, &rowid_len, OCI_ATTR_CHDES_ROW_ROWID, d->cberr);
+      OCIAttrGet(rdesc, OCI_DTYPE_ROW_CHDES, &row_ops, NULL, OCI_ATTR_CHDES_ROW_OPFLAGS, d->cberr);
+      dcn_queue(d, kind, table, row_ops, rowid, rowid_len, query_id);
+    }
+  }
+}
+
+/* runs on an OCI thread - must not call into OCaml */
+static void dcn_callback(dvoid* ctx, OCISubscription* subscr, dvoid* payload, ub4* payl, dvoid* desc, ub4 mode) {
+  oci_dcn_t* d = (oci_dcn_t*)ctx;
+  ub4 kind = OCI_EVENT_NONE;
+  OCIColl* changes = NULL;
+  sb4 nqueries = 0;
+  sb4 i;
+  boolean exist;
+  dvoid** elem;
+  dvoid* ind;
+  ub8 query_id;
+
+  OCIAttrGet(desc, OCI_DTYPE_CHDES, &kind, NULL, OCI_ATTR_CHDES_NFYTYPE, d->cberr);
+
+  pthread_mutex_lock(&d->lock);
+  switch (kind) {
+  case OCI_EVENT_OBJCHANGE:
+    OCIAttrGet(desc, OCI_DTYPE_CHDES, &changes, NULL, OCI_ATTR_CHDES_TABLE_CHANGES, d->cberr);
+    dcn_table_changes(d, kind, changes, 0);
+    break;
+  case OCI_EVENT_QUERYCHANGE:
+    OCIAttrGet(desc, OCI_DTYPE_CHDES, &changes, NULL, OCI_ATTR_CHDES_QUERIES, d->cberr);
+    if (changes != NULL && OCICollSize(global_env, d->cberr, changes, &nqueries) == OCI_SUCCESS) {
+      for (i = 0; i < nqueries; i++) {
+	OCIColl* tables = NULL;
+	query_id = 0;
+	if (OCICollGetElem(global_env, d->cberr, changes, i, &exist, (dvoid**)&elem, &ind) != OCI_SUCCESS) {
+	  continue;
+	}
+	OCIAttrGet(*elem, OCI_DTYPE_CQDES, &query_id, NULL, OCI_ATTR_CQDES_QUERYID, d->cberr);
+	OCIAttrGet(*elem, OCI_DTYPE_CQDES, &tables, NULL, OCI_ATTR_CQDES_TABLE_CHANGES, d->cberr);
+	dcn_table_changes(d, kind, tables, query_id);
+      }
+    }
+    break;
+  case OCI_EVENT_DEREG:
+    d->registered = 0;
+    dcn_queue(d, kind, NULL, 0, NULL, 0, 0);
+    break;
+  default: /* startup and shutdown */
+    dcn_queue(d, kind, NULL, 0, NULL, 0, 0);
+  }
+  pthread_cond_broadcast(&d->ready);
+  pthread_mutex_unlock(&d->lock);
+}
+
+/* a subscription still registered could be called back at any time, so it 
+   is left for the process to clean up */
+void caml_oci_free_dcn(value dcn) {
+  CAMLparam1(dcn);
+  oci_dcn_t* d = Oci_dcn_val(dcn);
+  int registered = 1;
+  if (d != NULL) { /* the callback thread clears this under the lock */
+    pthread_mutex_lock(&d->lock);
+    registered = d->registered;
+    pthread_mutex_unlock(&d->lock);
+  }
+  if (d != NULL && !registered) {
+    if (d->subscr) {
+      OCIHandleFree(d->subscr, OCI_HTYPE_SUBSCRIPTION);
+    }
+    OCIHandleFree(d->cberr, OCI_HTYPE_ERROR);
+    dcn_free_events(d->head);
+    pthread_mutex_destroy(&d->lock);
+    pthread_cond_destroy(&d->ready);
+    free(d);
+  }
+#ifdef DEBUG
+  else { debug("caml_oci_free_dcn: subscription still registered, not freed"); }
+#endif
+  CAMLreturn0;
+}
+
+static struct custom_operations oci_dcn_custom_ops = {"oci_dcn_custom_ops", &caml_oci_free_dcn, NULL, NULL, NULL, NULL};
+
+/* register a subscription for change notifications on the connection - 
+   opts are (rowids, query level, timeout in seconds, 0 for none). Queries are 
+   added to it by executing them with caml_oci_dcn_add */
+value caml_oci_dcn_register(value handles, value opts, value max_queued) {
+  CAMLparam3(handles, opts, max_queued);
+  CAMLlocal1(v);
+  oci_handles_t h = Oci_handles_val(handles);
+  boolean rowids = Bool_val(Field(opts, 0));
+  ub4 qos = Bool_val(Field(opts, 1)) ? (OCI_SUBSCR_CQ_QOS_QUERY | OCI_SUBSCR_CQ_QOS_BEST_EFFORT) : 0;
+  ub4 timeout = Int_val(Field(opts, 2));
+  ub4 ns = OCI_SUBSCR_NAMESPACE_DBCHANGE;
+  sword x;
+
+  oci_dcn_t* d = (oci_dcn_t*)calloc(1, sizeof(oci_dcn_t));
+  d->max_queued = Int_val(max_queued);
+  pthread_mutex_init(&d->lock, NULL);
+  pthread_cond_init(&d->ready, NULL);
+  OCIHandleAlloc(global_env, (dvoid**)&d->cberr, OCI_HTYPE_ERROR, 0, 0);
+  v = caml_alloc_custom(&oci_dcn_custom_ops, sizeof(oci_dcn_t*), 0, 1);
+  Oci_dcn_val(v) = d;
+
+  x = OCIHandleAlloc(global_env, (dvoid**)&d->subscr, OCI_HTYPE_SUBSCRIPTION, 0, 0);
+  CHECK_OCI(x, h);
+  x = OCIAttrSet(d->subscr, OCI_HTYPE_SUBSCRIPTION, &ns, sizeof(ub4), OCI_ATTR_SUBSCR_NAMESPACE, h.err);
+  CHECK_OCI(x, h);
+  x = OCIAttrSet(d->subscr, OCI_HTYPE_SUBSCRIPTION, (dvoid*)dcn_callback, 0, OCI_ATTR_SUBSCR_CALLBACK, h.err);
+  CHECK_OCI(x, h);
+  x = OCIAttrSet(d->subscr, OCI_HTYPE_SUBSCRIPTION, (dvoid*)d, 0, OCI_ATTR_SUBSCR_CTX, h.err);
+  CHECK_OCI(x, h);
+  x = OCIAttrSet(d->subscr, OCI_HTYPE_SUBSCRIPTION, &rowids, sizeof(boolean), OCI_ATTR_CHNF_ROWIDS, h.err);
+  CHECK_OCI(x, h);
+  if (qos) {
+    x = OCIAttrSet(d->subscr, OCI_HTYPE_SUBSCRIPTION, &qos, sizeof(ub4), OCI_ATTR_SUBSCR_CQ_QOSFLAGS, h.err);
+    CHECK_OCI(x, h);
+  }
+  if (timeout > 0) {
+    x = OCIAttrSet(d->subscr, OCI_HTYPE_SUBSCRIPTION, &timeout, sizeof(ub4), OCI_ATTR_SUBSCR_TIMEOUT, h.err);
+    CHECK_OCI(x, h);
+  }
+
+  caml_release_runtime_system();
+  x = OCISubscriptionRegister(h.svc, &d->subscr, 1, h.err, OCI_DEFAULT);
+  caml_acquire_runtime_system();
+  CHECK_OCI(x, h);
+  d->registered = 1;
+
+  CAMLreturn(v);
+}
+
+/* mark a parsed statement so that executing it adds its query to the 
+   subscription */
+value caml_oci_dcn_add(value handles, value dcn, value stmt) {
+  CAMLparam3(handles, dcn, stmt);
+  oci_handles_t h = Oci_handles_val(handles);
+  oci_dcn_t* d = Oci_dcn_val(dcn);
+  OCIStmt* sth = Oci_statement_val(stmt);
+
+  if (!d->registered) {
+    caml_invalid_argument("caml_oci_dcn_add: subscription is not registered");
+  }
+  sword x = OCIAttrSet(sth, OCI_HTYPE_STMT, d->subscr, 0, OCI_ATTR_CHNF_REGHANDLE, h.err);
+  CHECK_OCI(x, h);
+
+  CAMLreturn(Val_unit);
+}
+
+/* after the registering execute, so later executes of the statement - also 
+   once it comes back from the statement cache - do not add it again */
+value caml_oci_dcn_clear(value handles, value stmt) {
+  CAMLparam2(handles, stmt);
+  oci_handles_t h = Oci_handles_val(handles);
+  OCIStmt* sth = Oci_statement_val(stmt);
+
+  if (sth != NULL) {
+    sword x = OCIAttrSet(sth, OCI_HTYPE_STMT, NULL, 0, OCI_ATTR_CHNF_REGHANDLE, h.err);
+    CHECK_OCI(x, h);
+  }
+  CAMLreturn(Val_unit);
+}
+
+/* wait up to timeout seconds (forever if negative) for changes and take 
+   everything queued, as an array of (kind, table, ops, rowid, query id) 
+   and whether the subscription is still registered */
+value caml_oci_dcn_wait(value dcn, value timeout) {
+  CAMLparam2(dcn, timeout);
+  CAMLlocal3(r, evs, ev);
+  oci_dcn_t* d = Oci_dcn_val(dcn);
+  double t = Double_val(timeout);
+  oci_dcn_event_t* head;
+  oci_dcn_event_t* e;
+  struct timeval now;
+  struct timespec until;
+  int n, i, registered;
+
+  caml_release_runtime_system();
+  pthread_mutex_lock(&d->lock);
+  if (t > 0.0 && d->head == NULL && d->registered) {
+    gettimeofday(&now, NULL);
+    double end = now.tv_sec + now.tv_usec / 1e6 + t;
+    until.tv_sec = (time_t)end;
+    until.tv_nsec = (long)((end - until.tv_sec) * 1e9);
+    while (d->head == NULL && d->registered) {
+      if (pthread_cond_timedwait(&d->ready, &d->lock, &until) == ETIMEDOUT) {
+	break;
+      }
+    }
+  } else if (t < 0.0) {
+    while (d->head == NULL && d->registered) {
+      pthread_cond_wait(&d->ready, &d->lock);
+    }
+  }
+  head = d->head;
+  n = d->queued;
+  d->head = d->tail = NULL;
+  d->queued = 0;
+  registered = d->registered;
+  pthread_mutex_unlock(&d->lock);
+  caml_acquire_runtime_system();
+
+  evs = caml_alloc_tuple(n);  /* Atom(0) if n is 0 */
+  for (e = head, i = 0; e != NULL && i < n; e = e->next, i++) {
+    ev = caml_alloc_tuple(5);
+    Store_field(ev, 0, Val_int(e->kind));
+    Store_field(ev, 1, caml_copy_string(e->table ? e->table : ""));
+    Store_field(ev, 2, Val_int(e->ops));
+    Store_field(ev, 3, caml_copy_string(e->rowid ? e->rowid : ""));
+    Store_field(ev, 4, Val_long(e->query_id));
+    Store_field(evs, i, ev);
+  }
+  dcn_free_events(head);
+
+  r = caml_alloc_tuple(2);
+  Store_field(r, 0, evs);
+  Store_field(r, 1, Val_bool(registered));
+  CAMLreturn(r);
+}
+
+/* the id the server gave the query of a statement executed with a 
+   query-level subscription attached, as sent back in its notifications */
+value caml_oci_dcn_query_id(value handles, value stmt) {
+  CAMLparam2(handles, stmt);
+  oci_handles_t h = Oci_handles_val(handles);
+  OCIStmt* sth = Oci_statement_val(stmt);
+  ub8 qid = 0;
+
+  sword x = OCIAttrGet(sth, OCI_HTYPE_STMT, &qid, NULL, OCI_ATTR_CQ_QUERYID, h.err);
+  CHECK_OCI(x, h);
+
+  CAMLreturn(Val_long(qid));
+}
+
+value caml_oci_dcn_dropped(value dcn) {
+  CAMLparam1(dcn);
+  oci_dcn_t* d = Oci_dcn_val(dcn);
+  int n;
+
+  pthread_mutex_lock(&d->lock);
+  n = d->dropped;
+  pthread_mutex_unlock(&d->lock);
+
+  CAMLreturn(Val_int(n));
+}
+
+/* drop the subscription on the server, and wake anything waiting on it */
+value caml_oci_dcn_unregister(value handles, value dcn) {
+  CAMLparam2(handles, dcn);
+  oci_handles_t h = Oci_handles_val(handles);
+  oci_dcn_t* d = Oci_dcn_val(dcn);
+  sword x = OCI_SUCCESS;
+
+  if (d->registered) {
+    caml_release_runtime_system();
+    x = OCISubscriptionUnRegister(h.svc, d->subscr, h.err, OCI_DEFAULT);
+    caml_acquire_runtime_system();
+  }
+  pthread_mutex_lock(&d->lock);
+  d->registered = 0;
+  pthread_cond_broadcast(&d->ready);
+  pthread_mutex_unlock(&d->lock);
+  CHECK_OCI(x, h);
+
+  CAMLreturn(Val_unit);
+}
+
+/* end of file */
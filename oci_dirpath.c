@@ -0,0 +1,313 @@
+/* direct path loading - rows are formatted into blocks on the client and
+   written above the table's high water mark, bypassing the SQL engine */
+
+#include <caml/mlvalues.h>
+#include <caml/memory.h>
+#include <caml/alloc.h>
+#include <caml/custom.h>
+#include <caml/callback.h>
+#include <caml/fail.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <oci.h>
+#include <ocidfn.h>
+#include "oci_wrapper.h"
+
+#if OCAML_VERSION_MINOR >= 12
+#include <caml/threads.h>
+#else
+#include <caml/signals.h>
+#endif
+
+/* from threads.h in 3.12 only */
+#ifndef caml_acquire_runtime_system
+#define caml_acquire_runtime_system caml_leave_blocking_section
+#define caml_release_runtime_system caml_enter_blocking_section
+#endif
+
+/* size of an Oracle internal DATE, as direct path takes dates */
+#define SQLT_DAT_SIZE 7
+
+/* a load in progress - the column types are not known until the first batch
+   has been packed, so the context is prepared then */
+typedef struct {
+  OCIDirPathCtx* ctx;
+  OCIError* err;         /* its own, for the abort when it is collected */
+  OCIDirPathColArray* ca;
+  OCIDirPathStream* str;
+  int ncols;
+  char** names;
+  int* sqlt;             /* type of each column as packed by the first batch */
+  oci_bind_slot_t* cols; /* packed data for each column, as for bulk binds */
+  ub4 ca_rows;           /* rows the column array can hold */
+  int prepared;
+} oci_dirpath_t;
+
+#define Oci_dirpath_val(v) (*((oci_dirpath_t**) Data_custom_val(v)))
+
+void caml_oci_free_dirpath(value v) {
+  oci_dirpath_t* d = Oci_dirpath_val(v);
+  int i;
+
+#ifdef DEBUG
+  debug("caml_oci_free_dirpath: freeing direct path context");
+#endif
+  if (d->prepared) { /* dropped mid-load, so throw the rows away */
+    OCIDirPathAbort(d->ctx, d->err);
+  }
+  if (d->ca)  { OCIHandleFree(d->ca, OCI_HTYPE_DIRPATH_COLUMN_ARRAY); }
+  if (d->str) { OCIHandleFree(d->str, OCI_HTYPE_DIRPATH_STREAM); }
+  if (d->ctx) { OCIHandleFree(d->ctx, OCI_HTYPE_DIRPATH_CTX); }
+  if (d->err) { OCIHandleFree(d->err, OCI_HTYPE_ERROR); }
+  for (i = 0; i < d->ncols; i++) {
+    free(d->names[i]);
+    free(d->cols[i].ptr); free(d->cols[i].inds); free(d->cols[i].lens);
+  }
+  free(d->names); free(d->sqlt); free(d->cols);
+  free(d);
+}
+
+static struct custom_operations oci_dirpath_custom_ops = {"oci_dirpath_custom_ops", &caml_oci_free_dirpath, NULL, NULL, NULL, NULL};
+
+/* start a direct path load into schema.table (schema may be "") for the named
+   columns, with a column array of rows rows */
+value caml_oci_dirpath_open(value handles, value schema, value table, value names, value rows) {
+  CAMLparam5(handles, schema, table, names, rows);
+  CAMLlocal1(v);
+  oci_handles_t h = Oci_handles_val(handles);
+  OCIEnv* env = NULL;
+  oci_dirpath_t* d = (oci_dirpath_t*)calloc(1, sizeof(oci_dirpath_t));
+  ub2 nc = Wosize_val(names);
+  ub4 nr = Int_val(rows);
+  int i;
+  sword x;
+
+  d->ncols = nc;
+  d->names = (char**)calloc(nc, sizeof(char*));
+  d->sqlt = (int*)calloc(nc, sizeof(int));
+  d->cols = (oci_bind_slot_t*)calloc(nc, sizeof(oci_bind_slot_t));
+  for (i = 0; i < nc; i++) {
+    d->names[i] = strdup(String_val(Field(names, i)));
+  }
+  v = caml_alloc_custom(&oci_dirpath_custom_ops, sizeof(oci_dirpath_t*), 0, 1);
+  Oci_dirpath_val(v) = d;
+
+  x = OCIAttrGet(h.svc, OCI_HTYPE_SVCCTX, &env, 0, OCI_ATTR_ENV, h.err);
+  CHECK_OCI(x, h);
+  x = OCIHandleAlloc(env, (dvoid**)&d->ctx, OCI_HTYPE_DIRPATH_CTX, 0, NULL);
+  CHECK_OCI(x, h);
+  x = OCIHandleAlloc(env, (dvoid**)&d->err, OCI_HTYPE_ERROR, 0, NULL);
+  CHECK_OCI(x, h);
+
+  x = OCIAttrSet(d->ctx, OCI_HTYPE_DIRPATH_CTX, String_val(table), caml_string_length(table), OCI_ATTR_NAME, h.err);
+  CHECK_OCI(x, h);
+  if (caml_string_length(schema) > 0) {
+    x = OCIAttrSet(d->ctx, OCI_HTYPE_DIRPATH_CTX, String_val(schema), caml_string_length(schema), OCI_ATTR_SCHEMA_NAME, h.err);
+    CHECK_OCI(x, h);
+  }
+  x = OCIAttrSet(d->ctx, OCI_HTYPE_DIRPATH_CTX, &nc, 0, OCI_ATTR_NUM_COLS, h.err);
+  CHECK_OCI(x, h);
+  x = OCIAttrSet(d->ctx, OCI_HTYPE_DIRPATH_CTX, &nr, 0, OCI_ATTR_NUM_ROWS, h.err);
+  CHECK_OCI(x, h);
+
+#ifdef DEBUG
+  char dbuf[256]; snprintf(dbuf, 255, "caml_oci_dirpath_open: %d columns into %s, %d rows per column array", nc, String_val(table), nr); debug(dbuf);
+#endif
+
+  CAMLreturn(v);
+}
+
+/* describe each column by the type the first batch was packed as, then
+   prepare the load and allocate its column array and stream */
+static void dirpath_prepare(oci_handles_t h, oci_dirpath_t* d) {
+  OCIParam* collist = NULL;
+  OCIParam* col = NULL;
+  ub2 dt;
+  ub4 sz;
+  int i;
+  sb4 errcode = 0;
+  char errbuf[256];
+  sword x;
+
+  x = OCIAttrGet(d->ctx, OCI_HTYPE_DIRPATH_CTX, &collist, 0, OCI_ATTR_LIST_COLUMNS, h.err);
+  CHECK_OCI(x, h);
+  for (i = 0; i < d->ncols; i++) {
+    d->sqlt[i] = d->cols[i].dtype;
+    switch (d->sqlt[i]) {
+    case SQLT_INT: dt = SQLT_INT; sz = sizeof(sb8); break;
+    case SQLT_FLT: dt = SQLT_FLT; sz = sizeof(double); break;
+    case SQLT_ODT: dt = SQLT_DAT; sz = SQLT_DAT_SIZE; break;
+    default:       dt = SQLT_CHR; sz = MAXVARCHAR; break;
+    }
+    x = OCIParamGet(collist, OCI_DTYPE_PARAM, h.err, (dvoid**)&col, i + 1);
+    CHECK_OCI(x, h);
+    OCIAttrSet(col, OCI_DTYPE_PARAM, d->names[i], strlen(d->names[i]), OCI_ATTR_NAME, h.err);
+    OCIAttrSet(col, OCI_DTYPE_PARAM, &dt, 0, OCI_ATTR_DATA_TYPE, h.err);
+    x = OCIAttrSet(col, OCI_DTYPE_PARAM, &sz, 0, OCI_ATTR_DATA_SIZE, h.err);
+    OCIDescriptorFree(col, OCI_DTYPE_PARAM);
+    CHECK_OCI(x, h);
+  }
+
+  x = OCIDirPathPrepare(d->ctx, h.svc, h.err);
+  CHECK_OCI(x, h);
+  x = OCIHandleAlloc(d->ctx, (dvoid**)&d->ca, OCI_HTYPE_DIRPATH_COLUMN_ARRAY, 0, NULL);
+  if (x == OCI_SUCCESS) {
+    x = OCIHandleAlloc(d->ctx, (dvoid**)&d->str, OCI_HTYPE_DIRPATH_STREAM, 0, NULL);
+  }
+  if (x == OCI_SUCCESS) {
+    x = OCIAttrGet(d->ca, OCI_HTYPE_DIRPATH_COLUMN_ARRAY, &d->ca_rows, 0, OCI_ATTR_NUM_ROWS, h.err);
+  }
+  if (x != OCI_SUCCESS) {
+    /* the load has started on the server, so abort it rather than leave it
+       holding the table until the context is freed */
+    strcpy(errbuf, "oradpload: could not set up the column array\n");
+    OCIErrorGet(h.err, 1, NULL, &errcode, (OraText*)errbuf, sizeof(errbuf), OCI_HTYPE_ERROR);
+    caml_release_runtime_system();
+    OCIDirPathAbort(d->ctx, h.err);
+    caml_acquire_runtime_system();
+    if (d->ca)  { OCIHandleFree(d->ca, OCI_HTYPE_DIRPATH_COLUMN_ARRAY); d->ca = NULL; }
+    if (d->str) { OCIHandleFree(d->str, OCI_HTYPE_DIRPATH_STREAM); d->str = NULL; }
+    raise_caml_exception(errcode, errbuf);
+  }
+  d->prepared = 1;
+}
+
+/* rewrite packed OCIDates in place as 7-byte internal DATEs */
+static void odt_to_dat(oci_bind_slot_t* b, int n) {
+  sb2 yyyy;
+  ub1 mm, dd, hh, mi, ss;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    ub1* p = (ub1*)b->ptr + (i * b->width);
+    if (b->inds[i] != 0) {
+      continue;
+    }
+    OCIDateGetDate((OCIDate*)p, &yyyy, &mm, &dd);
+    OCIDateGetTime((OCIDate*)p, &hh, &mi, &ss);
+    p[0] = (yyyy / 100) + 100; p[1] = (yyyy % 100) + 100; p[2] = mm; p[3] = dd;
+    p[4] = hh + 1; p[5] = mi + 1; p[6] = ss + 1;
+  }
+}
+
+/* convert the first n rows of the column array to a stream and load it,
+   more than once if the stream fills up before all rows are converted */
+static void dirpath_stream(oci_handles_t h, oci_dirpath_t* d, ub4 n) {
+  ub4 off = 0;
+  ub4 converted;
+  sword x, y;
+
+  for (;;) {
+    x = OCIDirPathColArrayToStream(d->ca, d->ctx, d->str, h.err, n - off, off);
+    if (x != OCI_SUCCESS && x != OCI_CONTINUE) {
+      CHECK_OCI(x, h);
+    }
+    caml_release_runtime_system();
+    y = OCIDirPathLoadStream(d->ctx, d->str, h.err);
+    caml_acquire_runtime_system();
+    CHECK_OCI(y, h);
+    OCIDirPathStreamReset(d->str, h.err);
+    if (x == OCI_SUCCESS) {
+      break;
+    }
+    OCIAttrGet(d->ca, OCI_HTYPE_DIRPATH_COLUMN_ARRAY, &converted, 0, OCI_ATTR_ROW_COUNT, h.err);
+    off += converted;
+  }
+}
+
+/* load one batch of bulk_columns, all the same length, packed exactly as
+   orabindexec_columns packs them - the first batch fixes each column's type */
+value caml_oci_dirpath_load(value handles, value dirpath, value columns) {
+  CAMLparam3(handles, dirpath, columns);
+  oci_handles_t h = Oci_handles_val(handles);
+  oci_dirpath_t* d = Oci_dirpath_val(dirpath);
+  int n = d->ncols > 0 ? oci_bulk_column_rows(Field(columns, 0)) : 0;
+  int i, r, c, base, cnt;
+  sword x;
+
+  for (i = 0; i < d->ncols; i++) {
+    oci_bind_slot_t* b = &d->cols[i];
+    oci_pack_column(b, Field(columns, i));
+    if (d->prepared && b->dtype != d->sqlt[i]) {
+      for (r = 0; r < n && b->inds[r] != 0; r++);
+      if (r < n) { /* an all-NULL column can go as anything */
+	caml_invalid_argument("oradpload: column datatype differs from the first batch");
+      }
+    }
+  }
+  if (!d->prepared) {
+    dirpath_prepare(h, d);
+  }
+
+  for (i = 0; i < d->ncols; i++) {
+    if (d->sqlt[i] == SQLT_ODT && d->cols[i].dtype == SQLT_ODT) {
+      odt_to_dat(&d->cols[i], n);
+    }
+  }
+
+  for (base = 0; base < n; base += cnt) {
+    cnt = (n - base) < (int)d->ca_rows ? (n - base) : (int)d->ca_rows;
+    for (r = 0; r < cnt; r++) {
+      for (c = 0; c < d->ncols; c++) {
+	oci_bind_slot_t* b = &d->cols[c];
+	int row = base + r;
+	ub4 len;
+	if (b->inds[row] != 0) {
+	  x = OCIDirPathColArrayEntrySet(d->ca, h.err, r, c, NULL, 0, OCI_DIRPATH_COL_NULL);
+	} else {
+	  switch (b->dtype) {
+	  case SQLT_CHR: len = b->lens[row]; break;
+	  case SQLT_ODT: len = SQLT_DAT_SIZE; break;
+	  default:       len = b->width; break;
+	  }
+	  x = OCIDirPathColArrayEntrySet(d->ca, h.err, r, c, (ub1*)b->ptr + (row * b->width), len, OCI_DIRPATH_COL_COMPLETE);
+	}
+	CHECK_OCI(x, h);
+      }
+    }
+    dirpath_stream(h, d, cnt);
+    OCIDirPathColArrayReset(d->ca, h.err);
+  }
+
+#ifdef DEBUG
+  char dbuf[256]; snprintf(dbuf, 255, "caml_oci_dirpath_load: loaded %d rows", n); debug(dbuf);
+#endif
+
+  CAMLreturn(Val_unit);
+}
+
+/* commit the loaded data and rebuild indexes, or throw it all away */
+value caml_oci_dirpath_finish(value handles, value dirpath, value abort) {
+  CAMLparam3(handles, dirpath, abort);
+  oci_handles_t h = Oci_handles_val(handles);
+  oci_dirpath_t* d = Oci_dirpath_val(dirpath);
+  sb4 errcode = 0;
+  char errbuf[256];
+  sword x = OCI_SUCCESS;
+
+  if (d->prepared) {
+    caml_release_runtime_system();
+    if (Bool_val(abort)) {
+      x = OCIDirPathAbort(d->ctx, h.err);
+    } else {
+      x = OCIDirPathFinish(d->ctx, h.err);
+    }
+    caml_acquire_runtime_system();
+    d->prepared = 0;
+    if (x != OCI_SUCCESS && !Bool_val(abort)) {
+      /* a load that could not be finished is aborted, not left half done */
+      strcpy(errbuf, "oradpfinish: finish failed\n");
+      OCIErrorGet(h.err, 1, NULL, &errcode, (OraText*)errbuf, sizeof(errbuf), OCI_HTYPE_ERROR);
+      caml_release_runtime_system();
+      OCIDirPathAbort(d->ctx, h.err);
+      caml_acquire_runtime_system();
+      raise_caml_exception(errcode, errbuf);
+    }
+  }
+  CHECK_OCI(x, h);
+
+  CAMLreturn(Val_unit);
+}
+
+/* end of file */
@@ -27,34 +27,80 @@
 
 static struct custom_operations oci_custom_ops = {"oci_custom_ops", NULL, NULL, NULL, NULL, NULL};
 
-/* parse a statement for execution */
-value caml_oci_stmt_prepare(value handles, value stmt, value sql) {
+/* prepare through the session's statement cache, so that a SQL text prepared 
+   before comes back already parsed with its defines in place. The handle the 
+   statement currently holds is given up first - released back to the cache 
+   if it came from there, or freed if it was allocated by oraopen. Returns 
+   the statement type and whether it was found in the cache */
+value caml_oci_stmt_prepare(value handles, value stmt, value sql, value cached) {
 #ifdef DEBUG
   debug("caml_oci_stmt_prepare entered");
 #endif
-  CAMLparam3(handles, stmt, sql);
+  CAMLparam4(handles, stmt, sql, cached);
+  CAMLlocal1(r);
   oci_handles_t h = Oci_handles_val(handles);
-  OCIStmt* sth = Oci_statement_val(stmt);
+  OCIStmt* old = Oci_statement_val(stmt);
+  OCIStmt* sth = NULL;
   char* sqltext = String_val(sql);
   int st_type = 0;
+  int hit = 1;
+  sword x;
 
-  sword x = OCIStmtPrepare(sth, h.err, (text*)sqltext, strlen(sqltext), OCI_NTV_SYNTAX, OCI_DEFAULT);
-  CHECK_OCI(x, h)
+  if (old != NULL) {
+    if (Bool_val(cached)) {
+      OCIStmtRelease(old, h.err, NULL, 0, OCI_DEFAULT);
+    } else {
+      OCIHandleFree((dvoid*)old, OCI_HTYPE_STMT);
+    }
+    Oci_statement_val(stmt) = NULL;
+  }
 
-#ifdef DEBUG
-else {
-    debug("caml_oci_stmt_prepare successful");
+  /* probe the cache first, purely so hits and misses can be counted */
+  x = OCIStmtPrepare2(h.svc, &sth, h.err, (text*)sqltext, strlen(sqltext), NULL, 0, OCI_NTV_SYNTAX, OCI_PREP2_CACHE_SEARCHONLY);
+  if (x != OCI_SUCCESS) {
+    hit = 0;
+    sth = NULL;
+    x = OCIStmtPrepare2(h.svc, &sth, h.err, (text*)sqltext, strlen(sqltext), NULL, 0, OCI_NTV_SYNTAX, OCI_DEFAULT);
+    CHECK_OCI(x, h)
   }
+  Oci_statement_val(stmt) = sth;
+
+#ifdef DEBUG
+  {char dbuf[256]; snprintf(dbuf, 255, "caml_oci_stmt_prepare: statement at %p, cache hit=%d", sth, hit); debug(dbuf);}
 #endif
 
- x = OCIAttrGet(sth, OCI_HTYPE_STMT, (ub2*)&st_type, 0, OCI_ATTR_STMT_TYPE, h.err);
- CHECK_OCI(x, h)
+  x = OCIAttrGet(sth, OCI_HTYPE_STMT, (ub2*)&st_type, 0, OCI_ATTR_STMT_TYPE, h.err);
+  CHECK_OCI(x, h)
  
 #ifdef DEBUG
- char dbuf[256]; snprintf(dbuf, 255, "caml_oci_stmt_prepare: stmt_type=%d", st_type); debug(dbuf);
+  char dbuf[256]; snprintf(dbuf, 255, "caml_oci_stmt_prepare: stmt_type=%d", st_type); debug(dbuf);
 #endif
 
- CAMLreturn(Val_int(st_type));
+  r = caml_alloc_tuple(2);
+  Store_field(r, 0, Val_int(st_type));
+  Store_field(r, 1, Val_bool(hit));
+  CAMLreturn(r);
+}
+
+/* give a statement handle from OCIStmtPrepare2 back to the cache */
+value caml_oci_stmt_release(value handles, value stmt) {
+  CAMLparam2(handles, stmt);
+  oci_handles_t h = Oci_handles_val(handles);
+  OCIStmt* sth = Oci_statement_val(stmt);
+
+  if (sth != NULL) {
+    sword x = OCIStmtRelease(sth, h.err, NULL, 0, OCI_DEFAULT);
+    Oci_statement_val(stmt) = NULL;
+    CHECK_OCI(x, h)
+  }
+  CAMLreturn(Val_unit);
+}
+
+/* identity of the OCI statement a handle currently holds, to tell whether a 
+   cache hit returned the very statement some define state was built on */
+value caml_oci_stmt_id(value stmt) {
+  CAMLparam1(stmt);
+  CAMLreturn(caml_copy_nativeint((intnat)Oci_statement_val(stmt)));
 }
 
 /* execute an already-prepared statement - throws ORA-24337 if not prepared */
@@ -68,21 +114,33 @@ value caml_oci_stmt_execute(value handles, value stmt, value autocommit, value d
   OCIStmt* sth = Oci_statement_val(stmt);
   int ac = Bool_val(autocommit);
   int d = Bool_val(desconly);
+  ub2 st_type = 0;
+  ub4 iters = 1;
   sword x;
 
+  /* rows of a SELECT are fetched in batches by caml_oci_fetch_rows, so do not
+     have the execute itself fetch one into the defines */
+  x = OCIAttrGet(sth, OCI_HTYPE_STMT, &st_type, 0, OCI_ATTR_STMT_TYPE, h.err);
+  CHECK_OCI(x, h)
+  if (st_type == OCI_STMT_SELECT) {
+    iters = 0;
+  }
+
   if (d) { /* implicit describe, but do not run query */
 #ifdef DEBUG
       debug("caml_oci_stmt_execute: describing only");
 #endif
+    caml_release_runtime_system();
     x = OCIStmtExecute(h.svc, sth, h.err, 1,  0, (CONST OCISnapshot*) NULL, (OCISnapshot*) NULL, OCI_DESCRIBE_ONLY);
+    caml_acquire_runtime_system();
   } else {
     /* this may take a while */
     caml_release_runtime_system();
     if (!ac) { /* run query normally */
       //BREAKPOINT
-      x = OCIStmtExecute(h.svc, sth, h.err, 1,  0, (CONST OCISnapshot*) NULL, (OCISnapshot*) NULL, OCI_DEFAULT);
+      x = OCIStmtExecute(h.svc, sth, h.err, iters,  0, (CONST OCISnapshot*) NULL, (OCISnapshot*) NULL, OCI_DEFAULT);
     } else { /* run query and commit immediately */
-      x = OCIStmtExecute(h.svc, sth, h.err, 1,  0, (CONST OCISnapshot*) NULL, (OCISnapshot*) NULL, OCI_COMMIT_ON_SUCCESS);
+      x = OCIStmtExecute(h.svc, sth, h.err, iters,  0, (CONST OCISnapshot*) NULL, (OCISnapshot*) NULL, OCI_COMMIT_ON_SUCCESS);
 #ifdef DEBUG
       debug("caml_oci_stmt_execute: autocommit is ON");
 #endif
@@ -99,12 +157,52 @@ value caml_oci_stmt_execute(value handles, value stmt, value autocommit, value d
 }
 
 
+/* one attempt at an execute in non-blocking mode - true if it completed, 
+   false if it is still executing and should be called again */
+value caml_oci_stmt_execute_nb(value handles, value stmt, value autocommit) {
+  CAMLparam3(handles, stmt, autocommit);
+  oci_handles_t h = Oci_handles_val(handles);
+  OCIStmt* sth = Oci_statement_val(stmt);
+  ub4 mode = Bool_val(autocommit) ? OCI_COMMIT_ON_SUCCESS : OCI_DEFAULT;
+  ub2 st_type = 0;
+  sword x;
+
+  x = OCIAttrGet(sth, OCI_HTYPE_STMT, &st_type, 0, OCI_ATTR_STMT_TYPE, h.err);
+  CHECK_OCI(x, h)
+
+  x = OCIStmtExecute(h.svc, sth, h.err, st_type == OCI_STMT_SELECT ? 0 : 1, 0, (CONST OCISnapshot*) NULL, (OCISnapshot*) NULL, mode);
+  if (x == OCI_STILL_EXECUTING) {
+    CAMLreturn(Val_false);
+  }
+  CHECK_OCI(x, h)
+
+  CAMLreturn(Val_true);
+}
+
+/* as caml_oci_stmt_execute_nb, for a commit */
+value caml_oci_commit_nb(value handles) {
+  CAMLparam1(handles);
+  oci_handles_t h = Oci_handles_val(handles);
+
+  sword x = OCITransCommit(h.svc, h.err, 0);
+  if (x == OCI_STILL_EXECUTING) {
+    CAMLreturn(Val_false);
+  }
+  CHECK_OCI(x, h);
+
+  CAMLreturn(Val_true);
+}
+
 /* commit all work outstanding on this handle  */
 value caml_oci_commit (value handles) {
   CAMLparam1(handles);
   oci_handles_t h = Oci_handles_val(handles);
 
-  sword x = OCITransCommit(h.svc, h.err, 0);
+  sword x;
+
+  caml_release_runtime_system();
+  x = OCITransCommit(h.svc, h.err, 0);
+  caml_acquire_runtime_system();
   CHECK_OCI(x, h);
 
   CAMLreturn(Val_unit);
@@ -115,7 +213,11 @@ value caml_oci_rollback (value handles) {
   CAMLparam1(handles);
   oci_handles_t h = Oci_handles_val(handles);
 
-  sword x = OCITransRollback(h.svc, h.err, 0);
+  sword x;
+
+  caml_release_runtime_system();
+  x = OCITransRollback(h.svc, h.err, 0);
+  caml_acquire_runtime_system();
   CHECK_OCI(x, h)
 
   CAMLreturn(Val_unit);
@@ -154,180 +256,145 @@ value caml_oci_stmt_alloc(value env) {
 value caml_oci_stmt_free(value stmt) {
   CAMLparam1(stmt);
   OCIStmt* s = Oci_statement_val(stmt);
-  OCIHandleFree((dvoid*)s, OCI_HTYPE_STMT);
+  if (s != NULL) {
+    OCIHandleFree((dvoid*)s, OCI_HTYPE_STMT);
+    Oci_statement_val(stmt) = NULL;
+  }
    CAMLreturn(Val_unit);
 }
 
-/* dates are special as we need to maintain the allocated OCIDate object */
-value caml_oci_bind_date_by_pos(value handles, value stmt, value bindh, value pos, value colval) {
-  CAMLparam5(handles, stmt, bindh, pos, colval);
-  oci_handles_t h = Oci_handles_val(handles);
-  OCIStmt* s = Oci_statement_val(stmt);
-  OCIBind* bh = Oci_bindhandle_val(bindh);
-  int p = Int_val(pos);
-  double epoch = Double_val(colval); /* datetime is epoch at this point - must convert to Oracle */
-
-  OCIDate ocidate;
-  epoch_to_ocidate(epoch, &ocidate);
-  /* allocate a new OCIDate on the heap and copy onto it */
-  OCIDate* od2 = (OCIDate*)malloc(sizeof(OCIDate));
-  memcpy(od2, &ocidate, sizeof(OCIDate));
-#ifdef DEBUG
-  char* fmt = "DD-MON-YYYY HH24:MI:SS";
-  char dbuf[256];
-  ub4 dbufsize=255;
-  debug("testing converted OCIDate:");
-  OCIDateToText(h.err, (const OCIDate*)od2, (text*)fmt, (ub1)strlen(fmt), (text*)0, (ub4)0, &dbufsize, (text*)dbuf);
-  debug(dbuf);
-#endif
-  sword x = OCIBindByPos(s, &bh, h.err, (ub4)p, (dvoid*)od2, (sb4)sizeof(OCIDate), SQLT_ODT, 0, 0, 0, 0, 0, OCI_DEFAULT);
-  CHECK_OCI(x,h);
-  CAMLreturn((value)od2);  /* I am assuming the OCaml GC will just take care of this... */
+/* free a bind slot - the bind handle itself belongs to the statement */
+void caml_oci_free_bind_slot(value slot) {
+  CAMLparam1(slot);
+  oci_bind_slot_t* b = Oci_bind_slot_val(slot);
+  free(b->ptr);
+  free(b->inds);
+  free(b->lens);
+  free(b);
+  CAMLreturn0;
 }
 
-/* bind colval at position pos using bind handle bh in statement stmt OR to named parameter name depending on bindtype */
-value caml_oci_bind_by_pos(value handles, value stmt, value bindh, value posandtype, value colval) {
-#ifdef DEBUG
-  debug("caml_oci_bind_by_pos: entered");
-#endif
-  CAMLparam5(handles, stmt, bindh, posandtype, colval);
+static struct custom_operations oci_bind_slot_custom_ops = {"oci_bind_slot_custom_ops", &caml_oci_free_bind_slot, NULL, NULL, NULL, NULL};
 
-  int dt = Int_val(Field(posandtype, 1));
-  int p = Int_val(Field(posandtype, 0));
-#ifdef DEBUG
-  char dbuf[256]; snprintf(dbuf, 255, "binding datatype %d to position %d", dt, p); debug(dbuf);
-#endif
+/* allocate an empty bind slot, bound on first use */
+value caml_oci_alloc_bind_slot(value unit) {
+  CAMLparam1(unit);
+  oci_bind_slot_t* b = (oci_bind_slot_t*)calloc(1, sizeof(oci_bind_slot_t));
 
-  oci_handles_t h = Oci_handles_val(handles);
-  OCIStmt* s = Oci_statement_val(stmt);
-  OCIBind* bh = Oci_bindhandle_val(bindh);
-
-  /* annoyingly can't create a local var immediately after a case in GCC - http://gcc.gnu.org/bugzilla/show_bug.cgi?id=37231  */
-  union cv_t {
-    char* c;
-    int i;
-    double f;
-  } c;
-  
-  sword x;
-  void* ptr;
-  
-  switch (dt) {
-  case SQLT_STR:
-    c.c = String_val(Field(colval,0));
-    int l = strlen(c.c); 
-    ptr = (char*)malloc(l+1);
-    strncpy(ptr, c.c, l);
+  value v = caml_alloc_custom(&oci_bind_slot_custom_ops, sizeof(oci_bind_slot_t*), 0, 1);
+  Oci_bind_slot_val(v) = b;
+  CAMLreturn(v);
+}
 
-    x = OCIBindByPos(s, &bh, h.err, (ub4)p, (dvoid*)ptr, (sb4)l, SQLT_CHR, 0, 0, 0, 0, 0, OCI_DEFAULT);
-    break;
-  case SQLT_ODT: 
-    debug("caml_oci_bind_by_pos: should use caml_oci_bind_date_by_pos() for dates");
-    break;
-  case SQLT_INT: 
-    c.i = Int_val(Field(colval,0)); 
-    ptr = (int*)malloc(sizeof(int)); 
-    memcpy(ptr, &c.i, sizeof(int));  
-    x = OCIBindByPos(s, &bh, h.err, (ub4)p, (dvoid*)ptr, (sb4) sizeof(int), SQLT_INT, 0, 0, 0, 0, 0, OCI_DEFAULT); 
-    break;
-  case SQLT_FLT:
-    c.f = Double_val(Field(colval, 0));
-    ptr = (double*)malloc(sizeof(double));
-    memcpy(ptr, &c.f, sizeof(double));
-    x = OCIBindByPos(s, &bh, h.err, (ub4)p, (dvoid*)ptr, (sb4) sizeof(double), SQLT_FLT, 0, 0, 0, 0, 0, OCI_DEFAULT);
-    break;
-  default:
-    debug("oci_bind_by_pos: unexpected datatype");
+/* make sure a slot has buffers of at least width bytes for each of rows rows 
+   of type sqlt, reallocating if not - returns true if it must be bound again */
+int oci_bind_slot_reserve(oci_bind_slot_t* b, int sqlt, int width, int rows) {
+  if (b->dtype == sqlt && b->width >= width && b->rows >= rows) {
+    return 0;
   }
-
-  CHECK_OCI(x, h);
-  
-  CAMLreturn((value)ptr);
+  free(b->ptr); free(b->inds); free(b->lens);
+  b->ptr  = calloc(rows, width);
+  b->inds = (sb2*)calloc(rows, sizeof(sb2));
+  b->lens = (ub2*)calloc(rows, sizeof(ub2));
+  b->width = width;
+  b->rows = rows;
+  b->dtype = sqlt;
+  b->bound = 0;
+  return 1;
 }
 
+/* bind a slot's current buffers to a Pos or Name in the statement - strings 
+   are bound as SQLT_CHR with their lengths in lens so need no terminator. A 
+   slot's bind handle is reused, so rebinding allocates nothing new */
+void oci_bind_slot_bind(oci_handles_t h, OCIStmt* s, value bs, oci_bind_slot_t* b) {
+  sword x;
 
-/* same again but by name */
-value caml_oci_bind_date_by_name(value handles, value stmt, value bindh, value name, value colval) {
-  CAMLparam5(handles, stmt, bindh, name, colval);
-  oci_handles_t h = Oci_handles_val(handles);
-  OCIStmt* s = Oci_statement_val(stmt);
-  OCIBind* bh = Oci_bindhandle_val(bindh);
-  char* n = String_val(name);
-  double epoch = Double_val(colval); /* datetime is epoch at this point - must convert to Oracle */
-
-  OCIDate ocidate;
-  epoch_to_ocidate(epoch, &ocidate);
-  /* allocate a new OCIDate on the heap and copy onto it */
-  OCIDate* od2 = (OCIDate*)malloc(sizeof(OCIDate));
-  memcpy(od2, &ocidate, sizeof(OCIDate));
-
-  sword x = OCIBindByName(s, &bh, h.err, (text*)n, (sb4)strlen((char*)n),(dvoid*)od2, (sb4)sizeof(OCIDate), SQLT_ODT, 0, 0, 0, 0, 0, OCI_DEFAULT);
+  if (Tag_val(bs) == 0) { /* Pos p */
+    x = OCIBindByPos(s, &b->bh, h.err, (ub4)Int_val(Field(bs, 0)), b->ptr, (sb4)b->width, b->dtype, b->inds, b->lens, 0, 0, 0, OCI_DEFAULT);
+  } else { /* Name n, already with its leading : */
+    char* n = String_val(Field(bs, 0));
+    x = OCIBindByName(s, &b->bh, h.err, (text*)n, (sb4)strlen(n), b->ptr, (sb4)b->width, b->dtype, b->inds, b->lens, 0, 0, 0, OCI_DEFAULT);
+  }
   CHECK_OCI(x, h);
+  b->bound = 1;
 
-   CAMLreturn((value)od2);  /* I am assuming the OCaml GC will just take care of this... */
-}
-
-/* bind colval at position pos using bind handle bh in statement stmt OR to named parameter name depending on bindtype */
-value caml_oci_bind_by_name(value handles, value stmt, value bindh, value posandtype, value colval) {
-#ifdef DEBUG
-  debug("caml_oci_bind_by_name: entered");
-#endif
-  CAMLparam5(handles, stmt, bindh, posandtype, colval);
-
-  int dt = Int_val(Field(posandtype, 1));
-  char* n = String_val(Field(posandtype, 0));
 #ifdef DEBUG
-  char dbuf[256]; snprintf(dbuf, 255, "binding datatype %d to position '%s'", dt, n); debug(dbuf);
+  char dbuf[256]; snprintf(dbuf, 255, "oci_bind_slot_bind: bound sqlt=%d width=%d rows=%d", b->dtype, b->width, b->rows); debug(dbuf);
 #endif
+}
 
+/* write colval into a slot, binding it first only if this is the first use, 
+   the type has changed, or the value does not fit. dtype is one of SQLT_STR,
+   SQLT_INT, SQLT_FLT or SQLT_ODT, and a date arrives as Number epoch */
+value caml_oci_bind_slot(value handles, value stmt, value slot, value specandtype, value colval) {
+  CAMLparam5(handles, stmt, slot, specandtype, colval);
   oci_handles_t h = Oci_handles_val(handles);
   OCIStmt* s = Oci_statement_val(stmt);
-  OCIBind* bh = Oci_bindhandle_val(bindh);
+  oci_bind_slot_t* b = Oci_bind_slot_val(slot);
+  value bs = Field(specandtype, 0);
+  int dt = Int_val(Field(specandtype, 1));
+  int need = 0;
+  int sqlt = 0;
+  int w;
 
-  union cv_t {
-    char* c;
-    int i;
-    double f;
-  } c;
-  
-  sword x;
-  void* ptr;
-  
   switch (dt) {
   case SQLT_STR:
-    c.c = String_val(Field(colval,0));
-    int l = strlen(c.c); 
-    ptr = (char*)malloc(l+1);
-    strncpy(ptr, c.c, l);
-
-    x = OCIBindByName(s, &bh, h.err, (text*)n, (sb4)strlen((char*)n), (dvoid*)ptr, (sb4)l, SQLT_CHR, 0, 0, 0, 0, 0, OCI_DEFAULT);
-    break;
-  case SQLT_ODT: 
-    debug("caml_oci_bind_by_pos: should use caml_oci_bind_date_by_name() for dates");
+    need = caml_string_length(Field(colval, 0));
+    sqlt = SQLT_CHR;
+    if (need > MAXBINDLEN) {
+      caml_invalid_argument("orabind: string is longer than 65535 bytes, bind it as a LOB");
+    }
     break;
-  case SQLT_INT: 
-    c.i = Int_val(Field(colval,0)); 
-    ptr = (int*)malloc(sizeof(int)); 
-    memcpy(ptr, &c.i, sizeof(int));  
-    x = OCIBindByName(s, &bh, h.err, (text*)n, (sb4)strlen((char*)n), (dvoid*)ptr, (sb4) sizeof(int), SQLT_INT, 0, 0, 0, 0, 0, OCI_DEFAULT); 
+  case SQLT_INT:
+    need = sizeof(sb8);
+    sqlt = SQLT_INT;
     break;
   case SQLT_FLT:
-    c.f = Double_val(Field(colval, 0));
-    ptr = (double*)malloc(sizeof(double));
-    memcpy(ptr, &c.f, sizeof(double));
-    x = OCIBindByName(s, &bh, h.err, (text*)n, (sb4)strlen((char*)n), (dvoid*)ptr, (sb4) sizeof(double), SQLT_FLT, 0, 0, 0, 0, 0, OCI_DEFAULT);
+    need = sizeof(double);
+    sqlt = SQLT_FLT;
+    break;
+  case SQLT_ODT:
+    need = sizeof(OCIDate);
+    sqlt = SQLT_ODT;
+    break;
+  case SQLT_CLOB: /* either kind of LOB, bound as the one the locator is */
+    need = sizeof(OCILobLocator*);
+    sqlt = Oci_lob_val(Field(colval, 0))->sqlt;
     break;
   default:
-    debug("caml_oci_bind_by_pos: unexpected datatype");
+    caml_invalid_argument("caml_oci_bind_slot: unexpected datatype");
   }
+  w = need;
 
-  CHECK_OCI(x, h);
-  
-#ifdef DEBUG
-  debug("bind by name OK");
-#endif
+  if (sqlt == SQLT_CHR) { /* leave room to grow so a longer string rarely rebinds */
+    for (w = 32; w < need; w *= 2);
+  }
+  if (oci_bind_slot_reserve(b, sqlt, w, 1) || !b->bound) {
+    oci_bind_slot_bind(h, s, bs, b);
+  }
+
+  switch (sqlt) {
+  case SQLT_CHR:
+    memcpy(b->ptr, String_val(Field(colval, 0)), need);
+    b->lens[0] = (ub2)need;
+    break;
+  case SQLT_INT:
+    *(sb8*)b->ptr = Long_val(Field(colval, 0));
+    break;
+  case SQLT_FLT:
+    *(double*)b->ptr = Double_val(Field(colval, 0));
+    break;
+  case SQLT_ODT:
+    epoch_to_ocidate(Double_val(Field(colval, 0)), (OCIDate*)b->ptr);
+    break;
+  case SQLT_CLOB:
+  case SQLT_BLOB: /* the locator must stay alive until the statement is executed */
+    *(OCILobLocator**)b->ptr = Oci_lob_val(Field(colval, 0))->loc;
+    break;
+  }
+  b->inds[0] = 0;
 
-  CAMLreturn((value)ptr);
+  CAMLreturn(Val_unit);
 }
 
 /* end of file */
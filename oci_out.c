@@ -276,6 +276,15 @@ value caml_oci_get_date_from_context(value handles, value context, value index)
   CAMLreturn(caml_copy_double(d));
 }
 
+/* same, but as a Unix.tm built straight from the OCIDate */
+value caml_oci_get_tm_from_context(value handles, value context, value index) {
+  CAMLparam3(handles, context, index);
+  cb_context_t  c = C_context_val(context);
+  out_date_t* offset = (out_date_t*)(*(void**)(c.cht.ptr) + (Int_val(index) * sizeof(out_date_t)));
+
+  CAMLreturn(ocidate_to_unix_tm(&offset->bufpp));
+}
+
 /* same again for strings */
 sb4 cbf_get_string(dvoid *ctxp, OCIBind *bindp, ub4 iter, ub4 index,
 		 dvoid **bufpp, ub4 **alenp, ub1 *piecep,
@@ -372,101 +381,131 @@ value caml_oci_get_string_from_context(value handles, value context, value index
   CAMLreturn(caml_copy_string(s));
 }
 
-/* get the position of a named bind - this is a bit of a mess but 
-   OCIStmtGetBindInfo() doesn't do what I want it to do*/
-value caml_oci_get_pos_from_name(value handles, value stmt, value bind_name) {
-  CAMLparam3(handles, stmt, bind_name);
+/* names of all the bind variables in a prepared statement in position order,
+   uppercase and without the leading colon, read in chunks of MAXBINDINFO - 
+   this is worked out by the client from the SQL text */
+#define MAXBINDINFO 255
+value caml_oci_get_bind_names(value handles, value stmt) {
+  CAMLparam2(handles, stmt);
+  CAMLlocal2(names, n);
   oci_handles_t h = Oci_handles_val(handles);
   OCIStmt* s = Oci_statement_val(stmt);
-  char* nm = String_val(bind_name);
-  int i = 0; int r = -1;
+  int i = 0; int total = 0; int chunk = 0;
+  ub4 start = 1;
 
-  /* temporary variables - for once I am glad of stack alloc  */
   sb4 found = 0;
-  text* bvns[255];
-  ub1 bvnls[255];
-  text* invs[255];
-  ub1 invls[255];
-  ub1 dupls[255];
-  OCIBind* bhnds[255];
-  OCIStmtGetBindInfo(s, h.err, (ub4)255, (ub4)1, &found, bvns, bvnls, invs, invls, dupls, bhnds);
+  text* bvns[MAXBINDINFO];
+  ub1 bvnls[MAXBINDINFO];
+  text* invs[MAXBINDINFO];
+  ub1 invls[MAXBINDINFO];
+  ub1 dupls[MAXBINDINFO];
+  OCIBind* bhnds[MAXBINDINFO];
+
+  sword x = OCIStmtGetBindInfo(s, h.err, (ub4)MAXBINDINFO, start, &found, bvns, bvnls, invs, invls, dupls, bhnds);
+  if (x == OCI_NO_DATA) { /* no binds at all */
+    CAMLreturn(Atom(0));
+  }
+  CHECK_OCI(x, h);
 
-#ifdef DEBUG
-  char dbuf[256]; snprintf(dbuf, 255, "caml_oci_get_pos_from_name: looking for %s", nm); debug(dbuf);
-#endif
+  total = found < 0 ? -found : found; /* negative when there are more than fit */
+  names = caml_alloc(total, 0);
 
-  for (i = 0; i < found; i++) {
+  while (1) {
+    chunk = (total - (int)start + 1) < MAXBINDINFO ? (total - (int)start + 1) : MAXBINDINFO;
+    for (i = 0; i < chunk; i++) {
+      n = caml_alloc_string(bvnls[i]);
+      memcpy((char*)String_val(n), bvns[i], bvnls[i]);
+      Store_field(names, start - 1 + i, n);
 #ifdef DEBUG
-    snprintf(dbuf, 255, "caml_oci_get_pos_from_name: found name %s at pos %d", (char*)bvns[i], i + 1); debug(dbuf);
+      char dbuf[256]; snprintf(dbuf, 255, "caml_oci_get_bind_names: found name %s at pos %d", String_val(n), start + i); debug(dbuf);
 #endif
-    if ((strncmp(nm, (char*)bvns[i], bvnls[i])) == 0) {
-      r = i + 1;
     }
+    start += MAXBINDINFO;
+    if ((int)start > total) {
+      break;
+    }
+    x = OCIStmtGetBindInfo(s, h.err, (ub4)MAXBINDINFO, start, &found, bvns, bvnls, invs, invls, dupls, bhnds);
+    CHECK_OCI(x, h);
   }
 
-  CAMLreturn(Val_int(r));
+  CAMLreturn(names);
 }
 
-/* a "/dev/null" buffer for dumping return codes I don't care about right now 
-   into, e.g. alen of a ref cursor is meaningless */
-ub4 dummy = 0;
-
-/* callback for ref cursors - we get the statement as context, then point the buffer at it */
+/* callback for ref cursors - the context holds the statement to point the 
+   buffer at, and somewhere for the length, indicator and return code, which
+   are meaningless for a ref cursor. One per bind, so that binds running at 
+   the same time do not share it */
 sb4 cbf_ref_cursor(dvoid *ctxp, OCIBind *bindp, ub4 iter, ub4 index,
 		 dvoid **bufpp, ub4 **alenp, ub1 *piecep,
 		 dvoid **indpp, ub2 **rcodepp) {
 
-  OCIStmt **stmtp = (OCIStmt **) ctxp;
+  out_ref_cursor_t* rc = (out_ref_cursor_t*)ctxp;
 
 #ifdef DEBUG
-  char dbuf[256]; snprintf(dbuf, 255, "cbf_ref_cursor: *bufpp=%p", stmtp); debug(dbuf);
+  char dbuf[256]; snprintf(dbuf, 255, "cbf_ref_cursor: *bufpp=%p", rc->stmt); debug(dbuf);
 #endif
 
-  *bufpp = stmtp;
-  *alenp = (void*)&dummy;
+  *bufpp = rc->stmt;
+  *alenp = &rc->alen;
   *piecep = OCI_ONE_PIECE;
-  *indpp = (void*)&dummy;
-  *rcodepp = (void*)&dummy;
+  *indpp = &rc->ind;
+  *rcodepp = &rc->rc;
 
   return OCI_CONTINUE;
 }
 
 sb4 cbf_ref_cursor_in(dvoid *ctxp, OCIBind *bindp, ub4 iter, ub4 index,
                       dvoid **bufpp, ub4 *alenpp, ub1 *piecep, dvoid **indpp) {
-  OCIStmt **stmtp = (OCIStmt **) ctxp;
+  out_ref_cursor_t* rc = (out_ref_cursor_t*)ctxp;
 
 #ifdef DEBUG
-  char dbuf[256]; snprintf(dbuf, 255, "cbf_ref_cursor_in: *bufpp=%p", stmtp); debug(dbuf);
+  char dbuf[256]; snprintf(dbuf, 255, "cbf_ref_cursor_in: *bufpp=%p", rc->stmt); debug(dbuf);
 #endif
 
-  *bufpp = stmtp;
-  *alenpp = dummy;
-  *indpp = (void*)&dummy;
+  *bufpp = rc->stmt;
+  *alenpp = 0;
+  *indpp = &rc->ind;
   *piecep = OCI_ONE_PIECE;
 
   return OCI_CONTINUE;
 }
 
+/* returns the callback context, which must be kept until the statement has 
+   been executed and the cursor fetched */
 value caml_oci_bind_ref_cursor(value handles, value statement, value bindh, value pos, value refcursor) {
   CAMLparam5(handles, statement, bindh, pos, refcursor);
   oci_handles_t h = Oci_handles_val(handles);
   OCIStmt* s = Oci_statement_val(statement);
   OCIBind* bh = Oci_bindhandle_val(bindh);
   int p = Int_val(pos);
-  OCIStmt* rc = Oci_statement_val(refcursor);
+  OCIStmt* r = Oci_statement_val(refcursor);
+  cb_context_t cbct = { { NULL, 0 }, h.err };
+  out_ref_cursor_t* rc;
   sword x;
 
 #ifdef DEBUG
-  char dbuf[256]; snprintf(dbuf, 255, "caml_oci_bind_ref_cursor: rc=%p", rc); debug(dbuf);
+  char dbuf[256]; snprintf(dbuf, 255, "caml_oci_bind_ref_cursor: rc=%p", r); debug(dbuf);
 #endif
 
+  rc = (out_ref_cursor_t*)calloc(1, sizeof(out_ref_cursor_t));
+  rc->stmt = r;
+  cbct.cht.ptr = rc;
+
   x = OCIBindByPos(s, &bh, h.err, (ub4)p, NULL, 0, SQLT_RSET, 0, 0, 0, 0, 0, OCI_DATA_AT_EXEC);
-  CHECK_OCI(x, h);
+  if (x != OCI_SUCCESS) {
+    free(rc);
+    oci_non_success(h);
+  }
 
   x = OCIBindDynamic(bh, h.err, (dvoid*)rc, cbf_ref_cursor_in, (dvoid*)rc, cbf_ref_cursor);
-  CHECK_OCI(x, h);
-  
-  CAMLreturn(Val_unit);
+  if (x != OCI_SUCCESS) {
+    free(rc);
+    oci_non_success(h);
+  }
+
+  value v = caml_alloc_custom(&c_context_t_custom_ops, sizeof(cb_context_t), 0, 1);
+  C_context_val(v) = cbct;
+  CAMLreturn(v);
 }
 
 /* end of file */
@@ -6,13 +6,27 @@
 #include <caml/custom.h>
 #include <caml/callback.h>
 #include <caml/fail.h>
+#include <caml/bigarray.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
 #include <oci.h>
 #include <ocidfn.h>
 #include "oci_wrapper.h"
 
+#if OCAML_VERSION_MINOR >= 12
+#include <caml/threads.h>
+#else
+#include <caml/signals.h>
+#endif 
+
+/* from threads.h in 3.12 only */
+#ifndef caml_acquire_runtime_system
+#define caml_acquire_runtime_system caml_leave_blocking_section
+#define caml_release_runtime_system caml_enter_blocking_section
+#endif
+
 /* Retrieve all the column names from the last query done on this statement handles as a string array */
 value caml_oci_get_column_types(value handles, value stmt) {
   CAMLparam2(handles, stmt);
@@ -57,6 +71,7 @@ value caml_oci_get_column_types(value handles, value stmt) {
 #endif
     coltuple = caml_alloc_tuple(5);
     Store_field(coltuple, 0, caml_copy_string((char*)col_name2));  /* name */
+    free(col_name2);
     Store_field(coltuple, 1, Val_long(col_type));                 /* type */    
     Store_field(coltuple, 2, Val_long(col_size + 1));                 /* size (for VARCHAR) */ /* +1 fixes problem with SELECT 1 FROM DUAL actually returned as 1. - we undo this cosmetically in oradesc */
 
@@ -80,15 +95,24 @@ value caml_oci_get_column_types(value handles, value stmt) {
 void caml_oci_free_defhandle(value dh) {
   CAMLparam1(dh);
   oci_define_t x = Oci_defhandle_val(dh);
+  int i;
+  if (x.sqlt == SQLT_CLOB || x.sqlt == SQLT_BLOB) { /* any locators not handed to OCaml */
+    for (i = 0; i < x.rows; i++) {
+      OCIDescriptorFree(((OCILobLocator**)x.ptr)[i], OCI_DTYPE_LOB);
+    }
+  }
   free(x.ptr);
+  free(x.inds);
+  free(x.lens);
   CAMLreturn0;
 }
 
 static struct custom_operations oci_defhandle_custom_ops = {"oci_defhandle_custom_ops", &caml_oci_free_defhandle, NULL, NULL, NULL, NULL};
 
-/* allocate sufficient memory to store a particular column then return a pointer to it */
-value caml_oci_define(value handles, value stmt, value pos, value dtype, value size) {
-  CAMLparam5(handles, stmt, pos, dtype, size);
+/* allocate sufficient memory to store a particular column for a batch of rows 
+   then return a pointer to it */
+value caml_oci_define(value handles, value stmt, value pos, value dtype, value sizeandrows) {
+  CAMLparam5(handles, stmt, pos, dtype, sizeandrows);
   CAMLlocal1(r);
   r = caml_alloc_tuple(4);
   oci_handles_t h = Oci_handles_val(handles);
@@ -97,35 +121,72 @@ value caml_oci_define(value handles, value stmt, value pos, value dtype, value s
   
   int t = Int_val(Field(dtype, 0)); /* data type */
   int ii = Int_val(Field(dtype, 1)); /* is_int */
+  int native = Bool_val(Field(dtype, 3)); /* NUMBERs as sb8/double rather than OCINumber */
 
-  int s = Int_val(size);
+  int s = Int_val(Field(sizeandrows, 0)); /* column size */
+  int n = Int_val(Field(sizeandrows, 1)); /* rows per fetch */
+  int sqlt = 0;
+  int i;
 
-  oci_define_t defs = { NULL, NULL, 0, 0.0, 0 };
-  defs.dtype = dtype;
+  oci_define_t defs = { NULL, NULL, 0, 0, 0.0, 0, NULL, NULL, 0, 0 };
+  defs.dtype = t;
+  defs.rows = n;
 
   sword x = -1;
   
 #ifdef DEBUG
-  char dbuf[256]; snprintf(dbuf, 255, "caml_oci_define: defining for pos=%d dtype=%d is_int=%d size=%d", p + 1, t, ii, s); debug(dbuf);
+  char dbuf[256]; snprintf(dbuf, 255, "caml_oci_define: defining for pos=%d dtype=%d is_int=%d native=%d size=%d rows=%d", p + 1, t, ii, native, s, n); debug(dbuf);
 #endif
 
   switch (t) {
   case SQLT_CHR:
-    defs.ptr = (void*)malloc(s+1);
-    memset(defs.ptr, 0, s+1); /* fixes problem with odd behavior of SELECT NULL FROM DUAL */
-    x = OCIDefineByPos(sth, &defs.defh, h.err, p + 1, defs.ptr, s+1, SQLT_STR, &defs.ind, 0, 0, OCI_DEFAULT);
+    defs.width = s + 1;
+    sqlt = SQLT_STR;
     break;
   case SQLT_DAT: /* see if we can get this as an OCIDate... */
-    defs.ptr = (void*)malloc(sizeof(OCIDate));
-    x = OCIDefineByPos(sth, &defs.defh, h.err, p + 1, defs.ptr, s+1, SQLT_ODT, &defs.ind, 0, 0, OCI_DEFAULT);
+    defs.width = sizeof(OCIDate);
+    sqlt = SQLT_ODT;
     break;
   case SQLT_NUM:
-    defs.ptr = (void*)malloc(sizeof(OCINumber));
-      x = OCIDefineByPos(sth, &defs.defh, h.err, p + 1, defs.ptr, s, SQLT_VNU, &defs.ind, 0, 0, OCI_DEFAULT);
-      break;
+    if (native) { /* OCI converts the whole batch during the fetch */
+      defs.width = ii ? sizeof(sb8) : sizeof(double);
+      sqlt = ii ? SQLT_INT : SQLT_BDOUBLE;
+    } else {
+      defs.width = sizeof(OCINumber);
+      sqlt = SQLT_VNU;
+    }
+    break;
+  case SQLT_IBFLOAT:
+  case SQLT_IBDOUBLE:
+    defs.width = sizeof(double);
+    sqlt = SQLT_BDOUBLE;
+    break;
+  case SQLT_CLOB:
+  case SQLT_BLOB: /* a locator per row, the data is read through it */
+    defs.width = sizeof(OCILobLocator*);
+    sqlt = t;
+    break;
   default:
     debug("caml_oci_define: unknown datatype to define");
   }
+  defs.sqlt = sqlt;
+
+  if (sqlt) {
+    /* zeroed - fixes problem with odd behavior of SELECT NULL FROM DUAL */
+    defs.ptr  = calloc(n, defs.width);
+    defs.inds = (sb2*)calloc(n, sizeof(sb2));
+    defs.lens = (ub2*)calloc(n, sizeof(ub2));
+    if (sqlt == SQLT_CLOB || sqlt == SQLT_BLOB) {
+      for (i = 0; i < n; i++) {
+	OCIDescriptorAlloc(global_env, (dvoid**)&((OCILobLocator**)defs.ptr)[i], OCI_DTYPE_LOB, 0, 0);
+      }
+    }
+    x = OCIDefineByPos(sth, &defs.defh, h.err, p + 1, defs.ptr, defs.width, sqlt, defs.inds, defs.lens, 0, OCI_DEFAULT);
+    if (x == OCI_SUCCESS && (sqlt == SQLT_CLOB || sqlt == SQLT_BLOB)) { /* have the length come back with the prefetched data */
+      boolean prefetch_length = TRUE;
+      x = OCIAttrSet(defs.defh, OCI_HTYPE_DEFINE, &prefetch_length, 0, OCI_ATTR_LOBPREFETCH_LENGTH, h.err);
+    }
+  }
   
   CHECK_OCI(x, h);
   
@@ -146,9 +207,408 @@ value caml_oci_fetch(value handles, value stmt) {
   oci_handles_t h = Oci_handles_val(handles);
   OCIStmt* sth = Oci_statement_val(stmt);
 
-  sword x = OCIStmtFetch2(sth, h.err, 1, OCI_FETCH_NEXT, 1, OCI_DEFAULT);
+  sword x;
+
+  caml_release_runtime_system();
+  x = OCIStmtFetch2(sth, h.err, 1, OCI_FETCH_NEXT, 1, OCI_DEFAULT);
+  caml_acquire_runtime_system();
+  CHECK_OCI(x, h);
+
+  CAMLreturn(Val_unit);
+}
+
+/* fetch up to rows rows into the define buffers in a single call and return 
+   how many actually arrived - fewer than asked for means the cursor is exhausted.
+   The define buffers are all malloc'ed or Bigarray data, so do not move while
+   the runtime is released */
+static int oci_fetch_array(oci_handles_t h, OCIStmt* sth, int n) {
+  ub4 fetched = 0;
+  sword x;
+
+  caml_release_runtime_system();
+  x = OCIStmtFetch2(sth, h.err, n, OCI_FETCH_NEXT, 0, OCI_DEFAULT);
+  caml_acquire_runtime_system();
+  if (x != OCI_NO_DATA) { /* a short last batch comes back as OCI_NO_DATA */
+    CHECK_OCI(x, h);
+  }
+
+  x = OCIAttrGet(sth, OCI_HTYPE_STMT, &fetched, 0, OCI_ATTR_ROWS_FETCHED, h.err);
+  CHECK_OCI(x, h);
+#ifdef DEBUG
+  char dbuf[256]; snprintf(dbuf, 255, "oci_fetch_array: asked for %d rows, got %d", n, fetched); debug(dbuf);
+#endif
+
+  return (int)fetched;
+}
+
+value caml_oci_fetch_rows(value handles, value stmt, value rows) {
+  CAMLparam3(handles, stmt, rows);
+  oci_handles_t h = Oci_handles_val(handles);
+  OCIStmt* sth = Oci_statement_val(stmt);
+
+  CAMLreturn(Val_int(oci_fetch_array(h, sth, Int_val(rows))));
+}
+
+/* the decoder only holds copies of the define pointers - the define_specs it 
+   was built from must outlive it, which they do as both hang off the statement */
+void caml_oci_free_decoder(value dec) {
+  CAMLparam1(dec);
+  oci_decoder_t* d = Oci_decoder_val(dec);
+  free(d->cols);
+  free(d);
+  CAMLreturn0;
+}
+
+static struct custom_operations oci_decoder_custom_ops = {"oci_decoder_custom_ops", &caml_oci_free_decoder, NULL, NULL, NULL, NULL};
+
+/* compile an array of define_spec {dtype; is_int; is_null; ptr} into a flat 
+   array of column descriptors, so that fetching a row needs no lookups */
+value caml_oci_make_decoder(value defines) {
+  CAMLparam1(defines);
+  int i;
+
+  oci_decoder_t* d = (oci_decoder_t*)calloc(1, sizeof(oci_decoder_t));
+  d->ncols = Wosize_val(defines);
+  d->cols = (oci_coldesc_t*)calloc(d->ncols, sizeof(oci_coldesc_t));
+
+  for (i = 0; i < d->ncols; i++) {
+    value ds = Field(defines, i);
+    d->cols[i].dtype   = Int_val(Field(ds, 0));
+    d->cols[i].is_int  = Bool_val(Field(ds, 1));
+    d->cols[i].is_null = Bool_val(Field(ds, 2));
+    d->cols[i].def     = Oci_defhandle_val(Field(ds, 3));
+    d->rows = d->cols[i].def.rows;
+  }
+
+#ifdef DEBUG
+  char dbuf[256]; snprintf(dbuf, 255, "caml_oci_make_decoder: %d columns, %d rows", d->ncols, d->rows); debug(dbuf);
+#endif
+
+  value v = caml_alloc_custom(&oci_decoder_custom_ops, sizeof(oci_decoder_t*), 0, 1);
+  Oci_decoder_val(v) = d;
+  CAMLreturn(v);
+}
+
+/* error code left on the error handle by the last failed call */
+static int oci_last_error(oci_handles_t h) {
+  text errbuf[256];
+  sb4 errcode = 0;
+  OCIErrorGet((dvoid*)h.err, 1, NULL, &errcode, errbuf, 255, OCI_HTYPE_ERROR);
+  return (int)errcode;
+}
+
+/* build the col_value for row r of one column - a NUMBER too big for an int 
+   comes back as Null (ORA-22060), as it did when decoded in OCaml */
+static value decode_cell(oci_handles_t h, oci_coldesc_t* c, int r, int epoch_dates) {
+  CAMLparam0();
+  CAMLlocal2(cell, v);
+  char* p = (char*)c->def.ptr + (r * c->def.width);
+  sword x;
+
+  if (c->is_null || c->def.inds[r] == -1) {
+    CAMLreturn(Val_int(COL_NULL));
+  }
+
+  switch (c->dtype) {
+  case SQLT_CHR:
+    cell = caml_copy_string(p);
+    v = caml_alloc(1, COL_VARCHAR);
+    break;
+  case SQLT_DAT:
+    if (epoch_dates) {
+      cell = caml_copy_double(ocidate_to_epoch((OCIDate*)p));
+      v = caml_alloc(1, COL_NUMBER);
+    } else {
+      cell = ocidate_to_unix_tm((OCIDate*)p);
+      v = caml_alloc(1, COL_DATETIME);
+    }
+    break;
+  case SQLT_NUM:
+  case SQLT_IBFLOAT:
+  case SQLT_IBDOUBLE:
+    if (c->def.sqlt == SQLT_INT) {
+      /* as below, NULL rather than wrap what does not fit in an OCaml int */
+      sb8 i = *(sb8*)p;
+      if (i > Max_long || i < Min_long) {
+	CAMLreturn(Val_int(COL_NULL));
+      }
+      cell = Val_long(i);
+      v = caml_alloc(1, COL_INTEGER);
+    } else if (c->def.sqlt == SQLT_BDOUBLE) {
+      cell = caml_copy_double(*(double*)p);
+      v = caml_alloc(1, COL_NUMBER);
+    } else if (c->is_int) {
+      sb8 i = 0;
+      x = OCINumberToInt(h.err, (OCINumber*)p, sizeof(sb8), OCI_NUMBER_SIGNED, &i);
+      if (x != OCI_SUCCESS && oci_last_error(h) == 22060) {
+	CAMLreturn(Val_int(COL_NULL));
+      }
+      CHECK_OCI(x, h);
+      if (i > Max_long || i < Min_long) {
+	CAMLreturn(Val_int(COL_NULL));
+      }
+      cell = Val_long(i);
+      v = caml_alloc(1, COL_INTEGER);
+    } else {
+      double d;
+      x = OCINumberToReal(h.err, (OCINumber*)p, sizeof(double), &d);
+      CHECK_OCI(x, h);
+      cell = caml_copy_double(d);
+      v = caml_alloc(1, COL_NUMBER);
+    }
+    break;
+  case SQLT_CLOB:
+  case SQLT_BLOB:
+    /* the locator, and any data prefetched with it, goes to OCaml and a 
+       fresh one takes its place for the next fetch */
+    cell = oci_lob_wrap(h, c->def.sqlt, *(OCILobLocator**)p);
+    *(OCILobLocator**)p = NULL;
+    OCIDescriptorAlloc(global_env, (dvoid**)p, OCI_DTYPE_LOB, 0, 0);
+    v = caml_alloc(1, COL_LOB);
+    break;
+  default:
+#ifdef DEBUG
+    {char dbuf[256]; snprintf(dbuf, 255, "decode_cell: unhandled datatype %d", c->dtype); debug(dbuf);}
+#endif
+    CAMLreturn(Val_int(COL_NULL));
+  }
+
+  Store_field(v, 0, cell);
+  CAMLreturn(v);
+}
+
+/* build the whole col_value array for row r of the define buffers */
+static value decode_row(oci_handles_t h, oci_decoder_t* d, int r) {
+  CAMLparam0();
+  CAMLlocal2(row, cell);
+  int i;
+
+  if (d->ncols == 0) {
+    CAMLreturn(Atom(0));
+  }
+  row = caml_alloc(d->ncols, 0);
+  for (i = 0; i < d->ncols; i++) {
+    cell = decode_cell(h, &d->cols[i], r, d->epoch_dates);
+    Store_field(row, i, cell);
+  }
+  CAMLreturn(row);
+}
+
+/* refill the define buffers with up to n rows, n no more than the defines hold */
+static void decoder_fill(oci_handles_t h, OCIStmt* sth, oci_decoder_t* d, int n) {
+  d->next = 0;
+  d->buffered = 0;
+  if (!d->done) {
+    d->buffered = oci_fetch_array(h, sth, n);
+    d->done = (d->buffered < n);
+  }
+}
+
+/* one attempt in non-blocking mode at refilling the define buffers, if they 
+   are empty - returns -1 if the fetch is still executing, otherwise the rows 
+   now buffered, 0 at the end of the cursor. The rows are then handed out by 
+   caml_oci_fetch_row without another round-trip */
+value caml_oci_decoder_fill_nb(value handles, value stmt, value decoder) {
+  CAMLparam3(handles, stmt, decoder);
+  oci_handles_t h = Oci_handles_val(handles);
+  OCIStmt* sth = Oci_statement_val(stmt);
+  oci_decoder_t* d = Oci_decoder_val(decoder);
+  ub4 fetched = 0;
+  sword x;
+
+  if (d->next < d->buffered || d->done) {
+    CAMLreturn(Val_int(d->buffered - d->next));
+  }
+
+  x = OCIStmtFetch2(sth, h.err, d->rows, OCI_FETCH_NEXT, 0, OCI_DEFAULT);
+  if (x == OCI_STILL_EXECUTING) {
+    CAMLreturn(Val_int(-1));
+  }
+  if (x != OCI_NO_DATA) {
+    CHECK_OCI(x, h);
+  }
+  x = OCIAttrGet(sth, OCI_HTYPE_STMT, &fetched, 0, OCI_ATTR_ROWS_FETCHED, h.err);
+  CHECK_OCI(x, h);
+
+  d->next = 0;
+  d->buffered = (int)fetched;
+  d->done = (d->buffered < d->rows);
+  CAMLreturn(Val_int(d->buffered));
+}
+
+/* hand out the next row, fetching another full batch when the buffers run dry
+   - one call per row whatever the number of columns. Raises Not_found at the 
+   end of the cursor */
+value caml_oci_fetch_row(value handles, value stmt, value decoder) {
+  CAMLparam3(handles, stmt, decoder);
+  oci_handles_t h = Oci_handles_val(handles);
+  oci_decoder_t* d = Oci_decoder_val(decoder);
+
+  if (d->next >= d->buffered) {
+    decoder_fill(h, Oci_statement_val(stmt), d, d->rows);
+  }
+  if (d->buffered == 0) {
+    caml_raise_not_found();
+  }
+
+  CAMLreturn(decode_row(h, d, d->next++));
+}
+
+/* up to n rows as a col_value array array - rows still in the buffers come 
+   first, then one fetch for the rest, which the defines must be able to hold */
+value caml_oci_fetch_decoded(value handles, value stmt, value decoder, value rows) {
+  CAMLparam4(handles, stmt, decoder, rows);
+  CAMLlocal3(result, row, shrunk);
+  oci_handles_t h = Oci_handles_val(handles);
+  oci_decoder_t* d = Oci_decoder_val(decoder);
+  int n = Int_val(rows);
+  int pending = d->buffered - d->next;
+  int from_buffer = pending < n ? pending : n;
+  int got = 0;
+  int i;
+
+  if (from_buffer < n && d->rows < n - from_buffer) {
+    caml_invalid_argument("caml_oci_fetch_decoded: defines too small for batch");
+  }
+
+  /* decode the leftovers before the fetch overwrites them */
+  result = caml_alloc(n, 0);
+  for (i = 0; i < from_buffer; i++) {
+    row = decode_row(h, d, d->next++);
+    Store_field(result, got++, row);
+  }
+  if (got < n) {
+    decoder_fill(h, Oci_statement_val(stmt), d, n - got);
+    while (d->next < d->buffered) {
+      row = decode_row(h, d, d->next++);
+      Store_field(result, got++, row);
+    }
+  }
+
+  /* short batch, return only what was filled */
+  if (got < n) {
+    if (got == 0) {
+      CAMLreturn(Atom(0));
+    }
+    shrunk = caml_alloc(got, 0);
+    for (i = 0; i < got; i++) {
+      Store_field(shrunk, i, Field(result, i));
+    }
+    result = shrunk;
+  }
+  CAMLreturn(result);
+}
+
+/* rows still waiting in the buffers, and whether the cursor is exhausted */
+value caml_oci_decoder_state(value decoder) {
+  CAMLparam1(decoder);
+  CAMLlocal1(r);
+  oci_decoder_t* d = Oci_decoder_val(decoder);
+
+  r = caml_alloc_tuple(2);
+  Store_field(r, 0, Val_int(d->buffered - d->next));
+  Store_field(r, 1, Val_bool(d->done));
+  CAMLreturn(r);
+}
+
+/* forget buffered rows, for a re-executed cursor */
+value caml_oci_decoder_reset(value decoder) {
+  CAMLparam1(decoder);
+  oci_decoder_t* d = Oci_decoder_val(decoder);
+
+  d->buffered = 0;
+  d->next = 0;
+  d->done = 0;
+  CAMLreturn(Val_unit);
+}
+
+/* whether DATEs are decoded to Number epoch instead of Datetime */
+value caml_oci_decoder_epoch_dates(value decoder, value epoch) {
+  CAMLparam2(decoder, epoch);
+  Oci_decoder_val(decoder)->epoch_dates = Bool_val(epoch);
+  CAMLreturn(Val_unit);
+}
+
+/* free the staging memory of a columnar define - the Bigarray belongs to OCaml */
+void caml_oci_free_coldef(value cd) {
+  CAMLparam1(cd);
+  oci_coldef_t x = Oci_coldef_val(cd);
+  free(x.inds);
+  free(x.dates);
+  CAMLreturn0;
+}
+
+static struct custom_operations oci_coldef_custom_ops = {"oci_coldef_custom_ops", &caml_oci_free_coldef, NULL, NULL, NULL, NULL};
+
+/* define a column directly into the memory of a Bigarray, so that a whole batch
+   of NUMBERs lands in OCaml-visible memory with no conversion per cell - the 
+   Bigarray must be kept alive for as long as the define is in use */
+value caml_oci_define_columnar(value handles, value stmt, value pos, value column) {
+  CAMLparam4(handles, stmt, pos, column);
+  oci_handles_t h = Oci_handles_val(handles);
+  OCIStmt* sth = Oci_statement_val(stmt);
+  int p = Int_val(pos);
+  value ba = Field(column, 0);
+  sword x = -1;
+
+  oci_coldef_t cd = { NULL, Tag_val(column), 0, NULL, NULL };
+  cd.rows = Caml_ba_array_val(ba)->dim[0];
+  cd.inds = (sb2*)calloc(cd.rows, sizeof(sb2));
+
+#ifdef DEBUG
+  char dbuf[256]; snprintf(dbuf, 255, "caml_oci_define_columnar: defining pos=%d kind=%d rows=%d", p + 1, cd.kind, cd.rows); debug(dbuf);
+#endif
+
+  switch (cd.kind) {
+  case COLUMNAR_INT:
+    x = OCIDefineByPos(sth, &cd.defh, h.err, p + 1, Caml_ba_data_val(ba), sizeof(sb8), SQLT_INT, cd.inds, 0, 0, OCI_DEFAULT);
+    break;
+  case COLUMNAR_FLOAT:
+    x = OCIDefineByPos(sth, &cd.defh, h.err, p + 1, Caml_ba_data_val(ba), sizeof(double), SQLT_BDOUBLE, cd.inds, 0, 0, OCI_DEFAULT);
+    break;
+  case COLUMNAR_DATE:
+    cd.dates = (OCIDate*)calloc(cd.rows, sizeof(OCIDate));
+    x = OCIDefineByPos(sth, &cd.defh, h.err, p + 1, cd.dates, sizeof(OCIDate), SQLT_ODT, cd.inds, 0, 0, OCI_DEFAULT);
+    break;
+  default:
+    debug("caml_oci_define_columnar: unknown column kind");
+  }
   CHECK_OCI(x, h);
 
+  value v = caml_alloc_custom(&oci_coldef_custom_ops, sizeof(oci_coldef_t), 0, 1);
+  Oci_coldef_val(v) = cd;
+  CAMLreturn(v);
+}
+
+/* after a fetch of n rows, fill in the null map from the indicators and convert
+   staged dates to epoch - NULLs read as nan (or 0 for integers) in the data */
+value caml_oci_columnar_finish(value coldef, value column, value nulls, value rows) {
+  CAMLparam4(coldef, column, nulls, rows);
+  oci_coldef_t cd = Oci_coldef_val(coldef);
+  value ba = Field(column, 0);
+  unsigned char* nm = (unsigned char*)Caml_ba_data_val(nulls);
+  int n = Int_val(rows);
+  int i;
+
+  for (i = 0; i < n; i++) {
+    nm[i] = (cd.inds[i] == -1);
+    switch (cd.kind) {
+    case COLUMNAR_INT:
+      if (nm[i]) {
+	((sb8*)Caml_ba_data_val(ba))[i] = 0;
+      }
+      break;
+    case COLUMNAR_FLOAT:
+      if (nm[i]) {
+	((double*)Caml_ba_data_val(ba))[i] = NAN;
+      }
+      break;
+    case COLUMNAR_DATE:
+      ((double*)Caml_ba_data_val(ba))[i] = nm[i] ? NAN : ocidate_to_epoch(&cd.dates[i]);
+      break;
+    }
+  }
+
   CAMLreturn(Val_unit);
 }
 
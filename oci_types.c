@@ -9,26 +9,265 @@
 #include <string.h>
 #include <stdio.h>
 #include <time.h>
+#include <math.h>
+#include <pthread.h>
 #include <oci.h>
 #include "oci_wrapper.h"
 
-/* convert an epoch time to an Oracle date */
-void epoch_to_ocidate(double e, OCIDate* ocidate) {
+/* Local time without a libc call per date - the UTC offset is looked up in a 
+   table of the transitions found in a span of 366 days, built with localtime_r
+   the first time a date in that span is seen. Offsets are sampled every six 
+   hours and each change is narrowed down to the second, so conversions come 
+   out the same as localtime_r's for any zone that does not change twice in 
+   six hours. A span with more than TZ_MAX_TRANSITIONS changes is marked full 
+   and converted with libc instead. TZ is read once, on first use */
+
+#define TZ_SPAN  31622400 /* seconds in a span */
+#define TZ_STEP  21600    /* seconds between samples */
+#define TZ_SPANS 256      /* spans cached at once, about 250 years */
+#define TZ_MAX_TRANSITIONS 8
+
+typedef struct {
+  int valid;
+  int full;                /* more transitions than fit, so ask libc */
+  long long span;          /* which span, epoch / TZ_SPAN rounded down */
+  long off0;               /* UTC offset at the start of the span */
+  int dst0;                /* and whether it is daylight saving time */
+  int ntrans;
+  long long at[TZ_MAX_TRANSITIONS];  /* epoch each new offset starts at */
+  long off[TZ_MAX_TRANSITIONS];
+  int dst[TZ_MAX_TRANSITIONS];
+} tz_span_t;
+
+static tz_span_t tz_cache[TZ_SPANS];
+static pthread_mutex_t tz_lock = PTHREAD_MUTEX_INITIALIZER;
+static int tz_ready = 0;
+
+static long long floor_div(long long a, long long b) {
+  return a / b - ((a % b != 0) && ((a < 0) != (b < 0)));
+}
+
+/* UTC offset at an epoch, with 1 added to mark daylight saving time so that 
+   a change of either shows up as a change in the value */
+static long libc_offset(long long e) {
   time_t t = (time_t)e;
   struct tm ut;
-  localtime_r(&t, &ut); /* convert to a Unix time */
-  mktime(&ut);
+  localtime_r(&t, &ut);
+  return ut.tm_gmtoff * 2 + (ut.tm_isdst > 0);
+}
+
+/* the cached span for an epoch, filling it if need be - tz_lock must be held */
+static tz_span_t* tz_span(long long e) {
+  long long k = floor_div(e, TZ_SPAN);
+  tz_span_t* z = &tz_cache[(int)(((k % TZ_SPANS) + TZ_SPANS) % TZ_SPANS)];
+  long long s, a, b, lo, hi, mid;
+  long oa, ob;
+
+  if (z->valid && z->span == k) {
+    return z;
+  }
+  if (!tz_ready) {
+    tzset();
+    tz_ready = 1;
+  }
+
+  z->span = k;
+  z->ntrans = 0;
+  z->full = 0;
+  s = k * TZ_SPAN;
+  oa = libc_offset(s);
+  z->off0 = oa >> 1;
+  z->dst0 = oa & 1;
+  for (a = s; a < s + TZ_SPAN; a = b, oa = ob) {
+    b = a + TZ_STEP;
+    ob = libc_offset(b);
+    if (ob != oa && z->ntrans == TZ_MAX_TRANSITIONS) {
+      z->full = 1;
+      break;
+    }
+    if (ob != oa) { /* changes somewhere in (a, b] */
+      for (lo = a, hi = b; hi - lo > 1; ) {
+	mid = lo + (hi - lo) / 2;
+	if (libc_offset(mid) == oa) { lo = mid; } else { hi = mid; }
+      }
+      z->at[z->ntrans] = hi;
+      z->off[z->ntrans] = ob >> 1;
+      z->dst[z->ntrans] = ob & 1;
+      z->ntrans++;
+    }
+  }
+  z->valid = 1;
 
 #ifdef DEBUG
-  char dbuf[256]; snprintf(dbuf, 255, "epoch_to_ocidate: epoch=%f year=%d month=%d day=%d", e, ut.tm_year + 1900, ut.tm_mon + 1, ut.tm_mday); debug(dbuf);
+  char dbuf[256]; snprintf(dbuf, 255, "tz_span: cached span %lld with %d transitions", k, z->ntrans); debug(dbuf);
 #endif
+  return z;
+}
 
-  OCIDateSetDate(ocidate, ut.tm_year + 1900, ut.tm_mon + 1, ut.tm_mday); 
-  OCIDateSetTime(ocidate, ut.tm_hour, ut.tm_min, ut.tm_sec);
+static long tz_offset(tz_span_t* z, long long e) {
+  long off = z->off0;
+  int i;
+  if (z->full) {
+    return libc_offset(e) >> 1;
+  }
+  for (i = 0; i < z->ntrans && e >= z->at[i]; i++) {
+    off = z->off[i];
+  }
+  return off;
 }
 
-/* convert an Oracle date to epoch */
-double ocidate_to_epoch(OCIDate* ocidate) {
+static int tz_dst(tz_span_t* z, long long e) {
+  int dst = z->dst0;
+  int i;
+  for (i = 0; i < z->ntrans && e >= z->at[i]; i++) {
+    dst = z->dst[i];
+  }
+  return dst;
+}
+
+/* the epoch for a local time in seconds, if there is exactly one - returns 0
+   for a time skipped or repeated by a transition, which is left to mktime. 
+   Any epoch it could be is within a day either side, so it is enough to look 
+   at the transitions in that window - tz_lock must be held */
+static int local_secs_to_epoch(long long ls, long long* e, int* dst) {
+  long long a = ls - 86400, b = ls + 86400;
+  tz_span_t* za = tz_span(a);
+  tz_span_t* zb = NULL;
+  long long t1, t2;
+  int n = 0, i;
+  long long at = 0;
+  long offb = 0;
+  int dstb = 0;
+
+  if (za->full) {
+    return 0;
+  }
+  for (i = 0; i < za->ntrans; i++) {
+    if (za->at[i] > a && za->at[i] <= b) { n++; at = za->at[i]; offb = za->off[i]; dstb = za->dst[i]; }
+  }
+  if (floor_div(b, TZ_SPAN) != za->span) {
+    zb = tz_span(b);
+    za = tz_span(a); /* in case filling zb evicted it */
+    if (zb->full) {
+      return 0;
+    }
+    for (i = 0; i < zb->ntrans; i++) {
+      if (zb->at[i] > a && zb->at[i] <= b) { n++; at = zb->at[i]; offb = zb->off[i]; dstb = zb->dst[i]; }
+    }
+  }
+
+  t1 = ls - tz_offset(za, a);
+  if (n == 0) {
+    *e = t1;
+    *dst = tz_dst(za, a);
+    return 1;
+  }
+  t2 = ls - offb;
+  if (n == 1 && ((t1 < at) != (t2 >= at))) {
+    *e = (t1 < at) ? t1 : t2;
+    *dst = (t1 < at) ? tz_dst(za, a) : dstb;
+    return 1;
+  }
+  return 0;
+}
+
+/* days since the epoch for a date, the inverse of the split below */
+static long long days_from_civil(long long y, int m, int d) {
+  long long era, yoe, doy, doe;
+
+  y -= (m <= 2);
+  era = floor_div(y, 400);
+  yoe = y - (era * 400);
+  doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return (era * 146097) + doe - 719468;
+}
+
+/* split seconds since the epoch, already moved to local time, into a date 
+   and seconds into the day - days to civil date after Howard Hinnant's 
+   algorithm */
+static void local_secs_split(long long ls, long long* year, int* month, int* day, long long* secs) {
+  long long days = floor_div(ls, 86400);
+  long long era, doe, yoe, doy, mp, y;
+  int m, d;
+
+  *secs = ls - (days * 86400);
+  days += 719468; /* from 0000-03-01 */
+  era = floor_div(days, 146097);
+  doe = days - (era * 146097);
+  yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  mp = (5 * doy + 2) / 153;
+  d = doy - (153 * mp + 2) / 5 + 1;
+  m = mp < 10 ? mp + 3 : mp - 9;
+  y = yoe + (era * 400) + (m <= 2);
+  *year = y; *month = m; *day = d;
+}
+
+/* the same into the fields of an OCIDate */
+static void local_secs_to_ocidate(long long ls, OCIDate* ocidate) {
+  long long y, sod;
+  int m, d;
+
+  local_secs_split(ls, &y, &m, &d, &sod);
+  OCIDateSetDate(ocidate, y, m, d);
+  OCIDateSetTime(ocidate, sod / 3600, (sod % 3600) / 60, sod % 60);
+}
+
+/* and into a struct tm, as localtime_r would fill it */
+static void local_secs_to_tm(long long ls, int dst, struct tm* ut) {
+  long long y, sod, days = floor_div(ls, 86400);
+  int m, d;
+
+  local_secs_split(ls, &y, &m, &d, &sod);
+  ut->tm_sec = sod % 60; ut->tm_min = (sod % 3600) / 60; ut->tm_hour = sod / 3600;
+  ut->tm_mday = d; ut->tm_mon = m - 1; ut->tm_year = y - 1900;
+  ut->tm_wday = (int)(((days + 4) % 7 + 7) % 7); /* 1970-01-01 was a Thursday */
+  ut->tm_yday = (int)(days - days_from_civil(y, 1, 1));
+  ut->tm_isdst = dst;
+}
+
+/* convert an epoch time to an Oracle date */
+void epoch_to_ocidate(double e, OCIDate* ocidate) {
+  long long t = (long long)(time_t)e;
+  long off;
+
+  pthread_mutex_lock(&tz_lock);
+  off = tz_offset(tz_span(t), t);
+  pthread_mutex_unlock(&tz_lock);
+  local_secs_to_ocidate(t + off, ocidate);
+
+#ifdef DEBUG
+  char dbuf[256]; snprintf(dbuf, 255, "epoch_to_ocidate: epoch=%f offset=%ld", e, off); debug(dbuf);
+#endif
+}
+
+/* convert n epochs to Oracle dates stride bytes apart, taking the lock once 
+   for the lot - a nan is a NULL, marked -1 in inds */
+void epochs_to_ocidates(double* e, int n, void* out, int stride, sb2* inds) {
+  tz_span_t* z = NULL;
+  long long t;
+  int i;
+
+  pthread_mutex_lock(&tz_lock);
+  for (i = 0; i < n; i++) {
+    if (isnan(e[i])) {
+      inds[i] = -1;
+      continue;
+    }
+    inds[i] = 0;
+    t = (long long)(time_t)e[i];
+    if (z == NULL || floor_div(t, TZ_SPAN) != z->span) {
+      z = tz_span(t);
+    }
+    local_secs_to_ocidate(t + tz_offset(z, t), (OCIDate*)((char*)out + (i * stride)));
+  }
+  pthread_mutex_unlock(&tz_lock);
+}
+
+/* the old way, for the times local_secs_to_epoch cannot settle - mktime 
+   twice, the first to work out whether DST is in force */
+static double libc_ocidate_to_epoch(OCIDate* ocidate) {
   int year, month, day, hour, minute, second;
   struct tm ut;
 
@@ -39,62 +278,106 @@ double ocidate_to_epoch(OCIDate* ocidate) {
   ut.tm_hour = hour;    ut.tm_min = minute;    ut.tm_sec = second;  ut.tm_isdst = -1;
 
   mktime(&ut); // should fix tm_isdst
-  double d = (double)mktime(&ut);
-
-#ifdef DEBUG
-  char dbuf[256]; snprintf(dbuf, 255, "ocidate_to_epoch: epoch=%f year=%d month=%d day=%d is_dst=%d", d, ut.tm_year + 1900, ut.tm_mon + 1, ut.tm_mday, ut.tm_isdst); debug(dbuf);
-#endif
-  return d;
+  return (double)mktime(&ut);
 }
 
-/* dereference a pointer to a string */
-value caml_oci_get_defined_string(value defs) {
-  CAMLparam1(defs);
-  oci_define_t d = Oci_defhandle_val(defs);
-  
-#ifdef DEBUG
-  char dbuf[256]; snprintf(dbuf, 255, "caml_oci_get_defined_string: string=%s indicator=%d", (char*)d.ptr, d.ind); debug(dbuf);
-#endif
+/* the fields of an OCIDate as seconds since the epoch, as if in UTC */
+static long long ocidate_to_local_secs(OCIDate* ocidate) {
+  int year, month, day, hour, minute, second;
 
-  CAMLreturn(caml_copy_string(d.ptr));
+  OCIDateGetDate(ocidate, &year, &month, &day);
+  OCIDateGetTime(ocidate, &hour, &minute, &second);
+  return (days_from_civil(year, month, day) * 86400) + (hour * 3600) + (minute * 60) + second;
 }
 
-/* dereference and return a datetime as epoch */
-value caml_oci_get_date_as_double(value defs) {
-  CAMLparam1(defs);
-  oci_define_t d = Oci_defhandle_val(defs);
+/* convert an Oracle date to epoch */
+double ocidate_to_epoch(OCIDate* ocidate) {
+  long long e;
+  int dst, ok;
+  double d;
 
-  CAMLreturn(caml_copy_double(ocidate_to_epoch(d.ptr)));
+  pthread_mutex_lock(&tz_lock);
+  ok = local_secs_to_epoch(ocidate_to_local_secs(ocidate), &e, &dst);
+  pthread_mutex_unlock(&tz_lock);
+  d = ok ? (double)e : libc_ocidate_to_epoch(ocidate);
+
+#ifdef DEBUG
+  char dbuf[256]; snprintf(dbuf, 255, "ocidate_to_epoch: epoch=%f cached=%d", d, ok); debug(dbuf);
+#endif
+  return d;
 }
 
-value caml_oci_get_double(value handles, value defs) {
-  CAMLparam2(handles, defs);
-  oci_define_t d = Oci_defhandle_val(defs);
-  oci_handles_t h = Oci_handles_val(handles);
+/* a Unix.tm for an Oracle date, as localtime would give for its epoch - built 
+   from the date's own fields unless it falls in a transition */
+value ocidate_to_unix_tm(OCIDate* ocidate) {
+  CAMLparam0();
+  CAMLlocal1(tm);
+  long long ls = ocidate_to_local_secs(ocidate);
+  long long e;
+  int dst, ok;
+  struct tm ut;
 
-  double r;
+  pthread_mutex_lock(&tz_lock);
+  ok = local_secs_to_epoch(ls, &e, &dst);
+  pthread_mutex_unlock(&tz_lock);
 
-  sword x = OCINumberToReal(h.err, d.ptr, sizeof(double), &r);
-  CHECK_OCI(x, h);
+  if (ok) {
+    local_secs_to_tm(ls, dst, &ut);
+  } else {
+    time_t t = (time_t)libc_ocidate_to_epoch(ocidate);
+    localtime_r(&t, &ut);
+  }
 
-  CAMLreturn(caml_copy_double(r));
+  tm = caml_alloc_tuple(9);
+  Store_field(tm, 0, Val_int(ut.tm_sec));
+  Store_field(tm, 1, Val_int(ut.tm_min));
+  Store_field(tm, 2, Val_int(ut.tm_hour));
+  Store_field(tm, 3, Val_int(ut.tm_mday));
+  Store_field(tm, 4, Val_int(ut.tm_mon));
+  Store_field(tm, 5, Val_int(ut.tm_year));
+  Store_field(tm, 6, Val_int(ut.tm_wday));
+  Store_field(tm, 7, Val_int(ut.tm_yday));
+  Store_field(tm, 8, Val_bool(ut.tm_isdst > 0));
+  CAMLreturn(tm);
 }
 
-value caml_oci_get_int(value handles, value defs) {
-  CAMLparam2(handles, defs);
-  oci_define_t d = Oci_defhandle_val(defs);
-  oci_handles_t h = Oci_handles_val(handles);
+/* mktime from the cache - the epoch for a local time, with out of range 
+   fields normalised into ut as mktime does. Only a time skipped or repeated 
+   by a transition goes to mktime itself */
+double tm_to_epoch(struct tm* ut) {
+  long long mon = ut->tm_mon;
+  long long y = ut->tm_year + 1900LL + floor_div(mon, 12);
+  long long ls, e;
+  int dst, ok;
 
-  int r;
+  mon -= floor_div(mon, 12) * 12;
+  ls = ((days_from_civil(y, (int)mon + 1, 1) + ut->tm_mday - 1) * 86400)
+    + (ut->tm_hour * 3600LL) + (ut->tm_min * 60LL) + ut->tm_sec;
 
-  sword x = OCINumberToInt(h.err, d.ptr, sizeof(int), OCI_NUMBER_SIGNED, &r);
-  CHECK_OCI(x, h);
+  pthread_mutex_lock(&tz_lock);
+  ok = local_secs_to_epoch(ls, &e, &dst);
+  pthread_mutex_unlock(&tz_lock);
 
-#ifdef DEBUG
-  char dbuf[256]; snprintf(dbuf, 255, "caml_oci_get_int: returning %d", r); debug(dbuf);
-#endif
+  if (!ok) {
+    ut->tm_isdst = -1;
+    return (double)mktime(ut);
+  }
+  local_secs_to_tm(ls, dst, ut);
+  return (double)e;
+}
+
+/* Unix.mktime, for binding a Datetime - the epoch only */
+value caml_oci_tm_to_epoch(value tm) {
+  CAMLparam1(tm);
+  struct tm ut;
 
-  CAMLreturn(Val_int(r));
+  ut.tm_sec  = Int_val(Field(tm, 0));
+  ut.tm_min  = Int_val(Field(tm, 1));
+  ut.tm_hour = Int_val(Field(tm, 2));
+  ut.tm_mday = Int_val(Field(tm, 3));
+  ut.tm_mon  = Int_val(Field(tm, 4));
+  ut.tm_year = Int_val(Field(tm, 5));
+  CAMLreturn(caml_copy_double(tm_to_epoch(&ut)));
 }
 
 /* end of file */
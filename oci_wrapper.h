@@ -1,5 +1,7 @@
 /* include file for OCI wrapper */
 
+#include <time.h>
+
 #define OCIML_VERSION "ociml-0.3"
 
 #define CHECK_OCI(x, h) if (x != OCI_SUCCESS) { oci_non_success(h); }
@@ -13,6 +15,7 @@
 
 /* max length of a VARCHAR */
 #define MAXVARCHAR 4000
+#define MAXBINDLEN 65535 /* bound string lengths are ub2 */
 
 /* Allocate the handles for error, server, service context and session in a struct for convenience */
 typedef struct {
@@ -23,15 +26,88 @@ typedef struct {
   OCIAuthInfo* auth;
 } oci_handles_t;
 
-/* struct for defining for rows fetched */
+/* struct for defining for rows fetched - the buffers hold rows entries of 
+   width bytes each so that a whole batch can be fetched in one call */
 typedef struct {
   OCIDefine* defh; 
   void* ptr; /* the data itself */
   int dtype;
+  int sqlt;    /* external type it is defined as, SQLT_VNU or native for NUMBERs */
   double dbl;
   int ind;
+  sb2* inds;   /* indicator for each row */
+  ub2* lens;   /* returned length for each row */
+  int width;   /* bytes per row in ptr */
+  int rows;    /* number of rows the buffers can hold */
 } oci_define_t;
 
+/* a bind that stays in place across executes - the value is overwritten and 
+   OCIBindByPos/Name only called again when the type changes or a value will 
+   not fit in the buffer */
+typedef struct {
+  OCIBind* bh;
+  void* ptr;
+  sb2* inds;   /* indicator for each row */
+  ub2* lens;   /* actual length of each row, for strings */
+  int dtype;   /* SQLT_ type bound as, 0 before the first bind */
+  int width;   /* bytes per row in ptr */
+  int rows;    /* rows the buffers can hold */
+  int bound;   /* the current buffers are bound in the statement */
+} oci_bind_slot_t;
+
+/* constructor tags of col_value, for building rows in C */
+#define COL_NULL     0 /* constant constructors */
+#define COL_VARCHAR  1 /* non-constant constructors */
+#define COL_DATETIME 2
+#define COL_INTEGER  3
+#define COL_NUMBER   4
+#define COL_LOB      7
+
+/* a LOB locator handed to OCaml, with the connection it was fetched or 
+   created on and the position the next read or write starts from - in 
+   characters for a CLOB, bytes for a BLOB, counting from 0 */
+typedef struct {
+  OCILobLocator* loc;
+  oci_handles_t h;
+  int sqlt;    /* SQLT_CLOB or SQLT_BLOB */
+  ub8 offset;
+  ub4 chunk;   /* OCILobGetChunkSize, 0 until asked for */
+} oci_lob_t;
+
+/* one column of a compiled row decoder, with a copy of the define it reads */
+typedef struct {
+  int dtype;
+  int is_int;
+  int is_null;
+  oci_define_t def;
+} oci_coldesc_t;
+
+/* row decoder for a SELECT, built once per set of defines, and the state of 
+   the define buffers that rows are handed out of */
+typedef struct {
+  int ncols;
+  oci_coldesc_t* cols;
+  int rows;     /* rows the defines can hold */
+  int buffered; /* rows in the defines from the last fetch */
+  int next;     /* next of those to hand out */
+  int done;     /* last fetch came back short, cursor is exhausted */
+  int epoch_dates; /* DATEs come back as Number epoch rather than Datetime */
+} oci_decoder_t;
+
+/* struct for a column defined straight into a Bigarray for columnar fetch - 
+   dates cannot be fetched as epoch so are staged as OCIDates and converted */
+typedef struct {
+  OCIDefine* defh;
+  int kind;       /* constructor of column_data: 0 Int_col, 1 Float_col, 2 Date_col */
+  int rows;       /* number of rows the Bigarray can hold */
+  sb2* inds;      /* indicator for each row */
+  OCIDate* dates; /* staging for Date_col only */
+} oci_coldef_t;
+
+#define COLUMNAR_INT   0
+#define COLUMNAR_FLOAT 1
+#define COLUMNAR_DATE  2
+
 typedef struct {
   void* ptr;
   int managed_by_oci; /* because we want to have a pointer to the TDO object, which will be freed by OCI */
@@ -62,6 +138,14 @@ typedef struct {
 } out_string_t;
 
 
+/* struct for the callback data for a ref cursor */
+typedef struct {
+  OCIStmt* stmt;   /* allocated by OCaml, so not freed with this */
+  ub4 alen;
+  sb2 ind;
+  ub2 rc;
+} out_ref_cursor_t;
+
 /* struct for context for dynamic bind callback */
 typedef struct {
   c_alloc_t cht;
@@ -74,6 +158,10 @@ typedef struct {
 #define Oci_bindhandle_val(v) (*((OCIBind**)      Data_custom_val(v)))
 #define Oci_date_val(v)       (*((OCIDate**)      Data_custom_val(v)))
 #define Oci_defhandle_val(v)  (*((oci_define_t*)  Data_custom_val(v)))
+#define Oci_coldef_val(v)     (*((oci_coldef_t*)  Data_custom_val(v)))
+#define Oci_decoder_val(v)    (*((oci_decoder_t**) Data_custom_val(v)))
+#define Oci_bind_slot_val(v)  (*((oci_bind_slot_t**) Data_custom_val(v)))
+#define Oci_lob_val(v)        (*((oci_lob_t**)    Data_custom_val(v)))
 #define C_alloc_val(v)        (*((c_alloc_t*)     Data_custom_val(v)))
 #define C_context_val(v)      (*((cb_context_t*)  Data_custom_val(v)))
 
@@ -85,9 +173,24 @@ void run_sql_simple(OCIEnv* e, oci_handles_t h, char* sql);
 
 /* type conversion functions */
 void epoch_to_ocidate(double d, OCIDate* ocidate);
+void epochs_to_ocidates(double* e, int n, void* out, int stride, sb2* inds);
+value ocidate_to_unix_tm(OCIDate* ocidate);
 double ocidate_to_epoch(OCIDate* ocidate);
+double tm_to_epoch(struct tm* ut);
+
+/* binding */
+int oci_bind_slot_reserve(oci_bind_slot_t* b, int sqlt, int width, int rows);
+void oci_bind_slot_bind(oci_handles_t h, OCIStmt* s, value bs, oci_bind_slot_t* b);
+int oci_pack_column(oci_bind_slot_t* b, value column);
+int oci_bulk_column_rows(value column);
 
 /* memory */
 void caml_free_alloc_t(value ch);
 
+/* LOBs */
+value oci_lob_wrap(oci_handles_t h, int sqlt, OCILobLocator* loc);
+
+/* the one OCI environment, from oci_connect.c */
+extern OCIEnv* global_env;
+
 /* end of file */
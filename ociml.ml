@@ -14,6 +14,20 @@ type oci_handles    (* C struct that bundles error, server, service context and
 type oci_statement  (* statement handle *)
 type oci_bindhandle (* for binding in prepared statements *)
 type oci_ptr        (* void* pointer so we can heap alloc for binding/defining *)
+type oci_bind_slot  (* bind buffer that stays bound across executes *)
+type oci_decoder    (* compiled column descriptors for a select list, and its fetch buffer state *)
+type oci_bulk_job   (* bulk execute running on a thread of its own *)
+type oci_spool      (* OCI session pool and its error handle *)
+type oci_lob        (* LOB locator, the connection it belongs to and a position in it *)
+type oci_dcn        (* change notification subscription and the queue of changes sent to it *)
+
+(* an AQ message type as used by a login - its TDO and, for object types,
+   where each attribute goes in a payload, worked out once from the TDO *)
+type aq_type = {aq_tdo:oci_ptr;
+		aq_kinds:int array;      (* 0 for a string, 1 for a number *)
+		aq_offsets:int array;
+		aq_null_offset:int;      (* null indicator struct, after the attributes *)
+		aq_size:int}             (* payload and null struct together *)
 
 (* data structure for use within the library bundling all the handles associated 
    with a connection with a unique identifier and some useful statistics *)
@@ -23,8 +37,58 @@ type meta_handle = {connection_id:int;
 		    mutable lda_op_time:float;
 		    mutable auto_commit:bool;
 		    mutable deq_timeout:int;
+		    mutable stmt_cache_size:int;   (* statements kept prepared by OCI for this session *)
+		    mutable stmt_cache_hits:int;
+		    mutable stmt_cache_misses:int;
+		    pooled:bool;                   (* taken from a session pool, so oralogoff gives it back *)
+		    login:string;                  (* user@database *)
+		    mutable async_pending:bool;    (* a non-blocking call is in progress *)
 		    lda:oci_handles}
 
+(* a session pool, with the statistics kept for it on this side *)
+type meta_pool = {pool_id:int;
+		  pool_login:string;              (* user@database *)
+		  spool:oci_spool;
+		  warmup_sql:string list;         (* parsed into the statement cache of every new session *)
+		  mutable pool_open:bool;
+		  mutable pool_acquires:int;
+		  mutable pool_new_sessions:int;
+		  mutable pool_failed_pings:int;
+		  mutable pool_wait_time:float;   (* total time spent waiting in orapool_acquire *)
+		  mutable pool_max_wait:float;
+		  pool_lock:Mutex.t}              (* for the statistics, when domains share a pool *)
+
+(* result of orapool_stats - idle sessions are open but not handed out *)
+type pool_stats = {ps_open:int;
+		   ps_busy:int;
+		   ps_idle:int;
+		   ps_acquires:int;
+		   ps_new_sessions:int;
+		   ps_failed_pings:int;
+		   ps_wait_time:float;
+		   ps_max_wait:float}
+
+(* operations in a change notification - Dcn_all_rows means the rows are not 
+   listed, e.g. because too many changed *)
+type dcn_op = Dcn_insert|Dcn_update|Dcn_delete|Dcn_alter|Dcn_drop|Dcn_all_rows
+
+(* what a change notification is about - Dcn_deregistered is the last one a 
+   subscription gets *)
+type dcn_kind = Dcn_object|Dcn_query|Dcn_startup|Dcn_shutdown|Dcn_deregistered|Dcn_other of int
+
+(* one change, one per row if the subscription asked for ROWIDs *)
+type dcn_event = {dcn_kind:dcn_kind;
+		  dcn_table:string;        (* SCHEMA.TABLE, empty for startup and shutdown *)
+		  dcn_ops:dcn_op list;
+		  dcn_rowid:string;        (* empty when only the table is known *)
+		  dcn_query_id:int}        (* for query-level notifications, 0 otherwise *)
+
+(* a change notification subscription on a connection *)
+type meta_dcn = {dcn_id:int;
+		 dcn_lda:meta_handle;
+		 dcn_sub:oci_dcn;
+		 mutable dcn_open:bool}
+
 (* variant enabling binding by position or by name *)
 type bind_spec = Pos of int|Name of string
 
@@ -34,6 +98,23 @@ type nullable = Nullable|Not_nullable
 type define_spec = {dtype:int; is_int:bool ; is_null:bool; ptr:oci_ptr}
 
 
+(* Bigarrays for columnar fetch, one element per row in a batch *)
+type int_column   = (int64, Bigarray.int64_elt, Bigarray.c_layout) Bigarray.Array1.t
+type float_column = (float, Bigarray.float64_elt, Bigarray.c_layout) Bigarray.Array1.t
+type null_column  = (int, Bigarray.int8_unsigned_elt, Bigarray.c_layout) Bigarray.Array1.t
+
+(* integer NUMBERs come back as Int_col, other NUMBERs and BINARY_DOUBLE/FLOAT 
+   as Float_col and DATEs as epoch seconds in Date_col *)
+type column_data = Int_col of int_column|Float_col of float_column|Date_col of float_column
+
+(* result of orafetch_columnar - only the first batch_rows of each array are 
+   valid, and the arrays are overwritten by the next call on the same cursor. 
+   A 1 in nulls.(i) marks a NULL in columns.(i), which reads as nan (or 0L) *)
+type column_batch = {batch_rows:int; columns:column_data array; nulls:null_column array}
+
+(* the Bigarrays a cursor is defined into, and how many rows they hold *)
+type columnar_state = {col_batch:column_batch; col_defines:oci_ptr array; col_capacity:int; mutable col_done:bool}
+
 (* Variant for the basic data types - datetime crosses back and forth as epoch, 
    and Oracle's NUMBER datatype of course can be either integer or floating 
    point but it doesn't make sense to make the OCaml layer deal only in floats *)
@@ -46,6 +127,7 @@ type col_value = Col_type of string * int * int * bool * bool
 		 |RefCursor
 		 |Statement of meta_statement
 		 |Binary of string
+		 |Lob of oci_lob
 and
 (* same with statements, counters for parses, binds and execs, and the parent 
    connection (as it is allocated from the global OCI environment) *)
@@ -58,23 +140,120 @@ and
 		    mutable rows_affected:int;
 		    mutable num_cols:int;
 		    mutable sql_type:int;
+		    mutable sql_text:string;
+		    mutable cached_handle:bool;  (* handle came from the statement cache and goes back to it *)
+		    mutable cache_hit:bool;      (* last parse found the SQL in the statement cache *)
 		    mutable out_pending:bool;
 		    mutable out_counter:int;
+		    mutable fetch_rows:int;      (* rows per round-trip when fetching *)
+		    mutable native_numbers:bool; (* define NUMBERs as 64-bit ints/doubles instead of OCINumber *)
+		    mutable epoch_dates:bool;    (* fetch DATEs as Number epoch instead of Datetime *)
+		    mutable define_rows:int;     (* rows the current defines can hold *)
+		    mutable defines:define_spec array;
+		    mutable decoder:oci_decoder option; (* built from the defines, holds rows from the last fetch *)
+		    mutable col_types:col_value array;
+		    mutable layout_gen:int;      (* layout_generation when the defines were checked, -1 if not *)
+		    mutable columnar:columnar_state option; (* defined into Bigarrays by orafetch_columnar *)
 		    out_types:(bind_spec, col_value) Hashtbl.t;
 		    bound_vals:(bind_spec, oci_bindhandle) Hashtbl.t;
-		    defined_vals:(bind_spec, define_spec) Hashtbl.t;
+		    bind_slots:(bind_spec, oci_bind_slot) Hashtbl.t;
+		    bound_values:(bind_spec, col_value) Hashtbl.t; (* last value bound to each, which also keeps LOBs alive *)
+		    mutable result_cache:bool;   (* answer SELECTs from the client-side result cache *)
+		    mutable result_ttl:float;    (* seconds a cached result is kept, 0 for no limit *)
+		    mutable result_dcn:bool;     (* drop cached results on change notification *)
+		    mutable result_hits:int;
+		    mutable result_misses:int;
+		    mutable result_fetch:result_fetch; (* where the rows of the last execute come from *)
+		    bind_names:(string, int * bind_spec) Hashtbl.t; (* NAME and :NAME to position and Name ":NAME" *)
 		    oci_ptrs:(bind_spec, oci_ptr) Hashtbl.t;
 		    ref_cursors:(bind_spec, oci_statement) Hashtbl.t;
 		    parent_lda:meta_handle; 
 		    sth:oci_statement}
-
-let date_to_double t = fst (mktime t)
+and
+(* key of a cached result - login, SQL text and the bind values in order *)
+  result_key = string * string * (bind_spec * col_value) list
+and
+(* rows of a hit are handed out from the cache, those of a miss are kept as 
+   they are fetched, to be cached once the cursor is exhausted *)
+  result_fetch = Rc_none
+		 |Rc_hit of {rows:col_value array array; mutable next:int}
+		 |Rc_miss of {key:result_key; 
+			      mutable rows:col_value array array list; (* newest first *)
+			      mutable count:int;
+			      changes:int;  (* result_changes when it was executed *)
+			      dcn:int;      (* subscription it was registered with, 0 for none *)
+			      query:int}    (* query id on that subscription *)
+
+(* defines left on a statement handle when it went back to the statement cache, 
+   tagged with the OCI statement they belong to *)
+type cached_defines = {cd_stmt:nativeint; 
+		       cd_cols:col_value array; 
+		       cd_defines:define_spec array; 
+		       cd_decoder:oci_decoder option; 
+		       cd_rows:int;
+		       cd_gen:int}       (* layout_gen of the statement *)
+
+(* a result kept by the client-side result cache *)
+type result_entry = {re_rows:col_value array array;
+		     re_expires:float;  (* 0 for never *)
+		     re_dcn:int;        (* subscription that invalidates it, 0 for none *)
+		     re_query:int}      (* and its query id there *)
+
+(* result of oraresultcache_stats - expired and invalidated entries are not 
+   counted as evictions, which are only to keep the cache in its size *)
+type result_cache_stats = {rc_entries:int;
+			   rc_bytes:int;
+			   rc_hits:int;
+			   rc_misses:int;
+			   rc_evictions:int;
+			   rc_expired:int;
+			   rc_invalidations:int}
+
+(* one column of a bulk insert for orabindexec_columns - Values may mix NULLs 
+   with one datatype (or Integer and Number), the Bigarray forms are copied 
+   in directly and read nan as NULL, and Dates are epoch seconds *)
+type bulk_column = Values of col_value array
+		   |Ints of int_column
+		   |Floats of float_column
+		   |Dates of float_column
+
+(* result of orabulkload - pack_time includes pulling the rows off the Seq, 
+   and wait_time is only what was left of each execute once the next batch 
+   was packed, so the two overlap less the closer wait_time gets to 0 *)
+type bulkload_stats = {load_rows:int; 
+		       load_batches:int; 
+		       load_time:float; 
+		       pack_time:float; 
+		       wait_time:float; 
+		       rows_per_sec:float}
+
+(* a call started in non-blocking mode by oraexec_async, orafetch_async or 
+   oracommit_async. Each orapoll makes the OCI call again, which returns 
+   straight away whether or not the server has finished, so it can be driven 
+   from an event loop on a timer. async_complete runs once, after the 
+   connection is back in blocking mode, to give the result *)
+type 'a ora_async = {async_lda:meta_handle;
+		     async_name:string;
+		     async_step:unit -> bool;      (* true once the OCI call has completed *)
+		     async_complete:unit -> 'a;
+		     async_cancel:unit -> unit;    (* puts back what a cancelled call left half done *)
+		     mutable async_cancelled:bool;
+		     async_started:float;
+		     mutable async_polls:int;
+		     mutable async_result:'a option}
+
+(* Unix.mktime, worked out from the cached UTC offsets - oci_types.c *)
+external date_to_double: tm -> float = "caml_oci_tm_to_epoch"
 
 let decode_col_type x =
   match x with
     |2  (* oci_sqlt_num *)    -> "NUMBER"
     |12 (* oci_sqlt_dat *)    -> "DATE"
     |1  (* oci_sqlt_chr *)    -> "VARCHAR2"
+    |100 (* oci_sqlt_ibfloat *) -> "BINARY_FLOAT"
+    |101 (* oci_sqlt_ibdouble *) -> "BINARY_DOUBLE"
+    |112 (* oci_sqlt_clob *)  -> "CLOB"
+    |113 (* oci_sqlt_blob *)  -> "BLOB"
     |_  (* something else! *) -> string_of_int x
 	  	  
 (* setup functions, in order in which they should be called - oci_connect.c *)
@@ -84,13 +263,31 @@ external oci_server_attach: oci_handles -> string -> unit = "caml_oci_server_att
 external oci_sess_set_attr: oci_handles -> int -> string -> unit = "caml_oci_sess_set_attr" 
 external oci_session_begin: oci_handles -> unit = "caml_oci_session_begin" (* username and password set as attrs *)
 external oci_set_module: oci_env -> oci_handles -> string -> unit = "caml_oci_set_module"
+external oci_set_stmt_cache_size: oci_handles -> int -> unit = "caml_oci_set_stmt_cache_size"
 
 (* teardown functions - oci_connect.c *)
 external oci_session_end: oci_handles -> unit = "caml_oci_session_end"
 external oci_server_detach: oci_handles -> unit = "caml_oci_server_detach"
 external oci_free_handles: oci_handles -> unit = "caml_oci_free_handles"
+external oci_logon_many: oci_env -> (string * string * string) -> int -> (oci_handles * float) array = "caml_oci_logon_many" (* (db, user, pass), returns time taken by each *)
 external oci_terminate: oci_env -> unit = "caml_oci_terminate" (* final cleanup *)
 external oci_break: oci_handles -> unit = "caml_oci_break"
+external oci_ping: oci_handles -> unit = "caml_oci_ping"
+external oci_in_transaction: oci_handles -> bool = "caml_oci_in_transaction"
+
+(* session pools - oci_connect.c *)
+external oci_spool_create: oci_env -> (string * string * string) -> (int * int * int) -> int -> oci_spool = "caml_oci_spool_create" (* (db, user, pass) (min, max, incr) timeout *)
+external oci_spool_get: oci_env -> oci_spool -> string -> (oci_handles * bool) = "caml_oci_spool_get" (* true if the session had the tag *)
+external oci_spool_release: oci_handles -> string -> bool -> unit = "caml_oci_spool_release" (* true to drop the session *)
+external oci_spool_counts: oci_spool -> (int * int) = "caml_oci_spool_counts" (* open, busy *)
+external oci_spool_destroy: oci_spool -> unit = "caml_oci_spool_destroy"
+
+(* non-blocking mode - oci_connect.c, oci_dml.c and oci_select.c *)
+external oci_set_nonblocking: oci_handles -> bool -> unit = "caml_oci_set_nonblocking"
+external oci_cancel: oci_handles -> unit = "caml_oci_cancel"
+external oci_statement_execute_nb: oci_handles -> oci_statement -> bool -> bool = "caml_oci_stmt_execute_nb" (* AUTOCOMMIT, true when complete *)
+external oci_commit_nb: oci_handles -> bool = "caml_oci_commit_nb"
+external oci_decoder_fill_nb: oci_handles -> oci_statement -> oci_decoder -> int = "caml_oci_decoder_fill_nb" (* -1 while still executing *)
 
 (* transaction control commit/rollback - oci_dml.c *)
 external oci_commit: oci_handles -> unit = "caml_oci_commit"
@@ -101,28 +298,31 @@ external oci_alloc_statement: oci_env -> oci_statement = "caml_oci_stmt_alloc"
 external oci_free_statement: oci_statement -> unit = "caml_oci_stmt_free"
 
 (* basic DML (enough for orasql) - oci_dml.c *)
-external oci_statement_prepare: oci_handles -> oci_statement -> string -> int = "caml_oci_stmt_prepare"
+external oci_statement_prepare: oci_handles -> oci_statement -> string -> bool -> (int * bool) = "caml_oci_stmt_prepare" (* type and cache hit *)
+external oci_statement_release: oci_handles -> oci_statement -> unit = "caml_oci_stmt_release"
+external oci_statement_id: oci_statement -> nativeint = "caml_oci_stmt_id"
 external oci_statement_execute: oci_handles -> oci_statement -> bool -> bool -> unit = "caml_oci_stmt_execute" (* AUTOCOMMIT and DESCRIBE_ONLY *)
 
 (* binding - oci_dml.c *)
 external oci_alloc_bindhandle: unit -> oci_bindhandle = "caml_oci_alloc_bindhandle"
-external oci_bind_by_pos: oci_handles -> oci_statement -> oci_bindhandle -> (int * int) -> col_value -> oci_ptr = "caml_oci_bind_by_pos" 
-external oci_bind_date_by_pos: oci_handles -> oci_statement -> oci_bindhandle -> int -> float -> oci_ptr = "caml_oci_bind_date_by_pos"
-external oci_bind_by_name: oci_handles -> oci_statement -> oci_bindhandle -> (string * int) -> col_value -> oci_ptr = "caml_oci_bind_by_name" 
-external oci_bind_date_by_name: oci_handles -> oci_statement -> oci_bindhandle -> string -> float -> oci_ptr = "caml_oci_bind_date_by_name" 
+external oci_alloc_bind_slot: unit -> oci_bind_slot = "caml_oci_alloc_bind_slot"
+external oci_bind_slot: oci_handles -> oci_statement -> oci_bind_slot -> (bind_spec * int) -> col_value -> unit = "caml_oci_bind_slot" (* dates as Number epoch *)
 
 (* fetching - oci_select.c *)
 external oci_get_column_types: oci_handles -> oci_statement -> col_value array = "caml_oci_get_column_types"
-external oci_define: oci_handles -> oci_statement -> int -> (int * bool * bool) -> int -> define_spec = "caml_oci_define"
+external oci_define: oci_handles -> oci_statement -> int -> (int * bool * bool * bool) -> (int * int) -> define_spec = "caml_oci_define" (* type, is_int, is_null, native; size and rows *)
 external oci_fetch: oci_handles -> oci_statement -> unit = "caml_oci_fetch"
+external oci_fetch_rows: oci_handles -> oci_statement -> int -> int = "caml_oci_fetch_rows" (* returns rows actually fetched *)
 external oci_set_prefetch: oci_handles -> oci_statement -> int -> unit = "caml_oci_set_prefetch"
 external oci_get_rows_affected: oci_handles -> oci_statement -> int = "caml_oci_get_rows_affected"
-
-(* type conversions - oci_types.c *)
-external oci_get_defined_string: oci_ptr -> string = "caml_oci_get_defined_string"
-external oci_get_date_as_double: oci_ptr -> float = "caml_oci_get_date_as_double"
-external oci_get_double: oci_handles -> oci_ptr -> float = "caml_oci_get_double"
-external oci_get_int: oci_handles -> oci_ptr -> int = "caml_oci_get_int"
+external oci_make_decoder: define_spec array -> oci_decoder = "caml_oci_make_decoder"
+external oci_fetch_row: oci_handles -> oci_statement -> oci_decoder -> col_value array = "caml_oci_fetch_row" (* raises Not_found at the end *)
+external oci_fetch_decoded: oci_handles -> oci_statement -> oci_decoder -> int -> col_value array array = "caml_oci_fetch_decoded"
+external oci_decoder_state: oci_decoder -> (int * bool) = "caml_oci_decoder_state" (* rows pending and cursor exhausted *)
+external oci_decoder_reset: oci_decoder -> unit = "caml_oci_decoder_reset"
+external oci_decoder_epoch_dates: oci_decoder -> bool -> unit = "caml_oci_decoder_epoch_dates"
+external oci_define_columnar: oci_handles -> oci_statement -> int -> column_data -> oci_ptr = "caml_oci_define_columnar"
+external oci_columnar_finish: oci_ptr -> column_data -> null_column -> int -> unit = "caml_oci_columnar_finish" (* null map and dates after a fetch *)
 
 (* C heap memory functions - oci_common.c *)
 external oci_alloc_c_mem: int -> oci_ptr = "caml_alloc_c_mem"
@@ -138,13 +338,41 @@ external oci_version: unit -> (int * int) = "caml_oci_version"
 (* AQ functions - oci_aq.c *)
 external oci_get_tdo_: oci_env -> oci_handles -> string -> oci_ptr = "caml_oci_get_tdo"
 external oci_string_assign: oci_env -> oci_handles -> string -> oci_ptr = "caml_oci_string_assign_text"
-external oci_aq_enqueue: oci_handles -> string -> oci_ptr -> oci_ptr -> oci_ptr -> unit = "caml_oci_aq_enqueue"
+external oci_aq_enqueue: oci_handles -> string -> oci_ptr -> oci_ptr -> int -> unit = "caml_oci_aq_enqueue" (* payload, null offset *)
+external oci_aq_layout: oci_env -> oci_handles -> oci_ptr -> (int array * int array * int * int) = "caml_oci_aq_layout"
+external oci_write_ind: oci_ptr -> int -> int -> int -> unit = "caml_oci_write_ind"
+external oci_read_ind: oci_ptr -> int -> int -> int = "caml_oci_read_ind"
 external oci_int_from_number: oci_handles -> oci_ptr -> int -> int = "caml_oci_int_from_number"
 external oci_flt_from_number: oci_handles -> oci_ptr -> int -> float = "caml_oci_flt_from_number"
 external oci_string_from_string: oci_env -> oci_ptr -> string = "caml_oci_string_from_string"
-external oci_aq_dequeue: oci_env -> oci_handles -> string -> oci_ptr -> int -> oci_ptr = "caml_oci_aq_dequeue"
+external oci_aq_dequeue: oci_env -> oci_handles -> string -> oci_ptr -> int -> (oci_ptr * oci_ptr) = "caml_oci_aq_dequeue" (* payload, null struct *)
 external oci_aq_enqueue_raw: oci_env -> oci_handles -> string -> oci_ptr -> string -> unit = "caml_oci_aq_enqueue_raw"
 external oci_aq_dequeue_raw: oci_env -> oci_handles -> string -> oci_ptr -> int -> string = "caml_oci_aq_dequeue_raw"
+external oci_aq_enqueue_array: oci_handles -> string -> oci_ptr -> oci_ptr array -> int -> int = "caml_oci_aq_enqueue_array"
+external oci_aq_enqueue_raw_array: oci_env -> oci_handles -> string -> oci_ptr -> string array -> int = "caml_oci_aq_enqueue_raw_array"
+external oci_aq_dequeue_array: oci_env -> oci_handles -> string -> oci_ptr -> (int * int) -> (oci_ptr * oci_ptr) array * int * string = "caml_oci_aq_dequeue_array" (* (timeout, max) -> (messages, error code, message) *)
+external oci_aq_dequeue_raw_array: oci_env -> oci_handles -> string -> oci_ptr -> (int * int) -> string array * int * string = "caml_oci_aq_dequeue_raw_array"
+
+(* LOBs - oci_blob.c *)
+external oci_lob_create_temp: oci_handles -> bool -> oci_lob = "caml_oci_lob_create_temp" (* true for a CLOB *)
+external oci_lob_is_clob: oci_lob -> bool = "caml_oci_lob_is_clob"
+external oci_lob_length: oci_lob -> int = "caml_oci_lob_length"
+external oci_lob_chunk_size: oci_lob -> int = "caml_oci_lob_chunk_size"
+external oci_lob_seek: oci_lob -> int -> unit = "caml_oci_lob_seek"
+external oci_lob_position: oci_lob -> int = "caml_oci_lob_position"
+external oci_lob_read: oci_lob -> Bytes.t -> int -> int -> int = "caml_oci_lob_read" (* buffer, offset and length, returns bytes read *)
+external oci_lob_write: oci_lob -> string -> int -> int -> int = "caml_oci_lob_write" (* same, returns bytes written *)
+external oci_lob_trim: oci_lob -> int -> unit = "caml_oci_lob_trim"
+external oci_set_lob_prefetch: oci_handles -> int -> unit = "caml_oci_set_lob_prefetch"
+
+(* change notification - oci_dcn.c *)
+external oci_dcn_register: oci_handles -> (bool * bool * int) -> int -> oci_dcn = "caml_oci_dcn_register" (* rowids, query level, timeout; max queued *)
+external oci_dcn_add: oci_handles -> oci_dcn -> oci_statement -> unit = "caml_oci_dcn_add"
+external oci_dcn_clear: oci_handles -> oci_statement -> unit = "caml_oci_dcn_clear"
+external oci_dcn_wait: oci_dcn -> float -> ((int * string * int * string * int) array * bool) = "caml_oci_dcn_wait" (* changes, still registered *)
+external oci_dcn_dropped: oci_dcn -> int = "caml_oci_dcn_dropped"
+external oci_dcn_query_id: oci_handles -> oci_statement -> int = "caml_oci_dcn_query_id"
+external oci_dcn_unregister: oci_handles -> oci_dcn -> unit = "caml_oci_dcn_unregister"
 
 (* Out variable functions - oci_out.c *)
 external oci_bind_numeric_out_by_pos: oci_handles -> oci_statement -> oci_bindhandle -> int -> oci_ptr = "caml_oci_bind_numeric_out_by_pos"
@@ -152,31 +380,40 @@ external oci_get_int_from_context: oci_handles -> oci_ptr -> int -> int = "caml_
 external oci_get_float_from_context: oci_handles -> oci_ptr -> int -> float = "caml_oci_get_float_from_context"
 external oci_bind_date_out_by_pos: oci_handles -> oci_statement -> oci_bindhandle -> int -> oci_ptr = "caml_oci_bind_date_out_by_pos"
 external oci_get_date_from_context: oci_handles -> oci_ptr -> int -> float = "caml_oci_get_date_from_context"
+external oci_get_tm_from_context: oci_handles -> oci_ptr -> int -> Unix.tm = "caml_oci_get_tm_from_context"
 external oci_bind_string_out_by_pos: oci_handles -> oci_statement -> oci_bindhandle -> int -> oci_ptr = "caml_oci_bind_string_out_by_pos"
 external oci_get_string_from_context: oci_handles -> oci_ptr -> int -> string = "caml_oci_get_string_from_context"
-external oci_get_pos_from_name: oci_handles -> oci_statement -> string -> int = "caml_oci_get_pos_from_name"
-external oci_bind_ref_cursor: oci_handles -> oci_statement -> oci_bindhandle -> int -> oci_statement -> unit = "caml_oci_bind_ref_cursor"
+external oci_get_bind_names: oci_handles -> oci_statement -> string array = "caml_oci_get_bind_names" (* in position order *)
+external oci_bind_ref_cursor: oci_handles -> oci_statement -> oci_bindhandle -> int -> oci_statement -> oci_ptr = "caml_oci_bind_ref_cursor" (* returns the callback context *)
 
 (* bulk dml functions - oci_bulkdml.c *)
-external oci_size_of_int: unit -> int = "caml_oci_get_size_of_int" (* native datatypes, not OCINumber *)
-external oci_size_of_float: unit -> int = "caml_oci_get_size_of_float"
-external oci_size_of_date: unit -> int = "caml_oci_get_size_of_date" (* this one is an OCIDate *)
-external oci_write_nat_int_at_offset: oci_ptr -> int -> int -> unit = "caml_oci_write_nat_int_at_offset"
-external oci_write_nat_flt_at_offset: oci_ptr -> int -> float -> unit = "caml_oci_write_nat_flt_at_offset"
-external oci_write_chr_at_offset: oci_ptr -> int -> string -> unit = "caml_oci_write_chr_at_offset"
-external oci_write_odt_at_offset: oci_ptr -> int -> float -> unit = "caml_oci_write_odt_at_offset" (* takes a double and converts it to an OCIDate *)
-external oci_bind_bulk_int: oci_handles -> oci_statement -> oci_bindhandle -> oci_ptr -> int -> unit = "caml_oci_bind_bulk_int"
-external oci_bind_bulk_flt: oci_handles -> oci_statement -> oci_bindhandle -> oci_ptr -> int -> unit = "caml_oci_bind_bulk_flt"
-external oci_bind_bulk_chr: oci_handles -> oci_statement -> oci_bindhandle -> oci_ptr -> (int * int) -> unit = "caml_oci_bind_bulk_chr"
-external oci_bind_bulk_odt: oci_handles -> oci_statement -> oci_bindhandle -> oci_ptr -> (int * int) -> unit = "caml_oci_bind_bulk_odt"
-external oci_bulk_exec: oci_handles -> oci_statement -> int -> bool -> unit = "caml_oci_bulk_exec"
+external oci_pack_column: oci_bind_slot -> bulk_column -> bool = "caml_oci_pack_column" (* true if it must be bound again *)
+external oci_bind_packed: oci_handles -> oci_statement -> oci_bind_slot -> bind_spec -> bool -> unit = "caml_oci_bind_packed" (* true if another slot was bound there since *)
+external oci_bulk_exec_start: oci_handles -> oci_statement -> int -> bool -> oci_bulk_job = "caml_oci_bulk_exec_start"
+external oci_bulk_exec_wait: oci_handles -> oci_bulk_job -> unit = "caml_oci_bulk_exec_wait"
+external oci_bulk_exec: oci_handles -> oci_statement -> int -> bool -> bool -> (int * int * string) array = "caml_oci_bulk_exec" (* rows that failed, if batch errors *)
 
 (* public interface *)
 module type OCIML =
 sig
   val oralogon:     string -> meta_handle
+  val oralogon_many: string -> int -> meta_handle array
   val oralogoff:    meta_handle -> unit
+  val oraping:      meta_handle -> bool
+  val orapool_create: ?min:int -> ?max:int -> ?increment:int -> ?timeout:int -> ?warmup:string list -> string -> meta_pool
+  val orapool_acquire: ?ping:bool -> meta_pool -> meta_handle
+  val orapool_release: meta_handle -> unit
+  val orapool_stats: meta_pool -> pool_stats
+  val orapool_destroy: meta_pool -> unit
   val oracommit:    meta_handle -> unit
+  val oraexec_async: meta_statement -> unit ora_async
+  val orafetch_async: meta_statement -> col_value array option ora_async
+  val oracommit_async: meta_handle -> unit ora_async
+  val orapoll:      'a ora_async -> bool
+  val oraresult:    'a ora_async -> 'a
+  val oraawait:     'a ora_async -> 'a
+  val oraawait_all: 'a ora_async list -> 'a list
+  val oracancel:    'a ora_async -> unit
   val oraroll:      meta_handle -> unit
   val oraopen:      meta_handle -> meta_statement
   val oraclose:     meta_statement -> unit
@@ -187,33 +424,86 @@ sig
   val orasql:       meta_statement -> string -> unit
   val oraautocom:   meta_handle -> unit
   val orabindexec:  meta_statement -> col_value array list -> unit
+  val orabindexec_columns: meta_statement -> bulk_column array -> unit
+  val orabindexec_batch_errors: meta_statement -> col_value array list -> (int * int * string) list
+  val orabulkload:  meta_statement -> ?batch:int -> col_value array Seq.t -> bulkload_stats
   val orastring:    col_value -> string
   val oradesc:      meta_handle -> string -> string array
   val oracols:      meta_statement -> string array
   val orafetch:     meta_statement -> col_value array
+  val orafetch_batch: meta_statement -> int -> col_value array array
+  val orafetch_columnar: meta_statement -> int -> column_batch
   val orafetchall:  meta_statement -> col_value array list
+  val orafold:      ('a -> col_value array -> 'a) -> 'a -> meta_statement -> 'a
+  val oraiter:      (col_value array -> unit) -> meta_statement -> unit
+  val oraseq:       meta_statement -> col_value array Seq.t
+  val oralob_create_clob: meta_handle -> oci_lob
+  val oralob_create_blob: meta_handle -> oci_lob
+  val oralob_length: oci_lob -> int
+  val oralob_chunk_size: oci_lob -> int
+  val oralob_seek:  oci_lob -> int -> unit
+  val oralob_position: oci_lob -> int
+  val oralob_trim:  oci_lob -> int -> unit
+  val oralob_read_into: oci_lob -> Bytes.t -> int
+  val oralob_seq:   ?size:int -> oci_lob -> string Seq.t
+  val oralob_to_string: oci_lob -> string
+  val oralob_write_seq: ?size:int -> oci_lob -> string Seq.t -> int
+  val oradcn_register: ?rowids:bool -> ?queries:bool -> ?timeout:int -> ?max_queued:int -> meta_statement -> meta_dcn
+  val oradcn_add:   meta_dcn -> meta_statement -> unit
+  val oradcn_wait:  ?timeout:float -> meta_dcn -> dcn_event list
+  val oradcn_iter:  (dcn_event -> unit) -> meta_dcn -> unit
+  val oradcn_dropped: meta_dcn -> int
+  val oradcn_unregister: meta_dcn -> unit
+  val oradcn_queue_default: int
   val oranullval:   col_value -> unit
   val oraenqueue:   meta_handle -> string -> string -> col_value array -> unit
   val oradequeue:   meta_handle -> string -> string -> col_value array -> col_value array
+  val oraenqueue_array: meta_handle -> string -> string -> col_value array array -> unit
+  val oradequeue_array: meta_handle -> ?max:int -> string -> string -> col_value array -> col_value array array
+  val oraaqtypes_flush: meta_handle -> unit
+  val oradeqarray_default: int
   val oradeqtime:   meta_handle -> int -> unit
   val oraprefetch:  meta_statement -> int -> unit
-  val oraprompt:    string
+  val orafetchrows: meta_statement -> int -> unit
+  val oranativenum: meta_statement -> bool -> unit
+  val oraepochdates: meta_statement -> bool -> unit
+  val oraprompt:    string Atomic.t
   val oraprefetch_default: int
+  val orafetchrows_default: int
+  val oranativenum_default: bool
+  val oraepochdates_default: bool
+  val oradesccache_size: int
+  val orastmtcache: meta_handle -> int -> unit
+  val orastmtcache_default: int
+  val oraresultcache: ?ttl:float -> ?dcn:bool -> meta_statement -> bool -> unit
+  val oraresultcache_stats: unit -> result_cache_stats
+  val oraresultcache_flush: unit -> unit
+  val oraresultcache_default: bool
+  val oraresultcache_size: int
+  val oraresultcache_max_rows: int
+  val oraresultcache_ttl_default: float
+  val oralobprefetch: meta_handle -> int -> unit
+  val oralobprefetch_default: int
+  val oralobchunks_default: int
+  val orabulkload_batch_default: int
   val oci_version:  unit -> (int * int)
   val oraldalist:   unit -> meta_handle list
   val orasthlist:   meta_handle -> meta_statement list
 end
 
-(* actual implementation *)
-let handle_seq = ref 0 (* unique ids for handles *)
-let statement_seq = ref 0 (* unique ids for statements *)
+(* actual implementation - the state below is shared by every domain, so ids
+   are atomic and the registries are sharded tables. A connection and its 
+   statements should be used from one domain at a time *)
+let handle_seq = Atomic.make 0 (* unique ids for handles *)
+let statement_seq = Atomic.make 0 (* unique ids for statements *)
+let next_id seq = (Atomic.fetch_and_add seq 1) + 1
 
-let open_connections = Hashtbl.create 10 (* currently opened handles *)
-let oraldalist () = hash_vals open_connections
+let open_connections = sharded_create 16 (* currently opened handles *)
+let oraldalist () = sharded_vals open_connections
 
-let open_statements  = Hashtbl.create 20 (* currently opened statement handles *)
+let open_statements  = sharded_create 32 (* currently opened statement handles *)
 let orasthlist lda = 
-  Hashtbl.fold (
+  sharded_fold (
     fun (connection_id, _) v acc -> 
       if (lda.connection_id == connection_id) then
 	v::acc
@@ -221,11 +511,19 @@ let orasthlist lda =
 	acc
   ) open_statements []
 
+let aq_deq_errors = sharded_create 16 (* (connection id, queue) -> error that came with an array dequeue *)
+
+let dcn_seq = Atomic.make 0
+let dcn_subscriptions = sharded_create 16 (* change notification subscriptions, by id *)
+
+(* changes held for a subscription before more are dropped *)
+let oradcn_queue_default = ref 100000
+
 (* write a timestamped log message (log messages from the C code are tagged {C} 
    so anything else is from the ML. This can be set from the application.  *)
-let internal_oradebug = ref false
-let oradebug x = internal_oradebug := x; ()
-let debug msg = match !internal_oradebug with |true -> log_message msg |false -> ()
+let internal_oradebug = Atomic.make false
+let oradebug x = Atomic.set internal_oradebug x; ()
+let debug msg = match Atomic.get internal_oradebug with |true -> log_message msg |false -> ()
 
 (* autocommit mode - default false *)
 let oraautocom lda x = lda.auto_commit <- x; ()
@@ -237,7 +535,43 @@ let oradeqtime lda x = lda.deq_timeout <- x; ()
 let oraprefetch sth x = sth.prefetch_rows <- x; ()
 let oraprefetch_default = ref 10
 
-let oraprompt = ref "not connected > "
+(* rows to fetch per round-trip into the define buffers - also set at the level 
+   of a statement, and takes effect from the next fetch *)
+let orafetchrows sth x = sth.fetch_rows <- (max 1 x); ()
+let orafetchrows_default = ref 10
+
+(* have OCI convert NUMBER columns to native 64-bit integers (for columns with 
+   scale 0) or doubles as it fetches, rather than converting each OCINumber 
+   afterwards. An integer column holding a value outside the 64-bit range 
+   will fail the fetch with ORA-01455 in this mode. Takes effect from the 
+   next oraparse *)
+let oranativenum sth x = sth.native_numbers <- x; ()
+let oranativenum_default = ref false
+
+(* fetch DATE columns as Number holding the epoch, which saves building a 
+   Unix.tm for each one - takes effect from the next oraexec *)
+let oraepochdates sth x = sth.epoch_dates <- x; ()
+let oraepochdates_default = ref false
+
+(* size of the client-side statement cache - set at the level of a connection *)
+let orastmtcache lda x = 
+  oci_set_stmt_cache_size lda.lda x;
+  lda.stmt_cache_size <- x; ()
+let orastmtcache_default = ref 20
+
+(* whether new statements use the client-side result cache - see oraresultcache *)
+let oraresultcache_default = ref false
+
+(* bytes of each LOB sent with the rows it is fetched in, so that small LOBs 
+   are read without round-trips of their own - set at the level of a 
+   connection, and takes effect from the next oraparse *)
+let oralobprefetch lda x = oci_set_lob_prefetch lda.lda x; ()
+let oralobprefetch_default = ref 8192
+
+(* chunks of the LOB read or written per round-trip when streaming *)
+let oralobchunks_default = ref 16
+
+let oraprompt = Atomic.make "not connected > "
 
 (* set this to what you want NULLs to be returned as, e.g. Integer 0 or Varchar "" or Datetime 0.0 even! *)
 let internal_oranullval = ref @@ (Varchar "null")
@@ -254,70 +588,199 @@ let _ = Callback.register_exception "Oci_exception" (Oci_exception (-20000, "Use
 (* do this just once at the start - cleaned up by atexit in the C code *)
 let global_env = oci_env_create ()
 
+(* look a bind name up in the names found when the statement was parsed, as 
+   given or failing that in uppercase, with or without its leading colon *)
+let resolve_bind_name sth n =
+  match Hashtbl.find_opt sth.bind_names n with
+    |Some r -> r
+    |None -> 
+      (match Hashtbl.find_opt sth.bind_names (String.uppercase_ascii n) with
+	|Some r -> r
+	|None -> raise (Oci_exception (1036, sprintf "ORA-01036: illegal variable name/number %s" n)))
+
+(* read the bind variables of a freshly prepared statement - SQL with no colon 
+   in it cannot have any, so does not need asking *)
+let find_bind_names sth sqltext =
+  Hashtbl.reset sth.bind_names;
+  if String.contains sqltext ':' then
+    Array.iteri (fun i n ->
+      if not (Hashtbl.mem sth.bind_names n) then
+	let entry = (i + 1, Name (":" ^ n)) in
+	Hashtbl.replace sth.bind_names n entry;
+	Hashtbl.replace sth.bind_names (":" ^ n) entry
+    ) (oci_get_bind_names sth.parent_lda.lda sth.sth)
+
+(* the bind slot for a bind spec, allocated on first use *)
+let bind_slot sth bs =
+  try 
+    Hashtbl.find sth.bind_slots bs
+  with Not_found -> let slot = oci_alloc_bind_slot () in
+		    Hashtbl.add sth.bind_slots bs slot; 
+		    slot
+
 (* bind a value into a placeholder in a statement, can be either an offset of
-   type integer (starting from 1) or the name of the placeholder e.g. :varname.
-   Note that if you bind the same column by position and by name in subsequent
-   calls you will have a small leak in the bind handle cache until the next parse*)
+   type integer (starting from 1) or the name of the placeholder e.g. :varname *)
 let rec orabind sth bs cv =
-  (* if we have a bind handle for this bind spec, reuse it otherwise allocate a new one *)
-  let bh = (try 
-	      Hashtbl.find sth.bound_vals bs
-    with Not_found -> let bh = oci_alloc_bindhandle () in
-		      Hashtbl.add sth.bound_vals bs bh; 
-		      bh ) in
-  (* note that we are maintaining pointers to the bindhandle *and* the bound value, so they can be heap-allocated and GC'd later *)
-  (match bs with
-    |Pos p -> (match cv with
-	|Datetime x -> (Hashtbl.replace sth.oci_ptrs bs (oci_bind_date_by_pos sth.parent_lda.lda sth.sth bh p (date_to_double x)))
-	|Varchar _  -> (Hashtbl.replace sth.oci_ptrs bs (oci_bind_by_pos sth.parent_lda.lda sth.sth bh (p, oci_sqlt_str) cv))
-	|Integer _  -> (Hashtbl.replace sth.oci_ptrs bs (oci_bind_by_pos sth.parent_lda.lda sth.sth bh (p, oci_sqlt_int) cv))
-	|Number _   -> (Hashtbl.replace sth.oci_ptrs bs (oci_bind_by_pos sth.parent_lda.lda sth.sth bh (p, oci_sqlt_flt) cv))
-	|_          -> orabind sth bs !internal_oranullval
-    )
-    |Name n -> ( 
-      let n = match (String.sub n 0 1) with 
-	|":" -> n
-	|_   -> (sprintf ":%s" n) in
-      match cv with
-	|Datetime x -> (Hashtbl.replace sth.oci_ptrs bs (oci_bind_date_by_name sth.parent_lda.lda sth.sth bh n (date_to_double x)))
-	|Varchar _  -> (Hashtbl.replace sth.oci_ptrs bs (oci_bind_by_name sth.parent_lda.lda sth.sth bh (n, oci_sqlt_str) cv))
-	|Integer _  -> (Hashtbl.replace sth.oci_ptrs bs (oci_bind_by_name sth.parent_lda.lda sth.sth bh (n, oci_sqlt_int) cv))
-	|Number _   -> (Hashtbl.replace sth.oci_ptrs bs (oci_bind_by_name sth.parent_lda.lda sth.sth bh (n, oci_sqlt_flt) cv))
-	|_          -> orabind sth bs !internal_oranullval
-    )
+  (* each bind spec has a slot for the life of the parse, so binding again for 
+     the next execute just overwrites the value in place *)
+  let bs = (match bs with
+    |Name n -> snd (resolve_bind_name sth n)
+    |Pos _ -> bs) in
+  let slot = bind_slot sth bs in
+  (match cv with
+    |Datetime x -> oci_bind_slot sth.parent_lda.lda sth.sth slot (bs, oci_sqlt_odt) (Number (date_to_double x))
+    |Varchar _  -> oci_bind_slot sth.parent_lda.lda sth.sth slot (bs, oci_sqlt_str) cv
+    |Integer _  -> oci_bind_slot sth.parent_lda.lda sth.sth slot (bs, oci_sqlt_int) cv
+    |Number _   -> oci_bind_slot sth.parent_lda.lda sth.sth slot (bs, oci_sqlt_flt) cv
+    |Lob _      -> oci_bind_slot sth.parent_lda.lda sth.sth slot (bs, oci_sqlt_clob) cv
+    |_          -> orabind sth bs !internal_oranullval
   );
+  Hashtbl.replace sth.bound_values bs cv;
   sth.binds <- (sth.binds +1);
   ()
       
 (* parse a SQL statement - note that this does *not* validate the SQL in any way,
    it simply sets it in the statement handle's context *)
 
+(* (re)define every column with buffers big enough for a batch of rows, and 
+   compile the defines into a decoder so a fetch needs no per-column lookups *)
+let define_cols sth rows =
+  sth.num_cols <- Array.length sth.col_types;
+  sth.defines <- Array.mapi (fun i x  ->
+    match x with
+      |Col_type (name, dtype, size, is_int, is_null) ->
+	oci_define sth.parent_lda.lda sth.sth i (dtype, is_int, is_null, sth.native_numbers) (size, rows)
+      | _ -> raise (Invalid_argument "define_cols: not a column")
+  )  sth.col_types;
+  sth.decoder <- Some (oci_make_decoder sth.defines);
+  sth.define_rows <- rows
+
+let reset_fetch_buffers sth =
+  sth.result_fetch <- Rc_none;
+  (match sth.decoder with
+    |Some d -> oci_decoder_reset d; oci_decoder_epoch_dates d sth.epoch_dates
+    |None -> ());
+  (match sth.columnar with
+    |Some st -> st.col_done <- false
+    |None -> ())
+
+(* bumped by DDL run on any connection, as it may change any select list *)
+let layout_generation = Atomic.make 0
+
+let layout_after_exec sql_type =
+  match sql_type with
+    |1 | 2 | 3 | 4 | 8 | 9 | 10 | 16 -> ()
+    |_ -> Atomic.incr layout_generation
+
+(* describe the select list of a statement that has been executed (which 
+   includes a REF CURSOR coming back from PL/SQL) and define it - the 
+   describe is read from the statement handle, not the server *)
 let define_select_cols sth =
   begin
-    oci_statement_execute sth.parent_lda.lda sth.sth sth.parent_lda.auto_commit true; 
-    let sql_cols = (oci_get_column_types sth.parent_lda.lda sth.sth)  in
-    sth.num_cols <- Array.length sql_cols;
-    Array.iteri (fun i x  ->
-      match x with
-	|Col_type (name, dtype, size, is_int, is_null) ->
-	  Hashtbl.replace sth.defined_vals (Pos i) (oci_define sth.parent_lda.lda
-                                               sth.sth i (dtype, is_int, is_null) size)
-	| _ -> () 
-    )  sql_cols
+    sth.layout_gen <- Atomic.get layout_generation;
+    sth.col_types <- (oci_get_column_types sth.parent_lda.lda sth.sth);
+    sth.columnar <- None;
+    define_cols sth sth.fetch_rows;
+    reset_fetch_buffers sth
   end
 
+(* column layouts of queries already described on a connection, keyed by 
+   (connection_id, SQL text), so that parsing the same query again can define 
+   straight away. Thrown away when it grows past oradesccache_size entries *)
+let describe_cache = sharded_create 100
+let oradesccache_size = ref 500
+
+let cache_describe sth =
+  sharded_replace_capped describe_cache !oradesccache_size (sth.parent_lda.connection_id, sth.sql_text) sth.col_types
+
+(* define state of SELECTs whose statements have gone back to the statement 
+   cache, keyed by (connection_id, SQL text). A cache hit that returns the same
+   OCI statement picks its defines up from here, skipping describe and define.
+   A statement going back defined any other way (e.g. into Bigarrays) drops its
+   entry, as the OCI defines no longer point at the saved buffers *)
+let stmt_defines = sharded_create 100
+
+let save_defines sth =
+  let key = (sth.parent_lda.connection_id, sth.sql_text) in
+  match (sth.cached_handle, sth.sql_type, sth.decoder, sth.columnar) with
+    |(true, 1, Some _, None) when sth.parent_lda.stmt_cache_size > 0 ->
+      sharded_replace_capped stmt_defines !oradesccache_size key
+	{cd_stmt=oci_statement_id sth.sth; cd_cols=sth.col_types; cd_defines=sth.defines; 
+	 cd_decoder=sth.decoder; cd_rows=sth.define_rows; cd_gen=sth.layout_gen}
+    |_ ->
+      (match sharded_find_opt stmt_defines key with
+	|Some cd when cd.cd_stmt = oci_statement_id sth.sth -> sharded_remove stmt_defines key
+	|_ -> ())
+
+let restore_defines sth =
+  match sharded_find_opt stmt_defines (sth.parent_lda.connection_id, sth.sql_text) with
+    |Some cd when cd.cd_stmt = oci_statement_id sth.sth ->
+      debug (sprintf "statement handle %d reusing defines from statement cache" sth.statement_id);
+      sth.col_types <- cd.cd_cols;
+      sth.defines <- cd.cd_defines;
+      sth.decoder <- cd.cd_decoder;
+      sth.define_rows <- cd.cd_rows;
+      sth.num_cols <- Array.length cd.cd_cols;
+      sth.layout_gen <- cd.cd_gen;
+      true
+    |_ -> false
+
+(* on parse, a SELECT seen before on this connection is defined from the cache, 
+   otherwise defining waits until oraexec *)
+let define_from_cache sth =
+  sth.col_types <- [||];
+  sth.defines <- [||];
+  sth.decoder <- None;
+  sth.num_cols <- 0;
+  sth.layout_gen <- (-1);
+  match sharded_find_opt describe_cache (sth.parent_lda.connection_id, sth.sql_text) with
+    |Some cols ->
+      debug (sprintf "statement handle %d defined from describe cache" sth.statement_id);
+      sth.col_types <- cols;
+      define_cols sth sth.fetch_rows
+    |None -> ()
+
+(* after the real execute, describe and define unless the cache already did. 
+   Defines checked since the last DDL, including those restored with a 
+   statement cache hit, are trusted - DDL from outside shows up as an error on
+   the first fetch instead (see relayout). Otherwise the layout is checked 
+   against the describe of the execute, which is read on the client - if any 
+   column's name, type, size or scale differs, it is stale *)
+let define_after_exec sth =
+  let gen = Atomic.get layout_generation in
+  match sth.decoder with
+    |Some _ when sth.layout_gen = gen -> ()
+    |Some _ when oci_get_column_types sth.parent_lda.lda sth.sth = sth.col_types -> sth.layout_gen <- gen
+    |_ ->
+      debug (sprintf "statement handle %d described after execute" sth.statement_id);
+      define_select_cols sth;
+      cache_describe sth
+
+(* the statement handle is prepared through the session's statement cache, so 
+   parsing a SQL text that was parsed before is a lookup on the client *)
 let oraparse sth sqltext =
   let t1 = gettimeofday () in
-  let sql_type = oci_statement_prepare sth.parent_lda.lda sth.sth sqltext in
+  save_defines sth;
+  let (sql_type, hit) = oci_statement_prepare sth.parent_lda.lda sth.sth sqltext sth.cached_handle in
   let t2 = gettimeofday () -. t1 in
-  debug (sprintf "parsed sql \"%s\" of type %d on statement handle %d in %fs" sqltext sql_type sth.statement_id t2);
+  debug (sprintf "parsed sql \"%s\" of type %d on statement handle %d in %fs (cache hit %b)" sqltext sql_type sth.statement_id t2 hit);
+  sth.cached_handle <- true;
+  sth.cache_hit <- hit;
+  (match hit with
+    |true -> sth.parent_lda.stmt_cache_hits <- (sth.parent_lda.stmt_cache_hits + 1)
+    |false -> sth.parent_lda.stmt_cache_misses <- (sth.parent_lda.stmt_cache_misses + 1));
 
   (* if this is a select statement we will need to setup the defines so we can 
-     fetch into it. execute with OCI_DESCRIBE_ONLY and get an array back. For
-     each item in the array, allocate an appropriate define (C) and store a 
-     pointer to it indexed by Pos n *)
+     fetch into it. Rather than a round-trip to execute with OCI_DESCRIBE_ONLY,
+     the select list is described after the real execute, or taken from the
+     describe cache if this SQL has been run on this connection before. A hit
+     in the statement cache may still have its defines in place *)
+  sth.sql_text <- sqltext;
+  sth.columnar <- None;
+  sth.result_fetch <- Rc_none;
+  find_bind_names sth sqltext;
   (match sql_type with
-    |1 -> define_select_cols sth
+    |1 -> if not (hit && restore_defines sth) then define_from_cache sth
     |_ -> ()
   );
 
@@ -327,18 +790,183 @@ let oraparse sth sqltext =
   sth.rows_affected <- 0;
   sth.out_pending <- false;
   sth.out_counter <- 0;
-  Hashtbl.clear sth.bound_vals; Hashtbl.clear sth.oci_ptrs;
+  Hashtbl.clear sth.bound_vals; Hashtbl.clear sth.bind_slots; Hashtbl.clear sth.oci_ptrs; Hashtbl.clear sth.bound_values;
   ()
     
-(* Execute the statement currently set in the statement handles. At this point,
-   an exception may be throw if the SQL is invalid. Calling this before the
-   statement is parsed will also result in an exception being thrown *)
-let oraexec sth =
+(* Client-side result cache - opt-in per statement with oraresultcache. The 
+   rows of a SELECT are kept under its login, SQL text and bind values, so 
+   the same query run again on any connection to the same schema is answered 
+   without going to the server. An entry goes ttl seconds after it was made, 
+   the least recently used go once the cache is over oraresultcache_size 
+   bytes, and with ~dcn:true an entry goes as soon as the server notifies a 
+   change to its result. Results with LOBs or cursors in them, or of more 
+   than oraresultcache_max_rows rows, are not kept. While its connection has
+   a transaction open a statement bypasses the cache, so it sees its own 
+   uncommitted changes and they are never kept for others, and committing 
+   such a transaction - or DML with auto_commit set, or DDL - drops 
+   everything kept for the login *)
+let oraresultcache_size = ref (64 * 1024 * 1024)
+let oraresultcache_max_rows = ref 10000
+let oraresultcache_ttl_default = ref 60.0
+
+let oraresultcache ?(ttl = !oraresultcache_ttl_default) ?(dcn = false) sth x =
+  sth.result_cache <- x;
+  sth.result_ttl <- ttl;
+  sth.result_dcn <- dcn; ()
+
+let result_cache = lru_create 256
+let result_lock = Mutex.create ()
+let result_hits = Atomic.make 0
+let result_misses = Atomic.make 0
+let result_evictions = Atomic.make 0
+let result_expired = Atomic.make 0
+let result_invalidations = Atomic.make 0
+let result_changes = Atomic.make 0 (* query change notifications seen *)
+let result_cache_dcns = sharded_create 16 (* connection id -> subscription for its cached queries *)
+
+let oraresultcache_stats () =
+  let (entries, bytes) = with_lock result_lock (fun () -> (lru_length result_cache, lru_cost result_cache)) in
+  {rc_entries = entries; rc_bytes = bytes; rc_hits = Atomic.get result_hits; rc_misses = Atomic.get result_misses;
+   rc_evictions = Atomic.get result_evictions; rc_expired = Atomic.get result_expired;
+   rc_invalidations = Atomic.get result_invalidations}
+
+let oraresultcache_flush () =
+  let n = with_lock result_lock (fun () -> lru_remove_if result_cache (fun _ _ -> true)) in
+  debug (sprintf "oraresultcache_flush: dropped %d results" n)
+
+(* take the notifications off each subscription the cache has made and drop 
+   the entries whose results changed - or all those kept through a 
+   subscription that has gone *)
+let result_cache_invalidate () =
+  List.iter (fun d ->
+    let (evs, registered) = if d.dcn_open then oci_dcn_wait d.dcn_sub 0.0 else ([||], false) in
+    let gone = not (registered && d.dcn_open) in
+    let queries = Array.fold_left (fun acc (kind, _, _, _, qid) -> if kind = 7 (* OCI_EVENT_QUERYCHANGE *) then qid::acc else acc) [] evs in
+    if queries <> [] then ignore (Atomic.fetch_and_add result_changes (List.length queries));
+    if gone || queries <> [] then begin
+      let n = with_lock result_lock (fun () ->
+	lru_remove_if result_cache (fun _ e -> e.re_dcn = d.dcn_id && (gone || List.mem e.re_query queries))) in
+      ignore (Atomic.fetch_and_add result_invalidations n);
+      debug (sprintf "result cache: %d results invalidated by subscription %d" n d.dcn_id)
+    end;
+    if gone then begin
+      d.dcn_open <- false;
+      sharded_remove result_cache_dcns d.dcn_lda.connection_id;
+      sharded_remove dcn_subscriptions d.dcn_id
+    end) (sharded_vals result_cache_dcns)
+
+(* the query-level subscription a connection's cached queries are added to *)
+let result_cache_subscription lda =
+  match sharded_find_opt result_cache_dcns lda.connection_id with
+    |Some d when d.dcn_open -> d
+    |_ ->
+      let d = {dcn_id = next_id dcn_seq; dcn_lda = lda;
+	       dcn_sub = oci_dcn_register lda.lda (false, true, 0) !oradcn_queue_default; dcn_open = true} in
+      sharded_replace result_cache_dcns lda.connection_id d;
+      sharded_add dcn_subscriptions d.dcn_id d;
+      debug (sprintf "result cache: registered subscription %d on connection %d" d.dcn_id lda.connection_id);
+      d
+
+let uncacheable v = match v with Lob _ | Statement _ | RefCursor -> true | _ -> false
+
+(* None if the cache does not apply to this execute, otherwise the key and 
+   the rows if they are there *)
+let result_cache_find sth =
+  let binds = Hashtbl.fold (fun bs v acc -> (bs, v)::acc) sth.bound_values [] in
+  if not sth.result_cache || sth.sql_type <> 1 || List.exists (fun (_, v) -> uncacheable v) binds then None
+  else if oci_in_transaction sth.parent_lda.lda then begin
+    debug (sprintf "result cache: statement %d bypasses the cache inside a transaction" sth.statement_id);
+    None
+  end
+  else begin
+    let key = (sth.parent_lda.login, sth.sql_text, List.sort compare binds) in
+    result_cache_invalidate ();
+    let now = gettimeofday () in
+    let found = with_lock result_lock (fun () ->
+      match lru_find_opt result_cache key with
+	|Some e when e.re_expires > 0.0 && e.re_expires < now ->
+	  lru_remove result_cache key;
+	  Atomic.incr result_expired;
+	  None
+	|Some e -> Some e.re_rows
+	|None -> None) in
+    (match found with
+      |Some _ -> Atomic.incr result_hits; sth.result_hits <- (sth.result_hits + 1)
+      |None -> Atomic.incr result_misses; sth.result_misses <- (sth.result_misses + 1));
+    Some (key, found)
+  end
+
+(* keep a copy of rows handed out from a miss, giving up on the result if it 
+   cannot be cached *)
+let result_cache_capture sth rows =
+  match sth.result_fetch with
+    |Rc_miss m ->
+      if m.count + Array.length rows > !oraresultcache_max_rows || Array.exists (Array.exists uncacheable) rows then
+	sth.result_fetch <- Rc_none
+      else begin
+	m.rows <- (Array.map Array.copy rows) :: m.rows;
+	m.count <- (m.count + Array.length rows)
+      end
+    |_ -> ()
+
+(* the cursor of a miss is exhausted, so the whole result can be kept - 
+   unless a change was notified while it was being fetched *)
+let result_cache_complete sth =
+  match sth.result_fetch with
+    |Rc_miss m ->
+      sth.result_fetch <- Rc_none;
+      result_cache_invalidate ();
+      if m.dcn = 0 || Atomic.get result_changes = m.changes then begin
+	let rows = Array.concat (List.rev m.rows) in
+	let e = {re_rows = rows; re_dcn = m.dcn; re_query = m.query;
+		 re_expires = (if sth.result_ttl > 0.0 then gettimeofday () +. sth.result_ttl else 0.0)} in
+	let bytes = Obj.reachable_words (Obj.repr rows) * (Sys.word_size / 8) in
+	let evicted = with_lock result_lock (fun () -> lru_add result_cache !oraresultcache_size m.key e bytes) in
+	ignore (Atomic.fetch_and_add result_evictions evicted);
+	debug (sprintf "result cache: kept %d rows (%d bytes) for statement %d, %d evicted" m.count bytes sth.statement_id evicted)
+      end
+    |_ -> ()
+
+(* a transaction on this login has been committed, so what was kept for it 
+   may be out of date *)
+let result_cache_forget lda =
+  let n = with_lock result_lock (fun () -> lru_remove_if result_cache (fun (login, _, _) _ -> login = lda.login)) in
+  if n > 0 then begin
+    ignore (Atomic.fetch_and_add result_invalidations n);
+    debug (sprintf "result cache: %d results for %s dropped on commit" n lda.login)
+  end
+
+(* a statement that commits without oracommit - DML run with auto_commit set,
+   or anything other than a query or DML (DDL commits implicitly, and so may 
+   PL/SQL) *)
+let result_cache_after_exec lda sql_type =
+  match sql_type with
+    |1 -> ()
+    |2 | 3 | 4 | 16 -> if lda.auto_commit then result_cache_forget lda
+    |_ -> result_cache_forget lda
+
+(* up to n rows of a hit, copied so the caller cannot change the cache *)
+let result_cache_take sth n =
+  match sth.result_fetch with
+    |Rc_hit h ->
+      let k = min n (Array.length h.rows - h.next) in
+      let rows = Array.init k (fun i -> Array.copy h.rows.(h.next + i)) in
+      h.next <- (h.next + k);
+      sth.rows_affected <- (sth.rows_affected + k);
+      rows
+    |_ -> [||]
+
+(* run the statement on the server *)
+let exec_statement sth =
   let t1 = gettimeofday () in
   oci_set_prefetch sth.parent_lda.lda sth.sth sth.prefetch_rows;
   oci_sess_set_attr sth.parent_lda.lda oci_attr_action (sprintf "oraexec: starting %d" sth.statement_id);
   oci_statement_execute sth.parent_lda.lda sth.sth sth.parent_lda.auto_commit false;
   oci_sess_set_attr sth.parent_lda.lda oci_attr_action (sprintf "oraexec: completed %d" sth.statement_id);
+  if sth.sql_type = 1 then define_after_exec sth;
+  layout_after_exec sth.sql_type;
+  result_cache_after_exec sth.parent_lda sth.sql_type;
+  reset_fetch_buffers sth;
   let t2 = gettimeofday () -. t1 in
   debug (sprintf "statement handle %d executed in %fs" sth.statement_id t2);
   sth.execs <- (sth.execs + 1);
@@ -349,6 +977,37 @@ let oraexec sth =
   sth.sth_op_time <- t2;
   ()
 
+(* run the statement so that its query is added to a change notification 
+   subscription - only this execute, not later ones of the same handle *)
+let exec_registered sth sub =
+  oci_dcn_add sth.parent_lda.lda sub sth.sth;
+  (try exec_statement sth with e -> oci_dcn_clear sth.parent_lda.lda sth.sth; raise e);
+  oci_dcn_clear sth.parent_lda.lda sth.sth
+
+(* Execute the statement currently set in the statement handles. At this point,
+   an exception may be throw if the SQL is invalid. Calling this before the
+   statement is parsed will also result in an exception being thrown. A 
+   SELECT with result caching on may be answered from the cache instead *)
+let oraexec sth =
+  match result_cache_find sth with
+    |None -> exec_statement sth
+    |Some (key, Some rows) ->
+      sth.result_fetch <- Rc_hit {rows; next = 0};
+      sth.execs <- (sth.execs + 1);
+      sth.rows_affected <- 0;
+      sth.sth_op_time <- 0.0;
+      debug (sprintf "statement handle %d answered from the result cache" sth.statement_id)
+    |Some (key, None) ->
+      let lda = sth.parent_lda in
+      let changes = Atomic.get result_changes in
+      let d = if sth.result_dcn then Some (result_cache_subscription lda) else None in
+      let (dcn, query) = (match d with
+	|Some d ->
+	  exec_registered sth d.dcn_sub;
+	  (d.dcn_id, oci_dcn_query_id lda.lda sth.sth)
+	|None -> exec_statement sth; (0, 0)) in
+      sth.result_fetch <- Rc_miss {key; rows = []; count = 0; changes; dcn; query}
+
 (* quick convenient function for binding an array of col_values to an sth and executing *)
 let orabindexec_slow sth cval = 
   List.iter (fun cva -> Array.iteri (fun i v -> orabind sth (Pos (i + 1)) v) cva) cval;
@@ -363,15 +1022,20 @@ let orasql sth sqltext =
 
 let oraclose sth = 
   debug (sprintf "freeing statement id %d from connection id %d" sth.statement_id sth.parent_lda.connection_id);
-  Hashtbl.remove open_statements (sth.parent_lda.connection_id, sth.statement_id);
+  sharded_remove open_statements (sth.parent_lda.connection_id, sth.statement_id);
   Hashtbl.clear sth.bound_vals;
-  oci_free_statement sth.sth
+  match sth.cached_handle with
+    |true -> save_defines sth; oci_statement_release sth.parent_lda.lda sth.sth
+    |false -> oci_free_statement sth.sth
 
 let make_new_statement statement_id parent_lda stmt =
   {statement_id=statement_id; 
    parses=0; binds=0; execs=0; sth_op_time=0.0; prefetch_rows = !oraprefetch_default; rows_affected=0; num_cols=0;
-   out_pending=false; out_counter = 0; sql_type=0; out_types=(Hashtbl.create 10);
-   bound_vals=(Hashtbl.create 10); defined_vals=(Hashtbl.create 10); oci_ptrs=(Hashtbl.create 10); 
+   out_pending=false; out_counter = 0; sql_type=0; sql_text=""; cached_handle=false; cache_hit=false; layout_gen=(-1); out_types=(Hashtbl.create 10);
+   fetch_rows = !orafetchrows_default; native_numbers = !oranativenum_default; epoch_dates = !oraepochdates_default; define_rows=0; defines=[||]; decoder=None; col_types=[||];
+   columnar=None; result_cache = !oraresultcache_default; result_ttl = !oraresultcache_ttl_default; result_dcn=false;
+   result_hits=0; result_misses=0; result_fetch=Rc_none;
+   bound_vals=(Hashtbl.create 10); bind_slots=(Hashtbl.create 10); bound_values=(Hashtbl.create 10); bind_names=(Hashtbl.create 10); oci_ptrs=(Hashtbl.create 10); 
    ref_cursors=(Hashtbl.create 10); parent_lda=parent_lda; sth=stmt}
     
 (* open a statement handle/cursor on a given connection - actually allocated 
@@ -379,11 +1043,10 @@ let make_new_statement statement_id parent_lda stmt =
    that way. Needs a *lot* of metadata to support the OraTcl style API *)
 let oraopen lda =
   let s = oci_alloc_statement global_env in
-  statement_seq := (!statement_seq + 1);
-  let c = !statement_seq in
+  let c = next_id statement_seq in
   debug (sprintf "allocated statement id %d on connection id %d" c lda.connection_id);
   let new_statement = make_new_statement c lda s in
-  Hashtbl.add open_statements (lda.connection_id, c) new_statement;
+  sharded_add open_statements (lda.connection_id, c) new_statement;
   new_statement
 
 (* connect to Oracle, connstr in format "user/pass@db" or "user/pass" like OraTcl *)
@@ -396,29 +1059,229 @@ let oralogon connstr =
   oci_sess_set_attr h oci_attr_username username;
   oci_sess_set_attr h oci_attr_password password;
   oci_session_begin h;
-  handle_seq := (!handle_seq + 1);
-  let c = !handle_seq in 
+  let c = next_id handle_seq in 
   let t2 = (gettimeofday () -. t1) in
   debug (sprintf "established connection %d as %s@%s in %fs" c username database t2);
-  oraprompt := (sprintf "connected to %s@%s > " username database);
-  let conn = {connection_id=c; commits=0; rollbacks=0; auto_commit=false; deq_timeout=(-1); lda_op_time=t2; lda=h} in
-  Hashtbl.add open_connections c conn;
+  Atomic.set oraprompt (sprintf "connected to %s@%s > " username database);
+  let conn = {connection_id=c; commits=0; rollbacks=0; auto_commit=false; deq_timeout=(-1); lda_op_time=t2; 
+	      stmt_cache_size=0; stmt_cache_hits=0; stmt_cache_misses=0; pooled=false; login=username ^ "@" ^ database; async_pending=false; lda=h} in
+  orastmtcache conn !orastmtcache_default;
+  oralobprefetch conn !oralobprefetch_default;
+  sharded_add open_connections c conn;
   conn
 
-(* Disconnect from Oracle and release the memory. Global env is still allocated *)
-let oralogoff lda =
+(* Log on n connections at once, each on a thread of its own in the C stub, so
+   the time taken is about that of the first plus the slowest of the rest 
+   rather than the sum. The first is logged on before the others start, so a 
+   bad password is one failed login. If any fails, none are left open and the
+   first error is raised. lda_op_time is the time each connection took by 
+   itself *)
+let oralogon_many connstr n =
+  let t1 = gettimeofday () in
+  let (username, password, database) = sscanf connstr "%s@/%s@@%s" (fun u p d -> (u, p, d)) in
+  let hs = oci_logon_many global_env (database, username, password) n in
+  debug (sprintf "established %d connections as %s@%s in %fs" n username database (gettimeofday () -. t1));
+  if n > 0 then Atomic.set oraprompt (sprintf "connected to %s@%s > " username database);
+  Array.map (fun (h, t) ->
+    let conn = {connection_id = next_id handle_seq; commits=0; rollbacks=0; auto_commit=false; deq_timeout=(-1); lda_op_time=t;
+		stmt_cache_size=0; stmt_cache_hits=0; stmt_cache_misses=0; pooled=false; login=username ^ "@" ^ database; async_pending=false; lda=h} in
+    orastmtcache conn !orastmtcache_default;
+    oralobprefetch conn !oralobprefetch_default;
+    sharded_add open_connections conn.connection_id conn;
+    conn) hs
+
+(* drop what is kept for a connection that is going away *)
+let forget_connection lda =
   let c = lda.connection_id in
-  oci_session_end lda.lda;
-  oci_server_detach lda.lda;
-  oci_free_handles lda.lda;
-  Hashtbl.remove open_connections c;
-  oraprompt := "not connected > ";
-  debug (sprintf "disconnected %d" lda.connection_id);
-  ()
+  sharded_remove open_connections c;
+  sharded_filter_map_inplace (fun (cid, _) cols -> if cid = c then None else Some cols) describe_cache;
+  sharded_filter_map_inplace (fun (cid, _) cd -> if cid = c then None else Some cd) stmt_defines;
+  sharded_filter_map_inplace (fun (cid, _) e -> if cid = c then None else Some e) aq_deq_errors
+
+(* Session pools - rather than attaching and logging on for each connection,
+   OCI keeps between min and max sessions open and orapool_acquire hands one
+   out as a meta_handle, waiting if all max are busy. Idle sessions are closed
+   after timeout seconds, if given. Sessions go back tagged, so that one that
+   comes out without the tag is new and has the warmup SQL parsed into its
+   statement cache *)
+let pool_seq = Atomic.make 0
+let pool_tag = "ociml_warm"
+let pooled_connections = sharded_create 16 (* connection id -> meta_pool *)
+
+let orapool_create ?(min = 1) ?(max = 10) ?(increment = 1) ?(timeout = 0) ?(warmup = []) connstr =
+  let t1 = gettimeofday () in
+  let (username, password, database) = sscanf connstr "%s@/%s@@%s" (fun u p d -> (u, p, d)) in
+  let sp = oci_spool_create global_env (database, username, password) (min, max, increment) timeout in
+  let p = next_id pool_seq in
+  debug (sprintf "created pool %d as %s@%s (%d-%d sessions) in %fs" p username database min max (gettimeofday () -. t1));
+  {pool_id = p; pool_login = username ^ "@" ^ database; spool = sp; warmup_sql = warmup; pool_open = true;
+   pool_acquires = 0; pool_new_sessions = 0; pool_failed_pings = 0; pool_wait_time = 0.0; pool_max_wait = 0.0;
+   pool_lock = Mutex.create ()}
+
+(* check that a connection is still there, with one round-trip *)
+let oraping lda =
+  try
+    oci_ping lda.lda;
+    true
+  with Oci_exception (e_code, e_desc) ->
+    debug (sprintf "oraping: connection %d failed: %s" lda.connection_id e_desc);
+    false
+
+let orapool_release lda =
+  let pool = try sharded_find pooled_connections lda.connection_id
+    with Not_found -> raise (Invalid_argument "orapool_release: not a pooled connection") in
+  sharded_remove pooled_connections lda.connection_id;
+  forget_connection lda;
+  oci_spool_release lda.lda pool_tag false;
+  debug (sprintf "released connection %d to pool %d" lda.connection_id pool.pool_id)
+
+(* with ping, a session that fails the health check is closed and another
+   taken in its place *)
+let rec orapool_acquire ?(ping = false) pool =
+  if not pool.pool_open then raise (Invalid_argument "orapool_acquire: pool has been destroyed");
+  let t1 = gettimeofday () in
+  let (h, warm) = oci_spool_get global_env pool.spool pool_tag in
+  let t2 = gettimeofday () -. t1 in
+  with_lock pool.pool_lock (fun () ->
+    pool.pool_acquires <- (pool.pool_acquires + 1);
+    pool.pool_wait_time <- (pool.pool_wait_time +. t2);
+    if t2 > pool.pool_max_wait then pool.pool_max_wait <- t2);
+  let conn = {connection_id = next_id handle_seq; commits=0; rollbacks=0; auto_commit=false; deq_timeout=(-1); lda_op_time=t2;
+	      stmt_cache_size=0; stmt_cache_hits=0; stmt_cache_misses=0; pooled=true; login=pool.pool_login; async_pending=false; lda=h} in
+  if ping && not (oraping conn) then begin
+    with_lock pool.pool_lock (fun () -> pool.pool_failed_pings <- (pool.pool_failed_pings + 1));
+    oci_spool_release h pool_tag true;
+    orapool_acquire ~ping pool
+  end else begin
+    sharded_add open_connections conn.connection_id conn;
+    sharded_add pooled_connections conn.connection_id pool;
+    (try
+      orastmtcache conn !orastmtcache_default;
+      oralobprefetch conn !oralobprefetch_default;
+      if not warm then begin
+	with_lock pool.pool_lock (fun () -> pool.pool_new_sessions <- (pool.pool_new_sessions + 1));
+	let sth = oraopen conn in
+	(try List.iter (fun sql -> oraparse sth sql) pool.warmup_sql with e -> oraclose sth; raise e);
+	oraclose sth
+      end
+    with e ->
+      (* drop rather than retag, so the session isn't taken for a warm one *)
+      sharded_remove pooled_connections conn.connection_id;
+      forget_connection conn;
+      (try oci_spool_release h pool_tag true with Oci_exception _ -> ());
+      raise e);
+    debug (sprintf "acquired connection %d from pool %d in %fs (new session %b)" conn.connection_id pool.pool_id t2 (not warm));
+    conn
+  end
+
+let orapool_stats pool =
+  let (opened, busy) = if pool.pool_open then oci_spool_counts pool.spool else (0, 0) in
+  with_lock pool.pool_lock (fun () ->
+    {ps_open = opened; ps_busy = busy; ps_idle = opened - busy;
+     ps_acquires = pool.pool_acquires; ps_new_sessions = pool.pool_new_sessions; ps_failed_pings = pool.pool_failed_pings;
+     ps_wait_time = pool.pool_wait_time; ps_max_wait = pool.pool_max_wait})
+
+(* close every session in the pool - any still handed out are closed too, so
+   are no longer usable *)
+let orapool_destroy pool =
+  if pool.pool_open then begin
+    let handed_out = sharded_fold (fun c p acc -> if p == pool then c::acc else acc) pooled_connections [] in
+    List.iter (fun c ->
+      sharded_remove pooled_connections c;
+      match sharded_find_opt open_connections c with
+	|Some lda -> forget_connection lda
+	|None -> ()) handed_out;
+    oci_spool_destroy pool.spool;
+    pool.pool_open <- false;
+    debug (sprintf "destroyed pool %d" pool.pool_id)
+  end
+
+(* Database Change Notification - a subscription is registered on the 
+   connection of a statement, and the statement run to add its query. The 
+   server then sends the changes to tables the query reads (or only to its 
+   result, with ~queries:true) to this process, where they queue up until 
+   oradcn_wait takes them. The server has to be able to connect back to the 
+   client for this, and the user needs the CHANGE NOTIFICATION privilege *)
+let decode_dcn_kind k =
+  match k with
+    |1 (* OCI_EVENT_STARTUP *) -> Dcn_startup
+    |2 (* OCI_EVENT_SHUTDOWN *) | 3 (* OCI_EVENT_SHUTDOWN_ANY *) -> Dcn_shutdown
+    |5 (* OCI_EVENT_DEREG *) -> Dcn_deregistered
+    |6 (* OCI_EVENT_OBJCHANGE *) -> Dcn_object
+    |7 (* OCI_EVENT_QUERYCHANGE *) -> Dcn_query
+    |x -> Dcn_other x
+
+let decode_dcn_ops ops =
+  List.filter_map (fun (flag, op) -> if ops land flag <> 0 then Some op else None)
+    [(1, Dcn_all_rows); (2, Dcn_insert); (4, Dcn_update); (8, Dcn_delete); (16, Dcn_alter); (32, Dcn_drop)]
+
+(* run a statement so its query is added to a subscription *)
+let oradcn_add dcn sth =
+  if sth.parent_lda != dcn.dcn_lda then raise (Invalid_argument "oradcn_add: statement is on another connection");
+  exec_registered sth dcn.dcn_sub
+
+(* subscribe to changes to what the parsed query in sth reads, and run it - 
+   its rows can then be fetched as usual. A timeout in seconds has the server 
+   drop the subscription after that long *)
+let oradcn_register ?(rowids = true) ?(queries = false) ?(timeout = 0) ?(max_queued = !oradcn_queue_default) sth =
+  let lda = sth.parent_lda in
+  let d = {dcn_id = next_id dcn_seq; dcn_lda = lda; 
+	   dcn_sub = oci_dcn_register lda.lda (rowids, queries, timeout) max_queued; dcn_open = true} in
+  sharded_add dcn_subscriptions d.dcn_id d;
+  debug (sprintf "registered subscription %d on connection %d" d.dcn_id lda.connection_id);
+  oradcn_add d sth;
+  d
+
+(* the changes queued since the last call, waiting up to timeout seconds for 
+   one if there are none (forever by default, or until the subscription is 
+   dropped). The OCI thread that receives them never runs any OCaml *)
+let oradcn_wait ?(timeout = -1.0) dcn =
+  let (evs, registered) = oci_dcn_wait dcn.dcn_sub timeout in
+  if not registered && dcn.dcn_open then begin
+    dcn.dcn_open <- false;
+    sharded_remove dcn_subscriptions dcn.dcn_id
+  end;
+  Array.to_list (Array.map (fun (kind, table, ops, rowid, query_id) ->
+    {dcn_kind = decode_dcn_kind kind; dcn_table = table; dcn_ops = decode_dcn_ops ops; 
+     dcn_rowid = rowid; dcn_query_id = query_id}) evs)
+
+(* call f on each change as it arrives, until the subscription is dropped - 
+   e.g. from a thread or domain of its own *)
+let oradcn_iter f dcn =
+  let rec loop () =
+    List.iter f (oradcn_wait dcn);
+    if dcn.dcn_open then loop () in
+  loop ()
+
+(* changes lost since registering because max_queued were already waiting *)
+let oradcn_dropped dcn = oci_dcn_dropped dcn.dcn_sub
+
+let oradcn_unregister dcn =
+  sharded_remove dcn_subscriptions dcn.dcn_id;
+  dcn.dcn_open <- false;
+  oci_dcn_unregister dcn.dcn_lda.lda dcn.dcn_sub;
+  debug (sprintf "unregistered subscription %d" dcn.dcn_id)
+
+(* Disconnect from Oracle and release the memory. Global env is still allocated.
+   A pooled connection goes back to its pool. Subscriptions made on the 
+   connection are dropped first *)
+let oralogoff lda =
+  List.iter (fun d -> if d.dcn_lda == lda then oradcn_unregister d) (sharded_vals dcn_subscriptions);
+  match lda.pooled with
+    |true -> orapool_release lda
+    |false ->
+      oci_session_end lda.lda;
+      oci_server_detach lda.lda;
+      oci_free_handles lda.lda;
+      forget_connection lda;
+      Atomic.set oraprompt "not connected > ";
+      debug (sprintf "disconnected %d" lda.connection_id)
 
 (* commit work outstanding on this connection *)
 let oracommit lda = 
+  let changed = oci_in_transaction lda.lda in
   oci_commit lda.lda;
+  if changed then result_cache_forget lda;
   lda.commits <- (lda.commits + 1);
   debug (sprintf "connection id %d committed transaction %d" lda.connection_id lda.commits);
   ()
@@ -443,13 +1306,18 @@ let rec orastring c =
     |RefCursor -> "#REF CURSOR#"
     |Statement _ -> "#STATEMENT#"
     |Binary _ -> "#BINARY DATA#"
+    |Lob _ -> "#LOB#"
 
 (* describe a table - column names only (for now!) - using the implicit 
    describe method - also see implementation of oracols *)
 let oradesc lda tabname =
   let sth = oraopen lda in
-  ignore(oci_statement_prepare sth.parent_lda.lda sth.sth (sprintf "select * from %s" tabname)); (* discard return value here *)
+  let (_, hit) = oci_statement_prepare sth.parent_lda.lda sth.sth (sprintf "select * from %s" tabname) sth.cached_handle in
+  sth.cached_handle <- true;
+  debug (sprintf "oradesc: describing %s (statement cache hit %b)" tabname hit);
   oci_statement_execute sth.parent_lda.lda sth.sth sth.parent_lda.auto_commit true; (* true - with OCI_DESCRIBE_ONLY set *)
+  let cols = oci_get_column_types lda.lda sth.sth in
+  oraclose sth;
   Array.map (fun x -> 
     match x with 
     |Col_type (col_name, col_type, col_size, is_int, is_null) 
@@ -469,52 +1337,144 @@ let oradesc lda tabname =
 	  )
       )
     |_ -> ("Unknown", Null, 0, Nullable)
-  ) (oci_get_column_types lda.lda sth.sth) 
+  ) cols 
 
 (* list of columns from last exec - this differs from oradesc in that it gives 
    all the columns in an actual query *)
 let oracols sth = oci_get_column_types sth.parent_lda.lda sth.sth
 
-(* get the date back from the C layer as a double, then convert it to Unix.tm *)
-let oci_get_defined_date ptr =
-  let d = oci_get_date_as_double ptr in
-  localtime d
-
-let ora_get_or_null null expr =
-  if null then Null else
-  try expr () with Oci_exception (22060, _) -> Null
-                                      
-(* call the underlying OCI fetch, advancing the cursor by one row, then extract 
-   the data one column at a time from the define handles *)
+let raise_fetch_exception sth e_code e_desc =
+  match e_code with
+    |1403 -> 
+      debug (sprintf "orafetch: not found: rows=%d" sth.rows_affected); 
+      result_cache_complete sth;
+      raise Not_found
+    |_    -> raise (Oci_exception (e_code, e_desc))
+
+(* the decoder for row-at-a-time fetching, provided the cursor is not in use 
+   by orafetch_columnar *)
+let select_decoder sth =
+  match (sth.columnar, sth.decoder) with
+    |(Some _, _) -> raise (Invalid_argument "orafetch: cursor is defined for orafetch_columnar")
+    |(None, Some d) -> d
+    |(None, None) -> raise (Invalid_argument "orafetch: statement is not a select")
+
+(* ORA-01007, ORA-00932 or ORA-01406 on the first fetch after a statement 
+   cache hit means the table has changed under the restored defines - forget
+   the cached layout, run the statement again to describe and define it 
+   afresh, and fetch once more *)
+let relayout sth e_code =
+  match (e_code, sth.rows_affected, sth.columnar) with
+    |((1007 | 932 | 1406), 0, None) when sth.cache_hit ->
+      debug (sprintf "statement handle %d: ORA-%05d, defining again" sth.statement_id e_code);
+      let key = (sth.parent_lda.connection_id, sth.sql_text) in
+      sharded_remove describe_cache key;
+      sharded_remove stmt_defines key;
+      sth.decoder <- None;
+      exec_statement sth;
+      true
+    |_ -> false
+
+let with_relayout sth f =
+  try f () with
+    |Oci_exception (e_code, _) when relayout sth e_code -> f ()
+
+(* hand out the next row - the C decoder calls the underlying OCI fetch for 
+   another batch of sth.fetch_rows rows when its buffers run dry, and builds 
+   each row in a single call *)
 let orafetch_select sth = 
   debug(sprintf "orafetch_select: entered rows_affected=%d" sth.rows_affected);
+  with_relayout sth (fun () ->
+    match sth.result_fetch with
+      |Rc_hit _ -> (match result_cache_take sth 1 with [|row|] -> row |_ -> raise Not_found)
+      |_ ->
+	try
+	  let row = oci_fetch_row sth.parent_lda.lda sth.sth (select_decoder sth) in
+	  result_cache_capture sth [|row|];
+	  sth.rows_affected <- (sth.rows_affected + 1);
+	  debug(sprintf "orafetch: returning row %d" sth.rows_affected);
+	  row
+	with
+	  |Not_found -> result_cache_complete sth; raise Not_found (* end of the cursor, from the decoder *)
+	  |Oci_exception (e_code, e_desc) -> raise_fetch_exception sth e_code e_desc)
+
+(* fetch up to n rows in one call - rows already buffered by orafetch are 
+   returned first, the remainder come from a single array fetch. Raises 
+   Not_found when the cursor is exhausted, fewer than n rows means this is 
+   the last batch *)
+let orafetch_batch sth n =
+  debug(sprintf "orafetch_batch: entered n=%d rows_affected=%d" n sth.rows_affected);
+  if n < 1 then raise (Invalid_argument "orafetch_batch: batch size must be at least 1");
+  with_relayout sth (fun () ->
+    match sth.result_fetch with
+      |Rc_hit _ -> (match result_cache_take sth n with [||] -> raise Not_found |rows -> rows)
+      |_ ->
+	try
+	  let d = select_decoder sth in
+	  let (pending, exhausted) = oci_decoder_state d in
+	  let first = (match pending with
+	    |0 -> [||]
+	    |_ -> oci_fetch_decoded sth.parent_lda.lda sth.sth d (min n pending)) in
+	  let wanted = n - (Array.length first) in
+	  let rest = (match (wanted, exhausted) with
+	    |(0, _) | (_, true) -> [||]
+	    |_ ->
+	      (* the buffers are empty now, so they can be grown without losing rows *)
+	      if wanted > sth.define_rows then define_cols sth wanted;
+	      oci_fetch_decoded sth.parent_lda.lda sth.sth (select_decoder sth) wanted) in
+	  let rows = Array.append first rest in
+	  result_cache_capture sth rows;
+	  if Array.length rows < n then result_cache_complete sth;
+	  if Array.length rows = 0 then raise Not_found;
+	  sth.rows_affected <- (sth.rows_affected + (Array.length rows));
+	  rows
+	with Oci_exception (e_code, e_desc) -> raise_fetch_exception sth e_code e_desc)
+
+(* allocate a Bigarray for each column of the select list plus a null map, 
+   and define the columns straight into them *)
+let define_columnar sth n =
+  let columns = Array.map (fun x -> 
+    match x with
+      |Col_type (_, 2, _, true, _) -> Int_col (Bigarray.Array1.create Bigarray.int64 Bigarray.c_layout n)
+      |Col_type (_, (2|100|101), _, _, _) -> Float_col (Bigarray.Array1.create Bigarray.float64 Bigarray.c_layout n)
+      |Col_type (_, 12, _, _, _) -> Date_col (Bigarray.Array1.create Bigarray.float64 Bigarray.c_layout n)
+      |Col_type (name, dt, _, _, _) -> 
+	raise (Invalid_argument (sprintf "orafetch_columnar: column %s is %s, only numbers and dates are supported" name (decode_col_type dt)))
+      |_ -> raise (Invalid_argument "orafetch_columnar: not a select")
+  ) sth.col_types in
+  let nulls = Array.map (fun _ -> Bigarray.Array1.create Bigarray.int8_unsigned Bigarray.c_layout n) columns in
+  let defs = Array.mapi (fun i c -> oci_define_columnar sth.parent_lda.lda sth.sth i c) columns in
+  let st = {col_batch={batch_rows=0; columns=columns; nulls=nulls}; col_defines=defs; col_capacity=n; col_done=false} in
+  sth.columnar <- Some st;
+  st
+
+(* fetch up to n rows of an all numeric/date select list in one round-trip, 
+   directly into one Bigarray per column with no allocation per value. Once a 
+   cursor has been fetched this way orafetch cannot be used on it until it is 
+   parsed again. Raises Not_found when the cursor is exhausted *)
+let orafetch_columnar sth n =
+  debug(sprintf "orafetch_columnar: entered n=%d rows_affected=%d" n sth.rows_affected);
+  if n < 1 then raise (Invalid_argument "orafetch_columnar: batch size must be at least 1");
+  (match sth.result_fetch with
+    |Rc_hit _ -> raise (Invalid_argument "orafetch_columnar: result came from the result cache")
+    |_ -> sth.result_fetch <- Rc_none);
+  (match sth.decoder with
+    |Some d when fst (oci_decoder_state d) > 0 -> raise (Invalid_argument "orafetch_columnar: cursor has rows buffered by orafetch")
+    |_ -> ());
+  let st = (match sth.columnar with
+    |Some st when st.col_capacity >= n -> st
+    |Some st -> let st' = define_columnar sth n in st'.col_done <- st.col_done; st'
+    |None -> define_columnar sth n) in
+  if st.col_done then raise Not_found;
   try
-    (match sth.rows_affected with
-      |0 -> ()
-      |_ -> oci_fetch sth.parent_lda.lda sth.sth);
-    let row = Array.make sth.num_cols Null in
-    (for i = 0 to (sth.num_cols - 1) do
-       let {dtype=dt; is_int; is_null; ptr} = Hashtbl.find sth.defined_vals (Pos i) in
-       match dt with
-	  |1  -> row.(i) <- ora_get_or_null is_null @@ fun () -> Varchar (oci_get_defined_string ptr)
-	  |12 -> row.(i) <- ora_get_or_null is_null @@ fun () -> Datetime (oci_get_defined_date ptr)
-	  |2 -> (* could be an int or a float *)
-	    (debug(sprintf "col=%d type=%d is_int=%b" i dt is_int);
-	     match is_int with             
-	      |true -> row.(i) <- ora_get_or_null is_null @@ fun () -> Integer (oci_get_int sth.parent_lda.lda ptr)
-	      |false -> row.(i) <- ora_get_or_null is_null @@ fun () -> Number (oci_get_double sth.parent_lda.lda ptr)
-	    )
-	  |_ -> debug(sprintf "orafetch unhandled type in row %d col=%d datatype=%d is_int=%b" sth.rows_affected i dt is_int);
-     done); 
-    sth.rows_affected <- (sth.rows_affected + 1);
-    debug(sprintf "orafetch: returning row %d" sth.rows_affected);
-    row
-  with Oci_exception (e_code, e_desc) ->
-    ( match e_code with
-      |1403 -> 
-	debug (sprintf "orafetch: not found: rows=%d" sth.rows_affected); 
-	raise Not_found
-      |_    -> raise (Oci_exception (e_code, e_desc)))
+    let got = oci_fetch_rows sth.parent_lda.lda sth.sth n in
+    debug(sprintf "orafetch_columnar: asked for %d rows, got %d" n got);
+    st.col_done <- (got < n);
+    if got = 0 then raise Not_found;
+    Array.iteri (fun i d -> oci_columnar_finish d st.col_batch.columns.(i) st.col_batch.nulls.(i) got) st.col_defines;
+    sth.rows_affected <- (sth.rows_affected + got);
+    {st.col_batch with batch_rows=got}
+  with Oci_exception (e_code, e_desc) -> raise_fetch_exception sth e_code e_desc
 
 (* build a result set from the out variables. we know how many we have from the 
    number of keys in sth.oci_ptrs. We know how many rows we have from 
@@ -542,15 +1502,12 @@ let orafetch_out sth =
 	     end
 	   |Datetime _ ->
 	     begin
-	       let epoch = oci_get_date_from_context sth.parent_lda.lda (Hashtbl.find sth.oci_ptrs bs) sth.out_counter in
-	       debug(sprintf "gotten epoch time back as %f" epoch);
-	       rs.(!i) <- Datetime (localtime epoch);
+	       rs.(!i) <- Datetime (oci_get_tm_from_context sth.parent_lda.lda (Hashtbl.find sth.oci_ptrs bs) sth.out_counter);
 	     end
 	   |RefCursor ->
 	     (* get the oci_statement from sth.ref_cursors and turn it into a meta_statement *)
 	     let s = (make_new_statement 99 sth.parent_lda (Hashtbl.find sth.ref_cursors bs)) in
 	     define_select_cols s;
-	     oci_fetch s.parent_lda.lda s.sth;
 	     rs.(!i) <- Statement s
 	   |_ -> ());
 	 sth.out_counter <- (sth.out_counter +1); i := (!i + 1);
@@ -571,25 +1528,263 @@ let orafetch sth =
     |false -> orafetch_select sth
     |true  -> orafetch_out sth
 
-(* fetch all rows in a cursor and return them as a list - relying on prefetch to make this fast *)
-let rec orafetchall_ sth acc =
-  try
-    orafetchall_ sth (acc @ [(orafetch sth)])
-  with
-    |Not_found -> acc
-	  
+let orafetch_opt sth =
+  try Some (orafetch sth) with Not_found -> None
+
+(* fold over the remaining rows in a cursor without holding the result set in 
+   memory - rows still arrive sth.fetch_rows at a time through the defines *)
+let rec orafold f acc sth =
+  match orafetch_opt sth with
+    |Some row -> orafold f (f acc row) sth
+    |None -> acc
+
+let oraiter f sth = orafold (fun () row -> f row) () sth
+
+(* Non-blocking calls. The connection is put in non-blocking mode for just 
+   the one call, so only one can be in progress on a connection at a time and
+   the blocking functions work as before in between *)
+let async_start ?(cancel = fun () -> ()) lda name step complete =
+  if lda.async_pending then 
+    raise (Invalid_argument (sprintf "%s: connection %d already has a call in progress" name lda.connection_id));
+  oci_set_nonblocking lda.lda true;
+  lda.async_pending <- true;
+  {async_lda=lda; async_name=name; async_step=step; async_complete=complete; async_cancel=cancel; 
+   async_cancelled=false; async_started=gettimeofday (); async_polls=0; async_result=None}
+
+let async_finish a =
+  a.async_lda.async_pending <- false;
+  oci_set_nonblocking a.async_lda.lda false
+
+(* make the call again - true once it has completed and the result is ready *)
+let orapoll a =
+  match a.async_result with
+    |Some _ -> true
+    |None when a.async_cancelled -> raise (Invalid_argument (sprintf "%s: call was cancelled" a.async_name))
+    |None ->
+      a.async_polls <- (a.async_polls + 1);
+      let finished = (try a.async_step () with e -> async_finish a; raise e) in
+      if finished then begin
+	async_finish a;
+	a.async_result <- Some (a.async_complete ());
+	debug (sprintf "%s: completed on connection %d in %fs after %d polls" a.async_name a.async_lda.connection_id 
+		 (gettimeofday () -. a.async_started) a.async_polls)
+      end;
+      finished
+
+let oraresult a =
+  match a.async_result with
+    |Some r -> r
+    |None -> raise (Invalid_argument (sprintf "%s: call has not completed" a.async_name))
+
+(* give up on a call in progress - OCIBreak then OCIReset. The statement is 
+   left with nothing to fetch, and polling the call again raises *)
+let oracancel a =
+  match a.async_result with
+    |None when a.async_lda.async_pending && not a.async_cancelled ->
+      let finish () = async_finish a; a.async_cancelled <- true; a.async_cancel () in
+      (try oci_cancel a.async_lda.lda with e -> finish (); raise e);
+      finish ()
+    |_ -> ()
+
+(* A simple scheduler for programs without an event loop - polls every call
+   in turn, sleeping between rounds in which none completed for 0.5ms, 
+   doubling up to 20ms, and back to 0.5ms whenever one does *)
+let orapoll_min_sleep = 0.0005
+let orapoll_max_sleep = 0.02
+
+let oraawait_all asyncs =
+  let rec wait pending delay =
+    match pending with
+      |[] -> ()
+      |_ ->
+	let still = List.filter (fun a -> not (orapoll a)) pending in
+	if List.length still = List.length pending then begin
+	  Unix.sleepf delay;
+	  wait still (min orapoll_max_sleep (delay *. 2.0))
+	end else
+	  wait still orapoll_min_sleep in
+  wait asyncs orapoll_min_sleep;
+  List.map oraresult asyncs
+
+let oraawait a = List.hd (oraawait_all [a])
+
+(* execute, as exec_statement - unlike oraexec a SELECT always goes to the 
+   server, so is neither answered from nor added to the result cache *)
+let oraexec_async sth =
+  let lda = sth.parent_lda in
+  let t1 = gettimeofday () in
+  oci_set_prefetch lda.lda sth.sth sth.prefetch_rows;
+  oci_sess_set_attr lda.lda oci_attr_action (sprintf "oraexec_async: starting %d" sth.statement_id);
+  let a = async_start lda "oraexec_async" ~cancel:(fun () -> reset_fetch_buffers sth)
+    (fun () -> oci_statement_execute_nb lda.lda sth.sth lda.auto_commit)
+    (fun () ->
+      oci_sess_set_attr lda.lda oci_attr_action (sprintf "oraexec_async: completed %d" sth.statement_id);
+      if sth.sql_type = 1 then define_after_exec sth;
+      layout_after_exec sth.sql_type;
+      result_cache_after_exec lda sth.sql_type;
+      reset_fetch_buffers sth;
+      sth.execs <- (sth.execs + 1);
+      if sth.sql_type <> 1 then sth.rows_affected <- oci_get_rows_affected lda.lda sth.sth;
+      sth.sth_op_time <- (gettimeofday () -. t1)) in
+  ignore (orapoll a);
+  a
+
+(* the next row, as orafetch_opt - only a fetch that needs another batch of
+   sth.fetch_rows rows from the server has to wait *)
+let orafetch_async sth =
+  let lda = sth.parent_lda in
+  let step = (match (sth.out_pending, sth.result_fetch) with
+    |(true, _) | (_, Rc_hit _) -> (fun () -> true)
+    |_ -> 
+      let d = select_decoder sth in
+      (fun () -> oci_decoder_fill_nb lda.lda sth.sth d >= 0)) in
+  let a = async_start lda "orafetch_async" ~cancel:(fun () -> reset_fetch_buffers sth) step (fun () -> orafetch_opt sth) in
+  ignore (orapoll a);
+  a
+
+let oracommit_async lda =
+  let changed = oci_in_transaction lda.lda in
+  let a = async_start lda "oracommit_async" 
+    (fun () -> oci_commit_nb lda.lda)
+    (fun () -> 
+      if changed then result_cache_forget lda;
+      lda.commits <- (lda.commits + 1);
+      debug (sprintf "connection id %d committed transaction %d" lda.connection_id lda.commits)) in
+  ignore (orapoll a);
+  a
+
+(* the remaining rows as a sequence - note that this consumes the cursor, so 
+   it can only be traversed once *)
+let oraseq sth =
+  let rec next () =
+    match orafetch_opt sth with
+      |Some row -> Seq.Cons (row, next)
+      |None -> Seq.Nil in
+  next
+
+(* fetch all rows in a cursor and return them as a list *)
 let orafetchall sth =
   oci_sess_set_attr sth.parent_lda.lda oci_attr_action "orafetchall: starting";
-  let rs = orafetchall_ sth [] in
+  let rs = List.rev (orafold (fun acc row -> row :: acc) [] sth) in
   oci_sess_set_attr sth.parent_lda.lda oci_attr_action "orafetchall: done";
   rs
 
+(* LOBs - a Lob in a fetched row is a locator and the data is read through 
+   it a piece at a time, so a LOB of any size can be streamed in bounded 
+   memory. Positions and lengths are in characters for a CLOB and bytes for 
+   a BLOB, but the pieces read and written are always counted in bytes. 
+   Each read or write carries on from where the last one stopped *)
+let oralob_create_clob lda = oci_lob_create_temp lda.lda true
+let oralob_create_blob lda = oci_lob_create_temp lda.lda false
+let oralob_length lob = oci_lob_length lob
+let oralob_chunk_size lob = oci_lob_chunk_size lob
+let oralob_seek lob pos = oci_lob_seek lob pos
+let oralob_position lob = oci_lob_position lob
+let oralob_trim lob len = oci_lob_trim lob len
+
+(* fill as much of buf as one round-trip allows, returning the bytes read, 
+   0 at the end of the LOB *)
+let oralob_read_into lob buf = oci_lob_read lob buf 0 (Bytes.length buf)
+
+let oralob_piece_size lob = (oralob_chunk_size lob) * !oralobchunks_default
+
+(* the rest of a LOB as strings of up to size bytes, read as the sequence is 
+   consumed - so it can only be traversed once *)
+let oralob_seq ?size lob =
+  let size = match size with Some n -> max 1 n | None -> oralob_piece_size lob in
+  let buf = Bytes.create size in
+  let rec next () =
+    match oralob_read_into lob buf with
+      |0 -> Seq.Nil
+      |n -> Seq.Cons (Bytes.sub_string buf 0 n, next) in
+  next
+
+(* the whole LOB, from the start *)
+let oralob_to_string lob =
+  oralob_seek lob 0;
+  let b = Buffer.create (oralob_length lob) in
+  Seq.iter (Buffer.add_string b) (oralob_seq lob);
+  Buffer.contents b
+
+(* where to cut a piece of a CLOB so as not to split a UTF-8 character 
+   between two writes - in any other character set it is cut at the end *)
+let utf8_cut s =
+  let n = String.length s in
+  let rec back i =
+    if i < max 0 (n - 3) then n
+    else
+      let c = Char.code s.[i] in
+      if c land 0xc0 = 0x80 then back (i - 1)
+      else if c < 0xc0 then n
+      else
+	let len = if c >= 0xf0 then 4 else if c >= 0xe0 then 3 else 2 in
+	if i + len > n then i else n in
+  back (n - 1)
+
+(* write the strings in seq at the current position, gathered into pieces 
+   of size bytes (by default a whole number of chunks) so only one piece is 
+   held at a time, and return the bytes written *)
+let oralob_write_seq ?size lob seq =
+  let size = match size with Some n -> max 4 n | None -> oralob_piece_size lob in
+  let clob = oci_lob_is_clob lob in
+  let b = Buffer.create size in
+  let written = ref 0 in
+  let flush final =
+    let s = Buffer.contents b in
+    let cut = if final || not clob then String.length s else utf8_cut s in
+    if cut > 0 then written := !written + oci_lob_write lob s 0 cut;
+    Buffer.clear b;
+    Buffer.add_substring b s cut (String.length s - cut) in
+  Seq.iter (fun s ->
+    let rec add off =
+      if off < String.length s then begin
+	let n = min (String.length s - off) (size - Buffer.length b) in
+	Buffer.add_substring b s off n;
+	if Buffer.length b >= size then flush false;
+	add (off + n)
+      end in
+    add 0) seq;
+  flush true;
+  debug (sprintf "oralob_write_seq: wrote %d bytes" !written);
+  !written
+
 (* 0.2 functionality - object type AQ *)
 
-(* Get the TDO of the message type with global env, handles (already unpacked) and type name in 
-   UPPERCASE - returns a pointer to it in the OCI object cache *)
-let oci_get_tdo ge lda tn =
-  oci_get_tdo_ ge lda (String.uppercase tn)
+(* message types by (login, type name in UPPERCASE) - the TDOs are pinned in 
+   the environment's object cache for the life of the process, so every 
+   session of a login shares them, including each one taken from a pool *)
+let aq_types = sharded_create 16
+
+(* the TDO and payload layout of a message type, from the cache after the 
+   first time *)
+let aq_type lda message_type =
+  let tn = String.uppercase_ascii message_type in
+  match sharded_find_opt aq_types (lda.login, tn) with
+    |Some t -> t
+    |None ->
+      let tdo = oci_get_tdo_ global_env lda.lda tn in
+      let (kinds, offsets, null_offset, size) = 
+	if tn = "RAW" then ([||], [||], 0, 0) else oci_aq_layout global_env lda.lda tdo in
+      debug(sprintf "aq_type: %s has %d attributes, payload is %d bytes" tn (Array.length kinds) size);
+      let t = {aq_tdo = tdo; aq_kinds = kinds; aq_offsets = offsets; aq_null_offset = null_offset; aq_size = size} in
+      sharded_replace aq_types (lda.login, tn) t;
+      t
+
+(* forget every message type cached for this login, e.g. after replacing a 
+   type, so that each is looked up again when next used *)
+let oraaqtypes_flush lda =
+  sharded_filter_map_inplace (fun (login, _) t -> if login = lda.login then None else Some t) aq_types
+
+(* a type dropped and created again leaves its cached TDO stale, so an error 
+   saying the type is missing or does not match the queue drops the entry *)
+let aq_type_errors = [21700; 22303; 25215]
+
+let aq_type_check lda message_type f =
+  try f () with
+    |Oci_exception (e_code, _) as e when List.mem e_code aq_type_errors ->
+      debug (sprintf "aq_type: dropping %s after ORA-%05d" message_type e_code);
+      sharded_remove aq_types (lda.login, String.uppercase_ascii message_type);
+      raise e
 
 let oci_int_from_payload lda pa i =
   oci_int_from_number lda.lda pa i
@@ -601,114 +1796,130 @@ let oci_string_from_payload pa i =
   let sp = oci_read_ptr_at_offset pa i true in
   oci_string_from_string global_env sp
 
-let calculate_aq_message_size size_of_pointer size_of_number payload =
-  let total = ref 0 in
-  Array.iter (fun x ->
-    match x with
-      |Integer v -> total := (!total + size_of_number)
-      |Number  v -> total := (!total + size_of_number)
-      |Varchar v -> total := (!total + size_of_pointer)
-      |_ -> debug("This datatype not yet supported in AQ messages")
+let check_aq_payload t payload fn =
+  if Array.length payload <> Array.length t.aq_kinds then
+    raise (Invalid_argument (sprintf "%s: message has %d items, message type has %d attributes" fn (Array.length payload) (Array.length t.aq_kinds)))
+
+(* build an AQ message in one buffer, the payload followed by its null struct *)
+let build_aq_payload lda t payload = 
+  check_aq_payload t payload "oraenqueue";
+  let pa = oci_alloc_c_mem t.aq_size in
+  oci_write_ind pa t.aq_null_offset 0 0;                                       (* OCI_IND_NOTNULL for the object itself *)
+  Array.iteri (fun i x ->
+    let co = t.aq_offsets.(i) in
+    match (t.aq_kinds.(i), x) with
+      |(_, Null) -> oci_write_ind pa t.aq_null_offset (i + 1) (-1)             (* OCI_IND_NULL *)
+      |(0, Varchar v) ->
+	oci_write_ptr_at_offset pa co (oci_string_assign global_env lda.lda v); (* OCIString at this attribute's offset *)
+	oci_write_ind pa t.aq_null_offset (i + 1) 0
+      |(1, Integer n) ->
+	oci_write_int_at_offset lda.lda pa co n;                               (* copy the entire OCINumber into the payload *)
+	oci_write_ind pa t.aq_null_offset (i + 1) 0
+      |(1, Number n) ->
+	oci_write_flt_at_offset lda.lda pa co n;
+	oci_write_ind pa t.aq_null_offset (i + 1) 0
+      |_ -> raise (Invalid_argument (sprintf "oraenqueue: cannot enqueue %s as attribute %d" (orastring x) (i + 1)))
   ) payload;
-	!total
+  pa
 
 (* build and enqueue an AQ message *)
 let oraenqueue_obj lda queue_name message_type payload = 
-  let ps = oci_size_of_pointer () in                                           (* pointer size - for OCIString *)
-  let ns = oci_size_of_number () in                                            (* number size - for OCINumber *)
-  let ni = Array.length payload in                                             (* number of payload items *)
-  let pa = oci_alloc_c_mem (calculate_aq_message_size ps ns payload) in        (* payload array *)
-  let na = oci_alloc_c_mem ((ni + 1) * ps) in                                  (* null array - fixed size *)
-  let mt = oci_get_tdo global_env lda.lda message_type in                      (* message TDO pointer *)
-  let co = ref 0 in                                                            (* current offset *)
-  oci_constant_assign na 0 0;                                                  (* put OCI_IND_NOTNULL from oro.h at position 0 
-										  (TDO) in the null array *)
-  Array.iteri (fun i x ->
-    match x with
-      |Varchar v -> 
-	begin
-	  let s = oci_string_assign global_env lda.lda v in
-	  oci_write_ptr_at_offset pa !co s;                                    (* write OCIString at current offset in 
-										  payload array *)
-	  debug(sprintf "read back string '%s' at offset %d as '%s'" v !co (oci_string_from_payload pa !co));
-	  co := (!co + ps);                                                    (* increment the offset by the size of a 
-										  pointer *)
-	  oci_constant_assign na ((i + 1) * ps) 0                              (* write OCI_IND_NOTNULL at position i+1 in 
-										  the null array *)
-	end
-      |Integer n -> 
-	begin
-	  oci_write_int_at_offset lda.lda pa !co n;                        (* copy the entire OCINumber into the 
-										  payload *)
-	  debug(sprintf "read back int %d at offset %d as %d\n" n !co (oci_int_from_payload lda pa !co));
-	  co := (!co + ns);
-	  oci_constant_assign na ((i + 1) * ps) 0;
-	end
-      |Number n ->
-	begin
-	  oci_write_flt_at_offset lda.lda pa !co n;
-	  debug(sprintf "read back float %f at offset %d as %f\n" n !co (oci_flt_from_payload lda pa !co));
-	  co := (!co + ns);
-	  oci_constant_assign na ((i + 1) * ps) 0;
-	end
-      | _ -> oci_constant_assign na ((i + 1) * ps) (-1) (* OCI_IND_NULL *)
-  ) payload;
-  oci_aq_enqueue lda.lda queue_name mt pa na;
-  ()
+  let t = aq_type lda message_type in
+  let pa = build_aq_payload lda t payload in
+  oci_aq_enqueue lda.lda queue_name t.aq_tdo pa t.aq_null_offset
+
+(* read a dequeued message back, numbers as Integer where dummy_payload has an
+   Integer and as Number otherwise *)
+let decode_aq_payload lda t (pa, na) dummy_payload =
+  check_aq_payload t dummy_payload "oradequeue";
+  if oci_read_ind na 0 0 = -1 then Array.map (fun _ -> Null) dummy_payload else
+  Array.mapi (fun i x ->
+    let co = t.aq_offsets.(i) in
+    if oci_read_ind na 0 (i + 1) = -1 then Null else
+    match (t.aq_kinds.(i), x) with
+      |(0, _) -> Varchar (oci_string_from_payload pa co)
+      |(_, Integer _) -> Integer (oci_int_from_payload lda pa co)
+      |_ -> Number (oci_flt_from_payload lda pa co)
+  ) dummy_payload
 
 let oradequeue_obj lda queue_name message_type dummy_payload =
-  let ps = oci_size_of_pointer () in                                           (* pointer size - for OCIString *)
-  let ns = oci_size_of_number () in                                            (* number size - for OCINumber *)
-  let ni = Array.length dummy_payload in                                       (* number of payload items *)
-  let mt = oci_get_tdo global_env lda.lda message_type in                      (* message TDO pointer - should cache this in the lda *)
-  let co = ref 0 in                                                            (* current offset *)
-  let rv = Array.make ni Null in                                               (* array returned from function *)
-  let pa = oci_aq_dequeue global_env lda.lda queue_name mt lda.deq_timeout in  (* payload array *)
-  Array.iteri (fun i x -> 
-    match x with 
-      |Varchar z ->
-	begin
-	  debug(sprintf "oradequeue_obj: found Varchar, current offset is %d" !co);
-	  rv.(i) <- Varchar (oci_string_from_payload pa !co);
-	  co := (!co + ps);
-	  debug(sprintf "oradequeue_obj: dequeued string '%s'" (orastring rv.(i)))
-	  end
-      |Integer z ->
-	begin
-	  debug(sprintf "oradequeue_obj: found Integer, current offset is %d" !co);
-	  rv.(i) <- Integer (oci_int_from_payload lda pa !co);
-	  co := (!co + ns);
-	end
-      |Number z ->
-	begin
-	  rv.(i) <- Number (oci_flt_from_payload lda pa !co);
-	  co := (!co + ns);
-	end;
-      |_ -> debug("dequeue for this type not supported yet");
-    ) dummy_payload;
-  rv
+  let t = aq_type lda message_type in
+  decode_aq_payload lda t (oci_aq_dequeue global_env lda.lda queue_name t.aq_tdo lda.deq_timeout) dummy_payload
   
 let oraenqueue_raw lda queue_name message_type payload =
-  let mt = oci_get_tdo global_env lda.lda "RAW" in
+  let t = aq_type lda "RAW" in
   match payload.(0) with
-    |Binary b -> oci_aq_enqueue_raw global_env lda.lda queue_name mt b
+    |Binary b -> oci_aq_enqueue_raw global_env lda.lda queue_name t.aq_tdo b
     |_ -> raise (Invalid_argument "Cannot enqueue this message as RAW")
   
 let oraenqueue lda queue_name message_type payload =
-  match message_type with
-    |"RAW" -> oraenqueue_raw lda queue_name message_type payload
-    |_     -> oraenqueue_obj lda queue_name message_type payload
+  aq_type_check lda message_type (fun () ->
+    match message_type with
+      |"RAW" -> oraenqueue_raw lda queue_name message_type payload
+      |_     -> oraenqueue_obj lda queue_name message_type payload)
 
 let oradequeue_raw lda queue_name = 
-  let mt = oci_get_tdo global_env lda.lda "RAW" in
-  [|Binary (oci_aq_dequeue_raw global_env lda.lda queue_name mt lda.deq_timeout)|]
+  let t = aq_type lda "RAW" in
+  [|Binary (oci_aq_dequeue_raw global_env lda.lda queue_name t.aq_tdo lda.deq_timeout)|]
 
 let oradequeue lda queue_name message_type payload =
   debug(sprintf "oradequeue: queue_name='%s' message_type='%s'" queue_name message_type);
   try
+    aq_type_check lda message_type (fun () ->
+      match message_type with
+	|"RAW" -> oradequeue_raw lda queue_name
+	|_     -> oradequeue_obj lda queue_name message_type payload)
+  with
+      Oci_exception (e_code, e_desc) ->
+	match e_code with
+	  |25228 -> raise Not_found (* nothing on the queue and timeout set *)
+	  |_     -> raise (Oci_exception (e_code, e_desc))
+
+(* array AQ - a whole batch of messages in one round trip each way *)
+let oradeqarray_default = ref 100
+
+let oraenqueue_array lda queue_name message_type payloads =
+  debug(sprintf "oraenqueue_array: %d messages on '%s'" (Array.length payloads) queue_name);
+  aq_type_check lda message_type (fun () ->
     match message_type with
-      |"RAW" -> oradequeue_raw lda queue_name
-      |_     -> oradequeue_obj lda queue_name message_type payload
+      |"RAW" ->
+	let raws = Array.map (fun p ->
+	  match p.(0) with
+	    |Binary b -> b
+	    |_ -> raise (Invalid_argument "Cannot enqueue this message as RAW")) payloads in
+	let t = aq_type lda "RAW" in
+	ignore (oci_aq_enqueue_raw_array global_env lda.lda queue_name t.aq_tdo raws)
+      |_ ->
+	let t = aq_type lda message_type in
+	let built = Array.map (build_aq_payload lda t) payloads in
+	ignore (oci_aq_enqueue_array lda.lda queue_name t.aq_tdo built t.aq_null_offset))
+
+(* an error that came back with some messages is held until the next array 
+   dequeue from that queue, so those messages are not lost *)
+let aq_deq_result lda queue_name (msgs, e_code, e_desc) =
+  if e_code <> 0 then begin
+    debug(sprintf "oradequeue_array: %d messages from '%s' came with %s" (Array.length msgs) queue_name e_desc);
+    sharded_replace aq_deq_errors (lda.connection_id, queue_name) (e_code, e_desc)
+  end;
+  msgs
+
+(* dequeue up to max messages, waiting up to the dequeue timeout for the first
+   only and then taking whatever is on the queue *)
+let oradequeue_array lda ?(max = !oradeqarray_default) queue_name message_type payload =
+  debug(sprintf "oradequeue_array: up to %d messages from '%s' message_type='%s'" max queue_name message_type);
+  if max < 1 then raise (Invalid_argument "oradequeue_array: max must be at least 1");
+  try
+    (match sharded_find_opt aq_deq_errors (lda.connection_id, queue_name) with
+      |Some e -> sharded_remove aq_deq_errors (lda.connection_id, queue_name); raise (Oci_exception e)
+      |None -> ());
+    aq_type_check lda message_type (fun () ->
+      match message_type with
+	|"RAW" ->
+	  let t = aq_type lda "RAW" in
+	  Array.map (fun b -> [|Binary b|]) (aq_deq_result lda queue_name (oci_aq_dequeue_raw_array global_env lda.lda queue_name t.aq_tdo (lda.deq_timeout, max)))
+	|_ ->
+	  let t = aq_type lda message_type in
+	  Array.map (fun m -> decode_aq_payload lda t m payload) (aq_deq_result lda queue_name (oci_aq_dequeue_array global_env lda.lda queue_name t.aq_tdo (lda.deq_timeout, max))))
   with
       Oci_exception (e_code, e_desc) ->
 	match e_code with
@@ -749,116 +1960,135 @@ let rec orabindout sth bs cv =
 		let r = oci_alloc_statement global_env in 
 		Hashtbl.replace sth.ref_cursors bs r;
 		Hashtbl.replace sth.out_types bs cv;
-		(* bind r itself *)
-		oci_bind_ref_cursor sth.parent_lda.lda sth.sth bh p r;
+		(* bind r itself, keeping the callback context until the fetch *)
+		Hashtbl.replace sth.oci_ptrs bs (oci_bind_ref_cursor sth.parent_lda.lda sth.sth bh p r);
 	      end
 	    |_ -> debug("orabindout: this type not implemented yet")
 	end
       |Name n ->
-	let un = String.uppercase n in
-	let ucn = (match (String.sub un 0 1) with 
-	  |":" -> (String.sub un 1 ((String.length un) - 1))
-	  |_   -> un) in
-	orabindout sth (Pos (oci_get_pos_from_name sth.parent_lda.lda sth.sth ucn)) cv
+	orabindout sth (Pos (fst (resolve_bind_name sth n))) cv
   end;
   sth.binds <- (sth.binds + 1);
   sth.out_pending <- true;
   ()
 
-(* bulk DML implementation of orabindexec *)
-let orabindexec_bulk sth cval =
-  let batch_size = List.length cval in
-  let first_row = List.hd cval in
-  let num_cols = Array.length first_row in
-  debug (sprintf "orabindexec_bulk: batch_size=%d num_cols=%d" batch_size num_cols);
-  oci_sess_set_attr sth.parent_lda.lda oci_attr_action "orabindexec_bulk: running";
-  (* allocate bind handles for each position *)
-  Hashtbl.clear sth.bound_vals; Hashtbl.clear sth.oci_ptrs;
-  for i = 1 to num_cols do
-    Hashtbl.add sth.bound_vals (Pos i) (oci_alloc_bindhandle ())
-  done;
-  
-  (* get the sizes of each of the 4 types, and the longest string - since i am expecting
-     the bulk of the work to be on the Oracle side, the speedup of just assuming 4k is not
-     worth it in memory usage *)
-  let int_size = oci_size_of_int () in
-  let float_size = oci_size_of_float () in
-  let date_size = oci_size_of_date () in
-  let pointer_size = oci_size_of_pointer () in 
-  let string_size = ref 0 in
-  List.iter (fun item ->
-    Array.iter (fun member ->
-      match member with
-	|Varchar v ->
-	  let l = String.length v in
-	  if (l > !string_size) 
-	  then string_size := l
-	  else ()
-	|_ -> ()
-    ) item
-  ) cval;
-  
-  (* align the string size *)
-  string_size := ((!string_size/pointer_size) + 1) * pointer_size;
-  debug(sprintf "orabindexec_bulk: int_size=%d float_size=%d date_size(aligned)=%d string_size(aligned)=%d" int_size float_size date_size !string_size);
-
-  (* for each column, allocate enough storage for the batch *)
-  Array.iteri (fun i x -> 
-    Hashtbl.add sth.oci_ptrs (Pos (i + 1)) 
-      (oci_alloc_c_mem 
-	 (match x with
-	   |Integer _  -> batch_size * int_size
-	   |Number _   -> batch_size * float_size
-	   |Varchar _  -> batch_size * !string_size
-	   |Datetime _ -> batch_size * date_size
-	   |_ -> debug ("orabindexec_bulk: unknown type"); 0
-	 )
-      )
-  ) first_row;
-    
-  (* for each column in each row, get its oci_ptr from its bind spec, then 
-     write it at size*row_num bytes offset *)
-  let row_count = ref 0 in
-  List.iter (fun row -> 
-      Array.iteri (fun i x -> 
-	let ptr = (Hashtbl.find sth.oci_ptrs (Pos (i + 1))) in
-	match x with
-	  |Integer i  -> oci_write_nat_int_at_offset ptr (!row_count * int_size) i
-	  |Number n   -> oci_write_nat_flt_at_offset ptr (!row_count * float_size) n
-	  |Varchar v  -> oci_write_chr_at_offset ptr (!row_count * !string_size) v
-	  |Datetime d -> oci_write_odt_at_offset ptr (!row_count * date_size) (date_to_double d)
-	  |_ -> debug ("orabindexec_bulk: unknown type")
-	
-      ) row;
-    row_count := (!row_count +1);
-  ) cval;
-
-  (* bind each pointer to the corresponding bindhandle *)
-  Array.iteri (fun i x -> 
-    let bs = (Pos (i + 1)) in
-    let bh = Hashtbl.find sth.bound_vals bs in
-    let ptr = Hashtbl.find sth.oci_ptrs bs in
-    (match x with
-      |Integer _  -> oci_bind_bulk_int sth.parent_lda.lda sth.sth bh ptr (i + 1)
-      |Number _   -> oci_bind_bulk_flt sth.parent_lda.lda sth.sth bh ptr (i + 1)
-      |Varchar _  -> oci_bind_bulk_chr sth.parent_lda.lda sth.sth bh ptr (!string_size, (i + 1))
-      |Datetime _ -> oci_bind_bulk_odt sth.parent_lda.lda sth.sth bh ptr (date_size,  (i + 1))
-      |_ -> ());
-    debug(sprintf "orabindexec_bulk: done bind at position %d type %s" (i + 1) (match x with
-    |Integer _ -> "Integer"
-    |Number _ -> "Number"
-    |Varchar _ -> "Varchar"
-    |Datetime _ -> "Datetime"
-    |_ -> "Unknown"
-    )
-    )
-  ) first_row;
-
-  (* finally bulk execute *)
-  oci_bulk_exec sth.parent_lda.lda sth.sth batch_size sth.parent_lda.auto_commit;
-  sth.rows_affected <- oci_get_rows_affected sth.parent_lda.lda sth.sth;
-  oci_sess_set_attr sth.parent_lda.lda oci_attr_action "orabindexec_bulk: done";
-  ()
+(* bulk DML - each column is packed into a bind slot in a single call, and 
+   the slots stay bound to their positions so a second batch through the same 
+   statement only has to rebind a column whose buffer had to grow *)
+let bulk_column_length c = 
+  match c with
+    |Values a -> Array.length a
+    |Ints a -> Bigarray.Array1.dim a
+    |Floats a |Dates a -> Bigarray.Array1.dim a
+
+let bindexec_columns sth cols batch_errors =
+  let num_cols = Array.length cols in
+  let batch_size = if num_cols = 0 then 0 else bulk_column_length cols.(0) in
+  Array.iter (fun c -> 
+    if bulk_column_length c <> batch_size then
+      raise (Invalid_argument "orabindexec_columns: columns are not all the same length")) cols;
+  debug (sprintf "orabindexec_columns: batch_size=%d num_cols=%d" batch_size num_cols);
+  if batch_size = 0 then [||] else begin
+    oci_sess_set_attr sth.parent_lda.lda oci_attr_action "orabindexec_columns: running";
+    Array.iteri (fun i c -> 
+      let bs = Pos (i + 1) in
+      let slot = bind_slot sth bs in
+      if oci_pack_column slot c then
+	oci_bind_packed sth.parent_lda.lda sth.sth slot bs false
+    ) cols;
+    let errors = oci_bulk_exec sth.parent_lda.lda sth.sth batch_size sth.parent_lda.auto_commit batch_errors in
+    result_cache_after_exec sth.parent_lda sth.sql_type;
+    sth.rows_affected <- oci_get_rows_affected sth.parent_lda.lda sth.sth;
+    oci_sess_set_attr sth.parent_lda.lda oci_attr_action "orabindexec_columns: done";
+    errors
+  end
+
+let orabindexec_columns sth cols = ignore (bindexec_columns sth cols false)
+
+(* rows are turned into columns of Values and bound as above *)
+let rows_to_columns cval =
+  match cval with
+    |[] -> [||]
+    |first_row::_ ->
+      let rows = Array.of_list cval in
+      Array.init (Array.length first_row) (fun i -> Values (Array.map (fun row -> row.(i)) rows))
+
+let orabindexec_bulk sth cval = orabindexec_columns sth (rows_to_columns cval)
+
+(* as orabindexec, but rows that fail (e.g. a constraint violation) do not stop
+   the rest of the batch going in - returns (row, ORA code, message) for each 
+   failed row, counting rows from 0 in the order given *)
+let orabindexec_batch_errors sth cval = 
+  let errors = Array.to_list (bindexec_columns sth (rows_to_columns cval) true) in
+  List.iter (fun (row, _, msg) -> debug (sprintf "orabindexec_batch_errors: row %d failed: %s" row msg)) errors;
+  errors
+
+(* streaming bulk insert - rows are taken off the Seq a batch at a time and 
+   packed into one of two sets of bind slots while the previous batch executes
+   from the other, so at most two batches are held whatever the input size *)
+let orabulkload_batch_default = ref 1000
+
+(* up to n rows off the front of a Seq, and the rest of it *)
+let rec seq_take n s acc =
+  if n = 0 then (List.rev acc, s) else
+    match s () with
+      |Seq.Nil -> (List.rev acc, Seq.empty)
+      |Seq.Cons (x, rest) -> seq_take (n - 1) rest (x::acc)
+
+let orabulkload sth ?(batch = !orabulkload_batch_default) rows =
+  if batch < 1 then raise (Invalid_argument "orabulkload: batch must be at least 1");
+  let lda = sth.parent_lda.lda in
+  let sets = [|[||]; [||]|] in
+  let job = ref None in
+  let num_rows = ref 0 and num_batches = ref 0 in
+  let pack_time = ref 0.0 and wait_time = ref 0.0 in
+  let wait () = match !job with
+    |None -> ()
+    |Some j -> 
+      job := None;
+      let t = gettimeofday () in
+      oci_bulk_exec_wait lda j;
+      wait_time := !wait_time +. (gettimeofday () -. t) in
+  let rec load rows n =
+    let t = gettimeofday () in
+    match seq_take batch rows [] with
+      |([], _) -> ()
+      |(b, rest) ->
+	let cols = rows_to_columns b in
+	if Array.length sets.(n) = 0 then sets.(n) <- Array.map (fun _ -> oci_alloc_bind_slot ()) cols;
+	let slots = sets.(n) in
+	if Array.length slots <> Array.length cols then
+	  raise (Invalid_argument "orabulkload: rows are not all the same length");
+	Array.iteri (fun i c -> ignore (oci_pack_column slots.(i) c)) cols;
+	pack_time := !pack_time +. (gettimeofday () -. t);
+	(* the statement cannot be rebound until the other set is done with *)
+	wait ();
+	Array.iteri (fun i slot ->
+	  oci_bind_packed lda sth.sth slot (Pos (i + 1)) true;
+	  Hashtbl.replace sth.bind_slots (Pos (i + 1)) slot) slots;
+	job := Some (oci_bulk_exec_start lda sth.sth (List.length b) sth.parent_lda.auto_commit);
+	num_rows := !num_rows + List.length b;
+	incr num_batches;
+	load rest (1 - n) in
+  let t0 = gettimeofday () in
+  oci_sess_set_attr lda oci_attr_action "orabulkload: running";
+  (* batches already run were committed if auto_commit is set, even on error *)
+  (try 
+     load rows 0; 
+     wait ()
+   with e -> (try wait () with _ -> ()); result_cache_after_exec sth.parent_lda sth.sql_type; raise e);
+  result_cache_after_exec sth.parent_lda sth.sql_type;
+  oci_sess_set_attr lda oci_attr_action "orabulkload: done";
+  sth.rows_affected <- !num_rows;
+  let elapsed = gettimeofday () -. t0 in
+  debug (sprintf "orabulkload: %d rows in %d batches, %f secs packing, %f secs waiting" !num_rows !num_batches !pack_time !wait_time);
+  {load_rows = !num_rows; 
+   load_batches = !num_batches; 
+   load_time = elapsed; 
+   pack_time = !pack_time; 
+   wait_time = !wait_time; 
+   rows_per_sec = (if elapsed > 0.0 then float_of_int !num_rows /. elapsed else 0.0)}
+
 let orabindexec = orabindexec_bulk
 
 (* End of file *)
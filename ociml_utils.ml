@@ -22,9 +22,109 @@ let oci_sqlt_flt                = 4   (* floating point number *)
 let oci_sqlt_num                = 2   (* ORANET numeric *)
 let oci_sqlt_dat                = 12  (* Oracle 7-byte date *)
 let oci_sqlt_chr                = 1   (* ORANET character string *)
+let oci_sqlt_ibfloat            = 100 (* BINARY_FLOAT as described *)
+let oci_sqlt_ibdouble           = 101 (* BINARY_DOUBLE as described *)
+let oci_sqlt_clob               = 112 (* character LOB locator *)
+let oci_sqlt_blob               = 113 (* binary LOB locator *)
 
 (* function to return all the keys in a hashtable *)
 let hash_keys h = Hashtbl.fold (fun k v acc -> k::acc) h []
 let hash_vals h = Hashtbl.fold (fun k v acc -> v::acc) h []
 
+let with_lock m f =
+  Mutex.lock m;
+  match f () with
+    |r -> Mutex.unlock m; r
+    |exception e -> Mutex.unlock m; raise e
+
+(* a hashtable split into shards, each behind its own mutex, for state shared 
+   between domains - two domains only wait for each other when their keys 
+   land in the same shard *)
+type ('a, 'b) sharded = {shards:('a, 'b) Hashtbl.t array; 
+			 locks:Mutex.t array}
+
+let sharded_create ?(shards = 16) n =
+  {shards = Array.init shards (fun _ -> Hashtbl.create (max 1 (n / shards)));
+   locks = Array.init shards (fun _ -> Mutex.create ())}
+
+let with_shard t k f =
+  let i = (Hashtbl.hash k) mod (Array.length t.shards) in
+  with_lock t.locks.(i) (fun () -> f t.shards.(i))
+
+let sharded_add t k v = with_shard t k (fun h -> Hashtbl.add h k v)
+let sharded_replace t k v = with_shard t k (fun h -> Hashtbl.replace h k v)
+let sharded_remove t k = with_shard t k (fun h -> Hashtbl.remove h k)
+let sharded_find_opt t k = with_shard t k (fun h -> Hashtbl.find_opt h k)
+let sharded_find t k = match sharded_find_opt t k with Some v -> v |None -> raise Not_found
+
+(* as sharded_replace, but for a cache of at most size entries - a shard that
+   is full is emptied first *)
+let sharded_replace_capped t size k v =
+  with_shard t k (fun h ->
+    if Hashtbl.length h >= max 1 (size / (Array.length t.shards)) then Hashtbl.reset h;
+    Hashtbl.replace h k v)
+
+(* shards are locked one at a time, so this is not a snapshot of the whole table *)
+let sharded_fold f t acc =
+  let r = ref acc in
+  Array.iteri (fun i h -> with_lock t.locks.(i) (fun () -> r := Hashtbl.fold f h !r)) t.shards;
+  !r
+
+let sharded_filter_map_inplace f t =
+  Array.iteri (fun i h -> with_lock t.locks.(i) (fun () -> Hashtbl.filter_map_inplace f h)) t.shards
+
+let sharded_keys t = sharded_fold (fun k v acc -> k::acc) t []
+let sharded_vals t = sharded_fold (fun k v acc -> v::acc) t []
+
+(* a hashtable that drops its least recently used entries once their total 
+   cost is over a limit - each use takes a new tick, and the map from ticks 
+   to keys gives the order. Not locked, so callers sharing one must *)
+module IntMap = Map.Make (Int)
+
+type ('a, 'b) lru = {lru_tbl:('a, 'b * int * int) Hashtbl.t; (* value, cost and tick of last use *)
+		     mutable lru_order:'a IntMap.t;
+		     mutable lru_tick:int;
+		     mutable lru_cost:int}
+
+let lru_create n = {lru_tbl = Hashtbl.create n; lru_order = IntMap.empty; lru_tick = 0; lru_cost = 0}
+
+let lru_remove t k =
+  match Hashtbl.find_opt t.lru_tbl k with
+    |Some (_, cost, tick) ->
+      Hashtbl.remove t.lru_tbl k;
+      t.lru_order <- IntMap.remove tick t.lru_order;
+      t.lru_cost <- t.lru_cost - cost
+    |None -> ()
+
+let lru_find_opt t k =
+  match Hashtbl.find_opt t.lru_tbl k with
+    |Some (v, cost, tick) ->
+      t.lru_tick <- t.lru_tick + 1;
+      t.lru_order <- IntMap.add t.lru_tick k (IntMap.remove tick t.lru_order);
+      Hashtbl.replace t.lru_tbl k (v, cost, t.lru_tick);
+      Some v
+    |None -> None
+
+(* add or replace an entry, then evict down to limit - returns how many went *)
+let lru_add t limit k v cost =
+  lru_remove t k;
+  t.lru_tick <- t.lru_tick + 1;
+  Hashtbl.replace t.lru_tbl k (v, cost, t.lru_tick);
+  t.lru_order <- IntMap.add t.lru_tick k t.lru_order;
+  t.lru_cost <- t.lru_cost + cost;
+  let rec evict n =
+    match IntMap.min_binding_opt t.lru_order with
+      |Some (_, oldest) when t.lru_cost > limit -> lru_remove t oldest; evict (n + 1)
+      |_ -> n in
+  evict 0
+
+(* drop every entry f is true of, returning how many *)
+let lru_remove_if t f =
+  let ks = Hashtbl.fold (fun k (v, _, _) acc -> if f k v then k::acc else acc) t.lru_tbl [] in
+  List.iter (lru_remove t) ks;
+  List.length ks
+
+let lru_length t = Hashtbl.length t.lru_tbl
+let lru_cost t = t.lru_cost
+
 (* end of file *)
@@ -0,0 +1,91 @@
+(* Direct path loading - oci_dirpath.c. Rows are formatted into blocks on the
+   client and written straight into the table above its high water mark, so
+   they do not go through the SQL engine, redo (for NOLOGGING tables) or the
+   buffer cache. Columns are packed exactly as for orabindexec_columns. The
+   table is locked against other DML until oradpfinish or oradpabort *)
+
+open Unix
+open Printf
+open Ociml
+
+type oci_dirpath (* C struct holding the direct path context, column array and stream *)
+
+(* result of oradpfinish *)
+type dirpath_stats = {dp_rows:int;
+		      dp_batches:int;
+		      dp_time:float;
+		      dp_rows_per_sec:float}
+
+type dirpath = {dp_lda:meta_handle;
+		dp_table:string;
+		dp_cols:int;
+		dp_ctx:oci_dirpath;
+		dp_started:float;
+		mutable dp_loaded:int;
+		mutable dp_loads:int;
+		mutable dp_open:bool}
+
+external oci_dirpath_open: oci_handles -> string -> string -> string array -> int -> oci_dirpath = "caml_oci_dirpath_open"
+external oci_dirpath_load: oci_handles -> oci_dirpath -> bulk_column array -> unit = "caml_oci_dirpath_load"
+external oci_dirpath_finish: oci_handles -> oci_dirpath -> bool -> unit = "caml_oci_dirpath_finish" (* true to abort *)
+
+(* rows per column array, i.e. per conversion to a stream *)
+let oradprows_default = ref 1000
+
+(* start loading the named columns of a table, which may be given as
+   SCHEMA.TABLE *)
+let oradpopen lda ?(rows = !oradprows_default) table columns =
+  let (schema, tab) = try
+			let i = String.index table '.' in
+			(String.sub table 0 i, String.sub table (i + 1) (String.length table - i - 1))
+    with Not_found -> ("", table) in
+  debug (sprintf "oradpopen: loading %d columns into %s" (Array.length columns) table);
+  {dp_lda = lda;
+   dp_table = table;
+   dp_cols = Array.length columns;
+   dp_ctx = oci_dirpath_open lda.lda schema tab columns rows;
+   dp_started = gettimeofday ();
+   dp_loaded = 0;
+   dp_loads = 0;
+   dp_open = true}
+
+let check_open dp fn =
+  if not dp.dp_open then raise (Invalid_argument (sprintf "%s: direct path load into %s is finished" fn dp.dp_table))
+
+(* load a batch of columns, one per column given to oradpopen *)
+let oradpload dp cols =
+  check_open dp "oradpload";
+  if Array.length cols <> dp.dp_cols then
+    raise (Invalid_argument (sprintf "oradpload: expected %d columns, got %d" dp.dp_cols (Array.length cols)));
+  let batch_size = if dp.dp_cols = 0 then 0 else bulk_column_length cols.(0) in
+  Array.iter (fun c ->
+    if bulk_column_length c <> batch_size then
+      raise (Invalid_argument "oradpload: columns are not all the same length")) cols;
+  if batch_size > 0 then begin
+    oci_dirpath_load dp.dp_lda.lda dp.dp_ctx cols;
+    dp.dp_loaded <- dp.dp_loaded + batch_size;
+    dp.dp_loads <- dp.dp_loads + 1
+  end
+
+(* same, from rows as for orabindexec *)
+let oradploadrows dp rows = oradpload dp (rows_to_columns rows)
+
+(* make the loaded rows visible and rebuild indexes on the table *)
+let oradpfinish dp =
+  check_open dp "oradpfinish";
+  oci_dirpath_finish dp.dp_lda.lda dp.dp_ctx false;
+  dp.dp_open <- false;
+  let elapsed = gettimeofday () -. dp.dp_started in
+  debug (sprintf "oradpfinish: %d rows into %s in %f secs" dp.dp_loaded dp.dp_table elapsed);
+  {dp_rows = dp.dp_loaded;
+   dp_batches = dp.dp_loads;
+   dp_time = elapsed;
+   dp_rows_per_sec = (if elapsed > 0.0 then float_of_int dp.dp_loaded /. elapsed else 0.0)}
+
+(* throw away everything loaded since oradpopen *)
+let oradpabort dp =
+  check_open dp "oradpabort";
+  oci_dirpath_finish dp.dp_lda.lda dp.dp_ctx true;
+  dp.dp_open <- false
+
+(* End of file *)
@@ -37,7 +37,7 @@ class report (header : string array) =
       
     (** Generate the report to STDOUT @param chan an optional out_channel *)
     method print_report =
-      fun ?(chan = Pervasives.stdout) () ->
+      fun ?(chan = Stdlib.stdout) () ->
         (self#print_row chan header;
          self#print_row chan
            (Array.init (Array.length widths)
@@ -117,6 +117,27 @@ let test_bulk_insert_performance rows batchsize () =
   oralogoff lda;
   Time (t2, float_of_int rows /. t2)
 
+(* same again but streamed through orabulkload, with the rows generated as 
+   they are needed rather than up front *)
+let test_bulkload_performance rows batchsize () =
+  let rec gen n () = if n > rows then Seq.Nil else Seq.Cons (rand_row n test_dt_list, gen (n + 1)) in
+  let lda = oralogon "ociml_test/ociml_test" in
+  let sth = oraopen lda in
+  orasql sth "truncate table tab1";
+  oraparse sth ("insert into tab1 values (" ^ (get_bind_vars test_dt_list) ^ ")");
+  let stats = orabulkload sth ~batch:batchsize (gen 1) in
+  oracommit lda;
+  oralogoff lda;
+  Time (stats.load_time, stats.rows_per_sec)
+
+(* connections per second, one at a time or all at once *)
+let test_logon_performance n parallel () =
+  let t1 = gettimeofday () in
+  let ldas = if parallel then oralogon_many "ociml_test/ociml_test" n
+    else Array.init n (fun _ -> oralogon "ociml_test/ociml_test") in
+  let t2 = gettimeofday () -. t1 in
+  Array.iter oralogoff ldas;
+  Time (t2, float_of_int n /. t2)
 
 let test_prefetch_performance batchsize () =
   let lda = oralogon "ociml_test/ociml_test" in
@@ -129,6 +150,63 @@ let test_prefetch_performance batchsize () =
   oralogoff lda;
   Time (t2, float_of_int (List.length rs) /. t2)
 
+let test_batch_fetch_performance batchsize () =
+  let lda = oralogon "ociml_test/ociml_test" in
+  let sth = oraopen lda in
+  let t1 = gettimeofday() in
+  orasql sth "select * from tab1";
+  let rows = ref 0 in
+  (try
+     while true do
+       rows := !rows + Array.length (orafetch_batch sth batchsize)
+     done
+   with Not_found -> ());
+  let t2 = gettimeofday () -. t1 in
+  oralogoff lda;
+  Time (t2, float_of_int !rows /. t2)
+
+(* the same fetch on each of n connections at once, one thread each - with the
+   runtime released during round-trips the rate should scale with n *)
+let test_threaded_fetch_performance threads batchsize () =
+  let ldas = oralogon_many "ociml_test/ociml_test" threads in
+  let rows = Array.make threads 0 in
+  let worker i =
+    let sth = oraopen ldas.(i) in
+    orasql sth "select * from tab1";
+    (try
+       while true do
+	 rows.(i) <- rows.(i) + Array.length (orafetch_batch sth batchsize)
+       done
+     with Not_found -> ());
+    oraclose sth in
+  let t1 = gettimeofday () in
+  let ts = Array.init threads (fun i -> Thread.create worker i) in
+  Array.iter Thread.join ts;
+  let t2 = gettimeofday () -. t1 in
+  Array.iter oralogoff ldas;
+  Time (t2, float_of_int (Array.fold_left (+) 0 rows) /. t2)
+
+(* the same again with a domain per connection rather than a thread *)
+let test_domain_fetch_performance domains batchsize () =
+  let ldas = oralogon_many "ociml_test/ociml_test" domains in
+  let worker lda () =
+    let sth = oraopen lda in
+    let rows = ref 0 in
+    orasql sth "select * from tab1";
+    (try
+       while true do
+	 rows := !rows + Array.length (orafetch_batch sth batchsize)
+       done
+     with Not_found -> ());
+    oraclose sth;
+    !rows in
+  let t1 = gettimeofday () in
+  let ds = Array.map (fun lda -> Domain.spawn (worker lda)) ldas in
+  let rows = Array.fold_left (fun acc d -> acc + Domain.join d) 0 ds in
+  let t2 = gettimeofday () -. t1 in
+  Array.iter oralogoff ldas;
+  Time (t2, float_of_int rows /. t2)
+
 (* test that we can insert a row, issue a rollback, and that row isn't there anymore *)
 let test_transactions_rollback () =
   try
@@ -189,6 +267,620 @@ let test_bind_by_name_and_pos () =
     Oci_exception (e_code, e_desc) -> Fail e_desc
 
 
+(* the same rows should come back from orafold, oraiter, oraseq and orafetchall *)
+let test_streaming_fetch () =
+  try
+    let lda = oralogon "ociml_test/ociml_test" in
+    let sth = oraopen lda in
+    orasql sth "truncate table tab1";
+    oraparse sth ("insert into tab1 values (" ^ (get_bind_vars test_dt_list) ^ ")");
+    orabindexec sth (rand_big_dataset test_dt_list 25);
+    oracommit lda;
+    orafetchrows sth 7; (* not a divisor of the row count, to cross batch boundaries *)
+    orasql sth "select * from tab1";
+    let folded = orafold (fun n _ -> n + 1) 0 sth in
+    orasql sth "select * from tab1";
+    let iterated = ref 0 in
+    oraiter (fun _ -> incr iterated) sth;
+    orasql sth "select * from tab1";
+    let streamed = Seq.fold_left (fun n _ -> n + 1) 0 (oraseq sth) in
+    orasql sth "select * from tab1";
+    let all = List.length (orafetchall sth) in
+    oralogoff lda;
+    match (folded, !iterated, streamed, all) with
+    |(25, 25, 25, 25) -> Pass
+    |_ -> Fail (sprintf "fold=%d iter=%d seq=%d fetchall=%d" folded !iterated streamed all)
+  with
+    Oci_exception (e_code, e_desc) -> Fail e_desc
+
+(* the PKs are 1..25 so sum them back out of the Bigarrays a batch at a time *)
+let test_columnar_fetch () =
+  try
+    let lda = oralogon "ociml_test/ociml_test" in
+    let sth = oraopen lda in
+    orasql sth "truncate table tab1";
+    oraparse sth ("insert into tab1 values (" ^ (get_bind_vars test_dt_list) ^ ")");
+    orabindexec sth (rand_big_dataset test_dt_list 25);
+    oracommit lda;
+    orasql sth "select col0, col0 / 2, sysdate from tab1";
+    let ints = ref 0L and halves = ref 0.0 and dates = ref 0 in
+    (try
+       while true do
+	 let b = orafetch_columnar sth 7 in
+	 for i = 0 to b.batch_rows - 1 do
+	   (match b.columns.(0) with Int_col a -> ints := Int64.add !ints a.{i} |_ -> ());
+	   (match b.columns.(1) with Float_col a -> halves := !halves +. a.{i} |_ -> ());
+	   (match b.columns.(2) with Date_col a when a.{i} > 0.0 -> incr dates |_ -> ())
+	 done
+       done
+     with Not_found -> ());
+    oralogoff lda;
+    match (!ints, !halves, !dates) with
+    |(325L, 162.5, 25) -> Pass
+    |_ -> Fail (sprintf "ints=%Ld halves=%f dates=%d" !ints !halves !dates)
+  with
+    Oci_exception (e_code, e_desc) -> Fail e_desc
+
+(* same query with and without native defines, plus an integer past 32 bits *)
+let test_native_numbers () =
+  try
+    let lda = oralogon "ociml_test/ociml_test" in
+    let sth = oraopen lda in
+    (* the last column is past max_int, so NULL either way rather than wrapped *)
+    let sql = "select col0, col0 / 4, cast(1099511627776 + col0 as integer), cast(4611686018427387904 + col0 as integer) from tab1 order by col0" in
+    orasql sth sql;
+    let converted = orafetchall sth in
+    oranativenum sth true;
+    orasql sth sql;
+    let native = orafetchall sth in
+    oralogoff lda;
+    match (converted = native, native) with
+    |(true, [|Integer 1; Number 0.25; Integer 1099511627777; Null|] :: _) -> Pass
+    |(false, _) -> Fail "native and OCINumber fetches differ"
+    |_ -> Fail "unexpected first row"
+  with
+    Oci_exception (e_code, e_desc) -> Fail e_desc
+
+(* oradesc of the test table, the second time through the statement cache *)
+let test_oradesc () =
+  try
+    let lda = oralogon "ociml_test/ociml_test" in
+    let first = oradesc lda "tab1" in
+    let second = oradesc lda "tab1" in
+    oralogoff lda;
+    let names = Array.to_list (Array.map (fun (col_name, _, _, _) -> col_name) first) in
+    let expected = List.mapi (fun i _ -> sprintf "COL%d" i) test_dt_list in
+    match (names = expected, first = second) with
+    |(true, true) -> Pass
+    |(n, s) -> Fail (sprintf "names as expected %b, same the second time %b" n s)
+  with
+    Oci_exception (e_code, e_desc) -> Fail e_desc
+
+(* the second parse is defined from the describe cache, the third must notice 
+   that the table has grown a column since, and the fourth that a column has 
+   been widened with the column count unchanged *)
+let test_describe_cache () =
+  try
+    let lda = oralogon "ociml_test/ociml_test" in
+    let sth = oraopen lda in
+    (try orasql sth "drop table tab_desc" with Oci_exception _ -> ());
+    orasql sth "create table tab_desc (a integer)";
+    orasql sth "insert into tab_desc values (1)";
+    let sql = "select * from tab_desc" in
+    orasql sth sql;
+    let first = orafetch sth in
+    orasql sth sql;
+    let cached = orafetch sth in
+    orasql sth "alter table tab_desc add (b varchar2(10) default 'x')";
+    orasql sth sql;
+    let grown = orafetch sth in
+    orasql sth "alter table tab_desc modify (b varchar2(100))";
+    orasql sth "update tab_desc set b = rpad('y', 50, 'y')";
+    orasql sth sql;
+    let widened = orafetch sth in
+    orasql sth "drop table tab_desc";
+    oralogoff lda;
+    match (first, cached, grown, widened) with
+    |([|Integer 1|], [|Integer 1|], [|Integer 1; Varchar "x"|], [|Integer 1; Varchar w|]) when w = String.make 50 'y' -> Pass
+    |_ -> Fail (sprintf "got %d, %d, %d and %d columns, last row %s" (Array.length first) (Array.length cached) (Array.length grown)
+		  (Array.length widened) (String.concat "," (Array.to_list (Array.map orastring widened))))
+  with
+    Oci_exception (e_code, e_desc) -> Fail e_desc
+
+(* re-parsing the same SQL should be served by the statement cache and still 
+   fetch correctly with the defines it kept *)
+let test_stmt_cache () =
+  try
+    let lda = oralogon "ociml_test/ociml_test" in
+    orastmtcache lda 10;
+    let sth = oraopen lda in
+    let run () = orasql sth "select 42, 'x' from dual"; orafetch sth in
+    let r1 = run () in
+    ignore (orasql sth "select sysdate from dual");
+    let r2 = run () in
+    let r3 = run () in
+    let (hits, misses) = (lda.stmt_cache_hits, lda.stmt_cache_misses) in
+    oraclose sth;
+    oralogoff lda;
+    match (r1 = r2 && r2 = r3, hits, misses) with
+    |(true, 2, 2) -> Pass
+    |(false, _, _) -> Fail "rows differ between cached parses"
+    |_ -> Fail (sprintf "hits=%d misses=%d" hits misses)
+  with
+    Oci_exception (e_code, e_desc) -> Fail e_desc
+
+(* a cached statement last defined into Bigarrays must be defined again when 
+   it comes back for orafetch, not pointed at the buffers saved before *)
+let test_stmt_cache_columnar () =
+  try
+    let lda = oralogon "ociml_test/ociml_test" in
+    orastmtcache lda 10;
+    let sth = oraopen lda in
+    let sql = "select 42, 43 from dual" in
+    let run () = orasql sth sql; orafetch sth in
+    let r1 = run () in
+    orasql sth "select sysdate from dual";
+    orasql sth sql;
+    let batch = orafetch_columnar sth 10 in
+    orasql sth "select sysdate from dual";
+    Gc.full_major ();
+    let r2 = run () in
+    oraclose sth;
+    oralogoff lda;
+    match (r1 = r2, batch.batch_rows) with
+    |(true, 1) -> Pass
+    |(false, _) -> Fail "rows differ after a columnar fetch"
+    |(_, n) -> Fail (sprintf "columnar fetch got %d rows" n)
+  with
+    Oci_exception (e_code, e_desc) -> Fail e_desc
+
+(* parse once and execute many times, with values that change length and type
+   so that the bind slots have to grow and rebind between executes *)
+let test_rebind_in_place () =
+  try
+    let lda = oralogon "ociml_test/ociml_test" in
+    let sth = oraopen lda in
+    orasql sth "truncate table tab1";
+    oraparse sth ("insert into tab1 values (" ^ (get_bind_vars test_dt_list) ^ ")");
+    let rows = List.map (fun n -> rand_row n test_dt_list) [1; 2; 3; 4; 5] in
+    List.iter (fun r -> Array.iteri (fun i x -> orabind sth (Pos (i + 1)) x) r; oraexec sth) rows;
+    oracommit lda;
+    oraparse sth "select * from tab1 where col0 = :1";
+    let fetched = List.map (fun n -> orabind sth (Name "1") (Integer n); oraexec sth; orafetch sth) [1; 2; 3; 4; 5] in
+    oralogoff lda;
+    match List.for_all2 (===) rows fetched with
+    |true -> Pass
+    |false -> Fail "rows differ after rebinding"
+  with
+    Oci_exception (e_code, e_desc) -> Fail e_desc
+
+(* two batches through the same parse, the second with longer strings and 
+   with NULLs scattered through both, then a batch straight from a Bigarray *)
+let test_bulk_columns () =
+  try
+    let lda = oralogon "ociml_test/ociml_test" in
+    let sth = oraopen lda in
+    orasql sth "truncate table tab1";
+    oraparse sth ("insert into tab1 values (" ^ (get_bind_vars test_dt_list) ^ ")");
+    let with_nulls r = Array.mapi (fun i x -> if i > 0 && (i + (match r.(0) with Integer n -> n |_ -> 0)) mod 3 = 0 then Null else x) r in
+    let batch1 = List.map with_nulls (rand_big_dataset test_dt_list 5) in
+    let batch2 = List.map (fun r -> with_nulls (rand_row r test_dt_list)) [6; 7; 8; 9; 10] in
+    orabindexec sth batch1;
+    orabindexec sth batch2;
+    oraparse sth "insert into tab1 (col0) values (:1)";
+    orabindexec_columns sth [|Ints (Bigarray.Array1.of_array Bigarray.int64 Bigarray.c_layout [|11L; 12L; 13L|])|];
+    oracommit lda;
+    orasql sth "select * from tab1 where col0 <= 10 order by col0";
+    let fetched = orafetchall sth in
+    orasql sth "select count(*) from tab1 where col0 > 10";
+    let extra = orafetch sth in
+    oralogoff lda;
+    match (List.for_all2 (===) (batch1 @ batch2) fetched, extra) with
+    |(true, [|Integer 3|]) -> Pass
+    |(false, _) -> Fail "rows differ after bulk insert"
+    |_ -> Fail "Bigarray batch not inserted"
+  with
+    Oci_exception (e_code, e_desc) -> Fail e_desc
+
+(* bound lengths are ub2, so a longer string must be refused rather than 
+   silently truncated *)
+let test_long_bind () =
+  try
+    let lda = oralogon "ociml_test/ociml_test" in
+    let sth = oraopen lda in
+    oraparse sth "insert into tab1 (col0, col1) values (:1, :2)";
+    let long = Varchar (String.make 70000 'x') in
+    let single = (try orabind sth (Pos 2) long; false with Invalid_argument _ -> true) in
+    let bulk = (try orabindexec sth [[|Integer 1; Varchar "x"|]; [|Integer 2; long|]]; false with Invalid_argument _ -> true) in
+    oraroll lda;
+    oralogoff lda;
+    match (single, bulk) with
+    |(true, true) -> Pass
+    |_ -> Fail "long string was bound"
+  with
+    Oci_exception (e_code, e_desc) -> Fail e_desc
+
+(* a duplicate primary key in the middle of a batch should be reported for 
+   that row alone, with the rows either side of it inserted *)
+let test_batch_errors () =
+  try
+    let lda = oralogon "ociml_test/ociml_test" in
+    let sth = oraopen lda in
+    orasql sth "truncate table tab1";
+    oraparse sth ("insert into tab1 values (" ^ (get_bind_vars test_dt_list) ^ ")");
+    let rows = List.map (fun n -> rand_row n test_dt_list) [1; 2; 1; 3] in
+    let errors = orabindexec_batch_errors sth rows in
+    oracommit lda;
+    orasql sth "select count(*) from tab1";
+    let count = orafetch sth in
+    oralogoff lda;
+    match (errors, count) with
+    |([(2, 1, _)], [|Integer 3|]) -> Pass
+    |_ -> Fail (sprintf "%d rows failed, %s inserted" (List.length errors) (orastring count.(0)))
+  with
+    Oci_exception (e_code, e_desc) -> Fail e_desc
+
+(* a Seq that does not divide into whole batches, so the last one is short *)
+let test_bulkload () =
+  try
+    let lda = oralogon "ociml_test/ociml_test" in
+    let sth = oraopen lda in
+    orasql sth "truncate table tab1";
+    oraparse sth ("insert into tab1 values (" ^ (get_bind_vars test_dt_list) ^ ")");
+    let stats = orabulkload sth ~batch:7 (List.to_seq (rand_big_dataset test_dt_list 25)) in
+    oracommit lda;
+    orasql sth "select count(*), sum(col0) from tab1";
+    let r = orafetch sth in
+    oralogoff lda;
+    match (stats.load_rows, stats.load_batches, r) with
+    |(25, 4, [|Integer 25; Integer 325|]) -> Pass
+    |_ -> Fail (sprintf "%d rows in %d batches" stats.load_rows stats.load_batches)
+  with
+    Oci_exception (e_code, e_desc) -> Fail e_desc
+
+(* direct path, in two batches of uneven size with one column from a Bigarray *)
+let test_dirpath () =
+  try
+    let lda = oralogon "ociml_test/ociml_test" in
+    let sth = oraopen lda in
+    orasql sth "truncate table tab1";
+    let names = Array.of_list (List.mapi (fun i _ -> "COL" ^ string_of_int i) test_dt_list) in
+    let dp = Oradirpath.oradpopen lda ~rows:8 "tab1" names in
+    Oradirpath.oradploadrows dp (rand_big_dataset test_dt_list 20);
+    let cols = rows_to_columns (List.map (fun r -> rand_row r test_dt_list) [21; 22; 23; 24; 25]) in
+    cols.(0) <- Ints (Bigarray.Array1.of_array Bigarray.int64 Bigarray.c_layout [|21L; 22L; 23L; 24L; 25L|]);
+    Oradirpath.oradpload dp cols;
+    let stats = Oradirpath.oradpfinish dp in
+    orasql sth "select count(*), sum(col0) from tab1";
+    let r = orafetch sth in
+    oralogoff lda;
+    match (stats.Oradirpath.dp_rows, r) with
+    |(25, [|Integer 25; Integer 325|]) -> Pass
+    |_ -> Fail (sprintf "%d rows loaded" stats.Oradirpath.dp_rows)
+  with
+    Oci_exception (e_code, e_desc) -> Fail e_desc
+
+(* local times every 20 minutes through both DST changes of 2012, with some 
+   fields out of range, should come out as Unix.mktime has them - both bound 
+   alone as an epoch and packed in bulk as a DATE *)
+let test_dst_binds () =
+  try
+    let tms = List.concat_map (fun (mon, day) ->
+      List.init 216 (fun i -> 
+	{tm_sec = 7; tm_min = (i mod 3) * 20; tm_hour = (i / 3) - 1; tm_mday = day; tm_mon = mon; tm_year = 112;
+	 tm_wday = 0; tm_yday = 0; tm_isdst = false})) [(2, 24); (9, 27); (11, 31)] in
+    let same_epochs = List.for_all (fun tm -> date_to_double tm = fst (mktime tm)) tms in
+    let lda = oralogon "ociml_test/ociml_test" in
+    let sth = oraopen lda in
+    (try orasql sth "drop table tab_dst" with Oci_exception _ -> ());
+    orasql sth "create table tab_dst (a integer, d date)";
+    oraparse sth "insert into tab_dst values (:1, :2)";
+    orabindexec sth (List.mapi (fun i tm -> [|Integer i; Datetime tm|]) tms);
+    orasql sth "select d from tab_dst order by a";
+    let fetched = orafetchall sth in
+    orasql sth "drop table tab_dst";
+    oralogoff lda;
+    let same_dates = List.for_all2 (fun tm row ->
+      match row with
+	|[|Datetime d|] -> d = localtime (fst (mktime tm))
+	|_ -> false) tms fetched in
+    match (same_epochs, same_dates) with
+    |(true, true) -> Pass
+    |(false, _) -> Fail "epochs differ from Unix.mktime"
+    |(_, false) -> Fail "bulk bound dates differ from Unix.mktime"
+  with
+    Oci_exception (e_code, e_desc) -> Fail e_desc
+
+(* the same DATEs fetched as Datetime and as epoch should agree, including 
+   either side of a DST change *)
+let test_epoch_dates () =
+  try
+    let lda = oralogon "ociml_test/ociml_test" in
+    let sth = oraopen lda in
+    let sql = "select sysdate, to_date('2012-03-25 00:59:59', 'YYYY-MM-DD HH24:MI:SS'), to_date('2012-10-28 02:30:00', 'YYYY-MM-DD HH24:MI:SS') from dual" in
+    orasql sth sql;
+    let tms = orafetch sth in
+    oraepochdates sth true;
+    orasql sth sql;
+    let epochs = orafetch sth in
+    oralogoff lda;
+    match List.for_all2 (fun t e -> match (t, e) with
+      |(Datetime tm, Number ep) -> localtime ep = tm
+      |_ -> false) (Array.to_list tms) (Array.to_list epochs) with
+    |true -> Pass
+    |false -> Fail "Datetime and epoch differ"
+  with
+    Oci_exception (e_code, e_desc) -> Fail e_desc
+
+(* a second session from a pool of 2 is new and gets the warmup SQL, the
+   first one back out again is already warm *)
+let test_session_pool () =
+  try
+    let pool = orapool_create ~min:1 ~max:2 ~warmup:["select count(1) from dual"] "ociml_test/ociml_test" in
+    let l1 = orapool_acquire pool in
+    let l2 = orapool_acquire ~ping:true pool in
+    let busy = (orapool_stats pool).ps_busy in
+    orapool_release l1;
+    oralogoff l2;
+    let l3 = orapool_acquire pool in
+    let sth = oraopen l3 in
+    orasql sth "select count(1) from dual";
+    let r = orafetch sth in
+    orapool_release l3;
+    let stats = orapool_stats pool in
+    orapool_destroy pool;
+    match (busy, stats.ps_busy, stats.ps_acquires, stats.ps_new_sessions, r) with
+    |(2, 0, 3, 2, [|Integer 1|]) -> Pass
+    |_ -> Fail (sprintf "%d busy, %d acquires, %d new sessions" busy stats.ps_acquires stats.ps_new_sessions)
+  with
+    Oci_exception (e_code, e_desc) -> Fail e_desc
+
+(* all the connections should be usable, and each should be separate *)
+let test_logon_many () =
+  try
+    let ldas = oralogon_many "ociml_test/ociml_test" 4 in
+    let sids = Array.map (fun lda ->
+      let sth = oraopen lda in
+      orasql sth "select sys_context('USERENV', 'SID') from dual";
+      let r = orafetch sth in
+      oraclose sth;
+      r.(0)) ldas in
+    Array.iter oralogoff ldas;
+    let distinct = List.length (List.sort_uniq compare (Array.to_list sids)) in
+    match (Array.length ldas, distinct, Array.for_all (fun l -> l.lda_op_time > 0.0) ldas) with
+    |(4, 4, true) -> Pass
+    |_ -> Fail (sprintf "%d connections, %d sessions" (Array.length ldas) distinct)
+  with
+    Oci_exception (e_code, e_desc) -> Fail e_desc
+
+(* a bad password should fail the lot *)
+let test_logon_many_fail () =
+  try
+    let _ = oralogon_many "ociml_test/wrong_password" 4 in
+    Fail "logged on with the wrong password"
+  with
+    Oci_exception (1017, _) -> Pass
+  | Oci_exception (e_code, e_desc) -> Fail e_desc
+
+(* one connection per domain, each opening and closing statements at the same 
+   time - ids should not collide and nothing should be left registered *)
+let test_domains () =
+  try
+    let work () =
+      let lda = oralogon "ociml_test/ociml_test" in
+      let ids = List.init 50 (fun _ ->
+	let sth = oraopen lda in
+	orasql sth "select count(1) from dual";
+	ignore (orafetch sth);
+	oraclose sth;
+	sth.statement_id) in
+      let left = List.length (orasthlist lda) in
+      oralogoff lda;
+      (lda.connection_id, ids, left) in
+    let rs = List.map Domain.join (List.init 4 (fun _ -> Domain.spawn work)) in
+    let ldas = List.sort_uniq compare (List.map (fun (c, _, _) -> c) rs) in
+    let sths = List.sort_uniq compare (List.concat_map (fun (_, ids, _) -> ids) rs) in
+    let left = List.fold_left (fun acc (_, _, l) -> acc + l) 0 rs in
+    let still_open = List.filter (fun l -> List.mem l.connection_id ldas) (oraldalist ()) in
+    match (List.length ldas, List.length sths, left, still_open) with
+    |(4, 200, 0, []) -> Pass
+    |(c, s, l, _) -> Fail (sprintf "%d connections, %d statements, %d left open" c s l)
+  with
+    Oci_exception (e_code, e_desc) -> Fail e_desc
+
+(* the same query run on two connections at once from one thread, fetched 
+   a row at a time through the async calls, should match the blocking fetch *)
+let test_async () =
+  try
+    let ldas = oralogon_many "ociml_test/ociml_test" 2 in
+    let sths = Array.map oraopen ldas in
+    Array.iter (fun sth -> oraparse sth "select * from tab1 order by 1") sths;
+    ignore (oraawait_all (Array.to_list (Array.map oraexec_async sths)));
+    let rec fetch_all sth acc =
+      match oraawait (orafetch_async sth) with
+	|Some row -> fetch_all sth (row::acc)
+	|None -> List.rev acc in
+    let r1 = fetch_all sths.(0) [] and r2 = fetch_all sths.(1) [] in
+    oraawait (oracommit_async ldas.(0));
+    orasql sths.(1) "select * from tab1 order by 1";
+    let r3 = orafetchall sths.(1) in
+    let commits = ldas.(0).commits in
+    Array.iter oralogoff ldas;
+    match (r1 = r2, r2 = r3, commits) with
+    |(true, true, 1) -> Pass
+    |_ -> Fail (sprintf "%d, %d and %d rows, %d commits" (List.length r1) (List.length r2) (List.length r3) commits)
+  with
+    Oci_exception (e_code, e_desc) -> Fail e_desc
+
+(* a cancelled query cannot be polled again, and leaves the statement and its
+   connection free to run the next one *)
+let test_async_cancel () =
+  try
+    let lda = oralogon "ociml_test/ociml_test" in
+    let sth = oraopen lda in
+    oraparse sth "select count(*) from all_objects a, all_objects b, all_objects c";
+    let a = oraexec_async sth in
+    oracancel a;
+    let cancelled = (try ignore (orapoll a); false with Invalid_argument _ -> true) in
+    orasql sth "select 1 from dual";
+    let r = orafetchall sth in
+    oralogoff lda;
+    match (cancelled, r) with
+    |(true, [[|Integer 1|]]) -> Pass
+    |(false, _) -> Fail "polled again after the cancel"
+    |_ -> Fail (sprintf "%d rows after the cancel" (List.length r))
+  with
+    Oci_exception (e_code, e_desc) -> Fail e_desc
+
+(* a CLOB and a BLOB built up from temporary LOBs in small pieces should read 
+   back the same, both streamed and whole *)
+let test_lob () =
+  try
+    let lda = oralogon "ociml_test/ociml_test" in
+    let sth = oraopen lda in
+    (try orasql sth "drop table tab_lob" with Oci_exception _ -> ());
+    orasql sth "create table tab_lob (c clob, b blob)";
+    let cat = slurp_file "lynx.jpg" in
+    let text = String.concat "\n" (List.init 1000 (sprintf "line %d")) in
+    let pieces s n = List.to_seq (List.init ((String.length s + n - 1) / n) (fun i -> String.sub s (i * n) (min n (String.length s - i * n)))) in
+    let c = oralob_create_clob lda and b = oralob_create_blob lda in
+    let written = (oralob_write_seq ~size:1000 c (pieces text 333), oralob_write_seq b (pieces cat 1000)) in
+    oraparse sth "insert into tab_lob values (:1, :2)";
+    orabind sth (Pos 1) (Lob c);
+    orabind sth (Pos 2) (Lob b);
+    oraexec sth;
+    orasql sth "select c, b from tab_lob";
+    let (c2, b2) = match orafetch sth with
+      |[|Lob c; Lob b|] -> (c, b)
+      |_ -> raise (Failure "not fetched as LOBs") in
+    let streamed = String.concat "" (List.of_seq (oralob_seq ~size:1000 b2)) in
+    let whole = (oralob_to_string c2, oralob_to_string b2) in
+    orasql sth "drop table tab_lob";
+    oralogoff lda;
+    match (written, whole, streamed) with
+    |((cw, bw), (t, p), s) when cw = String.length text && bw = String.length cat && t = text && p = cat && s = cat -> Pass
+    |((cw, bw), _, _) -> Fail (sprintf "wrote %d and %d bytes, contents do not match" cw bw)
+  with
+    Oci_exception (e_code, e_desc) -> Fail e_desc
+  | Failure s -> Fail s
+
+(* an insert committed on another connection should be notified with the 
+   table, the operation and its ROWID *)
+let test_dcn () =
+  try
+    let lda = oralogon "ociml_test/ociml_test" in
+    let lda2 = oralogon "ociml_test/ociml_test" in
+    let sth = oraopen lda and sth2 = oraopen lda2 in
+    (try orasql sth "drop table tab_dcn" with Oci_exception _ -> ());
+    orasql sth "create table tab_dcn (a integer)";
+    oraparse sth "select a from tab_dcn";
+    let dcn = oradcn_register sth in
+    orasql sth2 "insert into tab_dcn values (1)";
+    oracommit lda2;
+    let evs = oradcn_wait ~timeout:30.0 dcn in
+    oradcn_unregister dcn;
+    let left = oradcn_wait dcn in
+    orasql sth "drop table tab_dcn";
+    oralogoff lda2;
+    oralogoff lda;
+    match List.filter (fun e -> e.dcn_kind = Dcn_object && List.mem Dcn_insert e.dcn_ops) evs with
+    |e::_ when e.dcn_table = "OCIML_TEST.TAB_DCN" && e.dcn_rowid <> "" && left = [] -> Pass
+    |_ -> Fail (sprintf "%d notifications, none for the insert" (List.length evs))
+  with
+    Oci_exception (e_code, e_desc) -> Fail e_desc
+
+(* the second run of a query should come from the cache with the same rows, 
+   and a change committed on another connection should drop it *)
+let test_result_cache () =
+  try
+    let lda = oralogon "ociml_test/ociml_test" in
+    let lda2 = oralogon "ociml_test/ociml_test" in
+    let sth = oraopen lda and sth2 = oraopen lda2 in
+    (try orasql sth "drop table tab_rc" with Oci_exception _ -> ());
+    orasql sth "create table tab_rc (a integer, b varchar2(10))";
+    orasql sth "insert into tab_rc values (1, 'one')";
+    oracommit lda;
+    oraresultcache ~dcn:true sth true;
+    let run () =
+      oraparse sth "select * from tab_rc where a > :1 order by a";
+      orabind sth (Pos 1) (Integer 0);
+      oraexec sth;
+      orafetchall sth in
+    let first = run () in
+    let second = run () in
+    let hits = sth.result_hits in
+    orasql sth2 "insert into tab_rc values (2, 'two')";
+    oracommit lda2;
+    let rec wait n =
+      let rows = run () in
+      if List.length rows = 2 || n = 0 then rows else (Unix.sleepf 0.5; wait (n - 1)) in
+    let third = wait 60 in
+    orasql sth "drop table tab_rc";
+    oralogoff lda2;
+    oralogoff lda;
+    match (first = second, hits, List.length third) with
+    |(true, 1, 2) -> Pass
+    |(same, h, n) -> Fail (sprintf "same rows %b, %d hits, %d rows after the insert" same h n)
+  with
+    Oci_exception (e_code, e_desc) -> Fail e_desc
+
+(* DML with auto_commit set commits without oracommit, and must still drop 
+   what was kept for the login *)
+let test_result_cache_autocommit () =
+  try
+    let lda = oralogon "ociml_test/ociml_test" in
+    let sth = oraopen lda in
+    (try orasql sth "drop table tab_rca" with Oci_exception _ -> ());
+    orasql sth "create table tab_rca (a integer)";
+    orasql sth "insert into tab_rca values (1)";
+    oracommit lda;
+    oraresultcache ~ttl:600.0 sth true;
+    let value () = orasql sth "select a from tab_rca"; orafetch sth in
+    let before = value () in
+    oraautocom lda true;
+    orasql sth "update tab_rca set a = 2";
+    oraautocom lda false;
+    let after = value () in
+    orasql sth "drop table tab_rca";
+    oralogoff lda;
+    match (before, after) with
+    |([|Integer 1|], [|Integer 2|]) -> Pass
+    |_ -> Fail "cached result survived an autocommitted update"
+  with
+    Oci_exception (e_code, e_desc) -> Fail e_desc
+
+(* uncommitted rows are seen by the session that wrote them but never kept 
+   for the other, and are gone again after a rollback *)
+let test_result_cache_transaction () =
+  try
+    let lda = oralogon "ociml_test/ociml_test" in
+    let lda2 = oralogon "ociml_test/ociml_test" in
+    let sth = oraopen lda and sth2 = oraopen lda2 in
+    (try orasql sth "drop table tab_rct" with Oci_exception _ -> ());
+    orasql sth "create table tab_rct (a integer)";
+    orasql sth "insert into tab_rct values (1)";
+    oracommit lda;
+    oraresultcache ~ttl:600.0 sth true;
+    oraresultcache ~ttl:600.0 sth2 true;
+    let count s = orasql s "select * from tab_rct"; List.length (orafetchall s) in
+    let before = count sth in
+    orasql sth "insert into tab_rct values (2)";
+    let own = count sth in
+    let other = count sth2 in
+    oraroll lda;
+    let rolled_back = count sth in
+    orasql sth "insert into tab_rct values (3)";
+    oracommit lda;
+    let committed = count sth2 in
+    orasql sth "drop table tab_rct";
+    oralogoff lda2;
+    oralogoff lda;
+    match (before, own, other, rolled_back, committed) with
+    |(1, 2, 1, 1, 2) -> Pass
+    |(b, o, o2, r, c) -> Fail (sprintf "rows %d before, %d own, %d other, %d after rollback, %d after commit" b o o2 r c)
+  with
+    Oci_exception (e_code, e_desc) -> Fail e_desc
+
 let test_autocommit () = 
   test_transactions_commit true ()
 
@@ -214,6 +906,50 @@ let test_aq_raw () =
   |true -> Pass
   |false -> Fail "Messages do not match"
 
+(* two numbers side by side and a NULL attribute, with the type looked up once 
+   and still cached for the next session of the same login *)
+let test_aq_layout () =
+  let lda = oralogon "ociml_test/ociml_test" in
+  try
+    let msgs = [[|Integer 1; Integer 2|]; [|Null; Integer 3|]; [|Integer 4; Null|]] in
+    List.iter (fun m -> oraenqueue lda "int2_queue" "int2_t" m) msgs;
+    oracommit lda;
+    let deq = List.map (fun _ -> oradequeue lda "int2_queue" "int2_t" [|Integer 0; Integer 0|]) msgs in
+    oracommit lda;
+    oralogoff lda;
+    let cached = sharded_find_opt aq_types (lda.login, "INT2_T") <> None in
+    oraaqtypes_flush lda;
+    let flushed = sharded_find_opt aq_types (lda.login, "INT2_T") = None in
+    match (List.for_all2 (===) msgs deq, cached, flushed) with
+    |(true, true, true) -> Pass
+    |(same, c, f) -> Fail (sprintf "messages match %b, cached %b, flushed %b" same c f)
+  with
+    Oci_exception (e_code, e_desc) -> Fail e_desc
+
+(* a batch each way, then an empty queue once the dequeue timeout is up *)
+let test_aq_array () =
+  let lda = oralogon "ociml_test/ociml_test" in
+  try
+    let msgs = Array.init 10 (fun _ -> rand_aq_msg ()) in
+    let raws = Array.init 5 (fun i -> [|Binary (String.make (100 * (i + 1)) (Char.chr (65 + i)))|]) in
+    oraenqueue_array lda "message_queue" "message_t" msgs;
+    oraenqueue_array lda "image_queue" "RAW" raws;
+    oracommit lda;
+    oradeqtime lda 5;
+    let deq_msgs = oradequeue_array lda ~max:100 "message_queue" "message_t" [|Integer 0; Varchar ""|] in
+    let deq_raws = oradequeue_array lda "image_queue" "RAW" [|Binary ""|] in
+    oracommit lda;
+    oradeqtime lda 1;
+    let empty = try ignore (oradequeue_array lda "message_queue" "message_t" [|Integer 0; Varchar ""|]); false with Not_found -> true in
+    oralogoff lda;
+    let same a b = Array.length a = Array.length b && Array.for_all2 (===) a b in
+    match (same msgs deq_msgs, same raws deq_raws, empty) with
+    |(true, true, true) -> Pass
+    |(m, r, e) -> Fail (sprintf "objects match %b (%d dequeued), raws match %b (%d dequeued), empty %b"
+			 m (Array.length deq_msgs) r (Array.length deq_raws) e)
+  with
+    Oci_exception (e_code, e_desc) -> Fail e_desc
+
 let test_returning () = Todo
 let test_ref_cursors () = Todo
     
@@ -224,25 +960,102 @@ let functional_tests = [
   (test_connect_to_db, "oralogon", "Connection to database");
   (test_simple_select, "oraopen, orasql, orafetch", "SELECT * FROM DUAL;");
   (test_setup_test_table, "oradesc", "Setup test table");
+  (test_oradesc, "oradesc", "Describe the test table");
   (test_transactions_commit false, "oraparse, orabindexec, oracommit", "Test COMMIT and SELECT from another session");
   (test_autocommit, "oraautocom", "Test autocommit mode");
   (test_transactions_rollback, "oraroll", "Test ROLLBACK"); 
   (test_bind_by_name_and_pos, "oraparse, orabind, oraexec", "Test binding by Name and by Pos");
+  (test_streaming_fetch, "orafold, oraiter, oraseq, orafetchall", "Test streaming fetch");
+  (test_columnar_fetch, "orafetch_columnar", "Test columnar fetch into Bigarrays");
+  (test_native_numbers, "oranativenum, orafetchall", "Test native NUMBER defines");
+  (test_describe_cache, "oraparse, oraexec, orafetch", "Test deferred describe and describe cache");
+  (test_stmt_cache, "orastmtcache, oraparse", "Test statement cache");
+  (test_stmt_cache_columnar, "orastmtcache, orafetch_columnar", "Test statement cache after a columnar fetch");
+  (test_rebind_in_place, "orabind, oraexec", "Test binding again for each execute");
+  (test_bulk_columns, "orabindexec, orabindexec_columns", "Test bulk insert with NULLs and growing strings");
+  (test_long_bind, "orabindexec", "Refuse strings too long to bind");
+  (test_batch_errors, "orabindexec_batch_errors", "Test per-row errors in bulk insert");
+  (test_bulkload, "orabulkload", "Test streaming bulk insert");
+  (test_dirpath, "oradpopen, oradpload, oradpfinish", "Test direct path load");
+  (test_epoch_dates, "oraepochdates, orafetch", "Test DATEs fetched as Datetime and as epoch");
+  (test_dst_binds, "orabind, orabindexec", "Test binding local times either side of DST changes");
+  (test_session_pool, "orapool_acquire, orapool_release", "Test session pool");
+  (test_logon_many, "oralogon_many", "Test parallel logon");
+  (test_logon_many_fail, "oralogon_many", "Test parallel logon with a bad password");
+  (test_domains, "oraopen, oraclose", "Test connections in parallel domains");
+  (test_async, "oraexec_async, orafetch_async, oracommit_async", "Test non-blocking calls");
+  (test_async_cancel, "oracancel", "Test a cancelled call leaves the statement usable");
+  (test_lob, "oralob_write_seq, oralob_seq, oralob_to_string", "Test LOBs");
+  (test_dcn, "oradcn_register, oradcn_wait", "Test change notification");
+  (test_result_cache, "oraresultcache", "Test result cache");
+  (test_result_cache_autocommit, "oraresultcache, oraautocom", "Test result cache after autocommitted DML");
+  (test_result_cache_transaction, "oraresultcache, oraroll, oracommit", "Test result cache inside transactions");
   (test_aq, "oraenqueue, oradequeue", "Test AQ");
   (test_aq_raw, "oraenqueue, oradequeue", "Test AQ (Raw, requires lynx.jpg)");
+  (test_aq_array, "oraenqueue_array, oradequeue_array", "Test array AQ");
+  (test_aq_layout, "oraenqueue, oradequeue", "Test AQ payload layout and NULLs");
   (test_returning, "orabindout", "Test the RETURNING/stored procedure syntax");
   (test_ref_cursors, "orabindout, orafetch", "Test cursor variables (REF CURSOR)");
   (test_drop_test_table, "", "Drop test table") ;
 ]
 
+(* the same small query run n times, from the server each time or answered 
+   from the result cache after the first *)
+let test_result_cache_performance cached n () =
+  let lda = oralogon "ociml_test/ociml_test" in
+  let sth = oraopen lda in
+  oraresultcache sth cached;
+  let t1 = gettimeofday () in
+  for i = 1 to n do
+    orasql sth "select * from tab1 where rownum <= 10";
+    ignore (orafetchall sth)
+  done;
+  let t2 = gettimeofday () -. t1 in
+  oralogoff lda;
+  Time (t2, float_of_int n /. t2)
+
+(* n messages through a queue, one per call or batch per call *)
+let test_aq_performance n batch () =
+  let lda = oralogon "ociml_test/ociml_test" in
+  let msgs = Array.init batch (fun _ -> rand_aq_msg ()) in
+  let t1 = gettimeofday () in
+  for i = 1 to n / batch do
+    if batch = 1 then oraenqueue lda "message_queue" "message_t" msgs.(0)
+    else oraenqueue_array lda "message_queue" "message_t" msgs
+  done;
+  oracommit lda;
+  let left = ref n in
+  while !left > 0 do
+    if batch = 1 then (ignore (oradequeue lda "message_queue" "message_t" [|Integer 0; Varchar ""|]); decr left)
+    else left := !left - Array.length (oradequeue_array lda ~max:batch "message_queue" "message_t" [|Integer 0; Varchar ""|])
+  done;
+  oracommit lda;
+  let t2 = gettimeofday () -. t1 in
+  oralogoff lda;
+  Time (t2, float_of_int n /. t2)
+
 let performance_tests = [ 
   ((test_bulk_insert_performance 10000 1), "Bulk insert performance: 10000 rows, 1 row per batch");
   ((test_bulk_insert_performance 10000 10), "Bulk insert performance: 10000 rows, 10 rows per batch");
   ((test_bulk_insert_performance 10000 100), "Bulk insert performance: 10000 rows, 100 rows per batch");
   ((test_bulk_insert_performance 10000 1000), "Bulk insert performance: 10000 rows, 1000 rows per batch");
   ((test_bulk_insert_performance 10000 10000), "Bulk insert performance: 10000 rows, 10000 rows per batch");
+  ((test_bulkload_performance 10000 1000), "Streaming bulk load: 10000 rows, 1000 rows per batch");
+  ((test_logon_performance 32 false), "Logon performance: 32 connections one at a time");
+  ((test_logon_performance 32 true), "Logon performance: 32 connections at once");
    ((test_prefetch_performance 1), "Testing prefetch 1 row per fetch");
   ((test_prefetch_performance 10), "Testing prefetch 10 rows per fetch");
+  ((test_batch_fetch_performance 100), "Testing array fetch 100 rows per fetch");
+  ((test_batch_fetch_performance 1000), "Testing array fetch 1000 rows per fetch");
+  ((test_threaded_fetch_performance 1 10), "Threaded fetch: 1 connection, 10 rows per fetch");
+  ((test_threaded_fetch_performance 4 10), "Threaded fetch: 4 connections, 10 rows per fetch");
+  ((test_threaded_fetch_performance 16 10), "Threaded fetch: 16 connections, 10 rows per fetch");
+  ((test_domain_fetch_performance 1 100), "Domain fetch: 1 connection, 100 rows per fetch");
+  ((test_domain_fetch_performance 4 100), "Domain fetch: 4 connections, 100 rows per fetch");
+  ((test_result_cache_performance false 1000), "Result cache: 1000 queries, not cached");
+  ((test_result_cache_performance true 1000), "Result cache: 1000 queries, cached");
+  ((test_aq_performance 10000 1), "AQ: 10000 messages, 1 per call");
+  ((test_aq_performance 10000 100), "AQ: 10000 messages, 100 per call");
 ]
 
 let () =
@@ -112,11 +112,11 @@ let rand_aq_msg () =
 let slurp_channel channel =
   let buffer_size = 4096 in
   let buffer = Buffer.create buffer_size in
-  let string = String.create buffer_size in
+  let bytes = Bytes.create buffer_size in
   let chars_read = ref 1 in
   while !chars_read <> 0 do
-    chars_read := input channel string 0 buffer_size;
-    Buffer.add_substring buffer string 0 !chars_read
+    chars_read := input channel bytes 0 buffer_size;
+    Buffer.add_subbytes buffer bytes 0 !chars_read
   done;
   Buffer.contents buffer
      